@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "hash.h"
+struct e { int k; HASH_ENTRY(e) h; };
+HASH_HEAD(th, e, h);
+HASH_GENERATE_INT(e, h, k);
+int main(void){
+  struct th t; HASH_INIT(&t, e, h);
+  struct e a = {.k = 42}, *f, *g;
+  HASH_FIND_OR_INSERT(&t, e, h, &a, g);
+  f = HASH_FIND(&t, e, h, &a.k);
+  printf("foi: found=%p expect=%p\n", (void*)f, (void*)&a);
+  return 0;
+}
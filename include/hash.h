@@ -99,6 +99,17 @@ typedef unsigned char uint8_t;
 #define HASH_INITIAL_NUM_BUCKETS_LOG2 5  /* lg2 of initial number of buckets */
 #define HASH_BKT_CAPACITY_THRESH 10      /* expand when bucket count reaches */
 
+/* minimum number of buckets to rehash in parallel if ops->parallel_for is set */
+#ifndef HASH_PARALLEL_EXPAND_THRESH
+#define HASH_PARALLEL_EXPAND_THRESH 65536
+#endif
+
+#if !defined(_HASH_USE_CLOSED) && !defined(_HASH_USE_CLOSED_LOCKFREE) &&     \
+    !defined(_HASH_USE_CUCKOO) && !defined(_HASH_USE_HOPSCOTCH) &&             \
+    !defined(_HASH_USE_EXTENDIBLE)
+#define _HASH_USE_CHAINED 1
+#endif
+
 /* random signature used only to find hash tables in external analysis */
 #define HASH_SIGNATURE 0xa0111fe1
 #define HASH_BLOOM_SIGNATURE 0xb12220f2
@@ -106,6 +117,244 @@ typedef unsigned char uint8_t;
 #ifndef HASH_TYPE
 #define HASH_TYPE uint32_t
 #endif
+
+/* Monotonic clock used to measure resize pauses */
+#ifndef HASH_CLOCK_NS
+#include <time.h>
+static inline uint64_t _HU_FUNCTION(_hash_clock_ns)(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define HASH_CLOCK_NS() _hash_clock_ns()
+#endif
+
+/*
+ * Statistics of a table returned by HASH_STATS. Histograms have
+ * HASH_STATS_HIST_SIZE slots, the last one counts all longer sequences:
+ * - chain_hist: buckets by the length of their chain (chained table only);
+ * - probe_hist: elements by the number of nodes compared to find them;
+ * - sampled_hist: sampled lookups by the number of nodes compared, filled if
+ *   HASH_PROBE_STATS is defined.
+ */
+#ifndef HASH_STATS_HIST_SIZE
+#define HASH_STATS_HIST_SIZE 16
+#endif
+
+typedef struct hash_stats_s {
+  unsigned num_items;
+  unsigned num_buckets;
+  unsigned empty_buckets;
+  unsigned deleted_buckets;
+  unsigned max_chain;
+  double load_factor;
+  unsigned chain_hist[HASH_STATS_HIST_SIZE];
+  unsigned probe_hist[HASH_STATS_HIST_SIZE];
+  unsigned expands;
+  uint64_t expand_ns;
+  unsigned ideal_chain_maxlen;
+  unsigned nonideal_items;
+  unsigned ineff_expands, noexpand;
+  uint64_t sampled_probes;
+  unsigned sampled_hist[HASH_STATS_HIST_SIZE];
+} hash_stats_t;
+
+/* Accumulate statistics of a part of a table (e.g. of a shard) to `dst` */
+static void _HU_FUNCTION(hash_stats_merge)(hash_stats_t *dst,
+    const hash_stats_t *src)
+{
+  dst->num_items += src->num_items;
+  dst->num_buckets += src->num_buckets;
+  dst->empty_buckets += src->empty_buckets;
+  dst->deleted_buckets += src->deleted_buckets;
+  if (src->max_chain > dst->max_chain) dst->max_chain = src->max_chain;
+  if (src->ideal_chain_maxlen > dst->ideal_chain_maxlen)
+    dst->ideal_chain_maxlen = src->ideal_chain_maxlen;
+  for (unsigned i = 0; i < HASH_STATS_HIST_SIZE; i ++) {
+    dst->chain_hist[i] += src->chain_hist[i];
+    dst->probe_hist[i] += src->probe_hist[i];
+    dst->sampled_hist[i] += src->sampled_hist[i];
+  }
+  dst->expands += src->expands;
+  dst->expand_ns += src->expand_ns;
+  dst->nonideal_items += src->nonideal_items;
+  dst->ineff_expands += src->ineff_expands;
+  dst->noexpand += src->noexpand;
+  dst->sampled_probes += src->sampled_probes;
+  dst->load_factor = dst->num_buckets ?
+      (double)dst->num_items / dst->num_buckets : 0;
+}
+
+#define _HASH_STATS_HIST_ADD(hist, n)                                          \
+  ((hist)[(n) < HASH_STATS_HIST_SIZE ? (n) : HASH_STATS_HIST_SIZE - 1] ++)
+
+/*
+ * Probe lengths of one in 2^HASH_PROBE_SAMPLE_LOG2 lookups of each thread are
+ * added to the table counters by relaxed atomics, so the overhead of sampling
+ * is a thread local increment per lookup
+ */
+#ifdef HASH_PROBE_STATS
+#ifndef HASH_PROBE_SAMPLE_LOG2
+#define HASH_PROBE_SAMPLE_LOG2 6
+#endif
+static __thread unsigned _hash_probe_tick __attribute__((__unused__));
+#define _HASH_PROBE_FIELDS                                                     \
+   uint64_t sampled_probes;                                                    \
+   unsigned sampled_hist[HASH_STATS_HIST_SIZE];
+#define _HASH_PROBE_SAMPLE(cnt, probes) do {                                   \
+  if ((++_hash_probe_tick & ((1U << HASH_PROBE_SAMPLE_LOG2) - 1)) == 0) {      \
+    unsigned _pn = (probes);                                                   \
+    __atomic_fetch_add(&(cnt)->sampled_probes, _pn, __ATOMIC_RELAXED);         \
+    __atomic_fetch_add(&(cnt)->sampled_hist[_pn < HASH_STATS_HIST_SIZE ?       \
+        _pn : HASH_STATS_HIST_SIZE - 1], 1, __ATOMIC_RELAXED);                 \
+  }                                                                            \
+} while(0)
+#define _HASH_PROBE_COLLECT(cnt, st) do {                                      \
+  (st)->sampled_probes += __atomic_load_n(&(cnt)->sampled_probes,              \
+      __ATOMIC_RELAXED);                                                       \
+  for (unsigned _k = 0; _k < HASH_STATS_HIST_SIZE; _k ++)                      \
+    (st)->sampled_hist[_k] += __atomic_load_n(&(cnt)->sampled_hist[_k],        \
+        __ATOMIC_RELAXED);                                                     \
+} while(0)
+#else
+#define _HASH_PROBE_FIELDS
+#define _HASH_PROBE_SAMPLE(cnt, probes) do { (void)(probes); } while(0)
+#define _HASH_PROBE_COLLECT(cnt, st) do {} while(0)
+#endif
+
+/*
+ * Thread local front cache of lookups, enabled by HASH_FRONT_CACHE defined
+ * before hash.h. Found elements are remembered by hash values in a direct
+ * mapped array of HASH_FRONT_SIZE entries per thread and type, and are
+ * returned without locks whilst the table generation and the version of
+ * their stripe are unchanged. Insertions and removals increment the version
+ * of a stripe under a bucket lock. Stripes are selected by low bits of a hash
+ * value and are stored in a head, so they are never freed by expansions.
+ * Entries are keyed by a process wide table id assigned by HASH_MAKE_TABLE
+ * rather than by a head address, so a head destroyed and made again (or a
+ * new head at the same address) never matches entries of its previous table.
+ * As cached elements are read without locks, removed elements must be freed
+ * by deferred reclamation or reference counting rather than at once
+ */
+#ifndef HASH_FRONT_STRIPES
+#define HASH_FRONT_STRIPES 256
+#endif
+#define _HASH_FRONT_BUMP_VER(vers, hv) do {                                    \
+  if ((vers) != NULL) {                                                        \
+    __atomic_fetch_add(&(vers)[(hv) & (HASH_FRONT_STRIPES - 1)], 1,            \
+        __ATOMIC_RELEASE);                                                     \
+  }                                                                            \
+} while(0)
+#ifdef HASH_FRONT_CACHE
+#if !defined(_HASH_USE_CHAINED) || defined(_HASH_USE_CHAINED_LOCKFREE)
+#error "HASH_FRONT_CACHE works with the locked chained table only"
+#endif
+#ifndef HASH_FRONT_SIZE
+#define HASH_FRONT_SIZE 2048
+#endif
+/* Weak, so all translation units share a single counter */
+uint64_t _hash_front_ids __attribute__((__weak__));
+#define _HASH_FRONT_FIELDS                                                     \
+   uint64_t front_id;                                                          \
+   unsigned front_ver[HASH_FRONT_STRIPES];
+#define _HASH_FRONT_VERSIONS(head) ((head)->front_ver)
+#define _HASH_FRONT_NEW_ID(head)                                               \
+  ((head)->front_id = __atomic_add_fetch(&_hash_front_ids, 1, __ATOMIC_RELAXED))
+#define _HASH_FRONT_BUMP(head, hv)                                             \
+  __atomic_fetch_add(&(head)->front_ver[(hv) & (HASH_FRONT_STRIPES - 1)], 1,   \
+      __ATOMIC_RELEASE)
+#define _HASH_FRONT_GENERATE(type, field)                                      \
+  static __thread struct {                                                     \
+    uint64_t id;                                                               \
+    struct type *node;                                                         \
+    HASH_TYPE hval;                                                            \
+    unsigned gen, ver;                                                         \
+  } _hash_front_##type##_##field[HASH_FRONT_SIZE] __attribute__((__unused__));
+#define _HASH_FRONT_ENTRY(type, field, h)                                      \
+  (&_hash_front_##type##_##field[(h) & (HASH_FRONT_SIZE - 1)])
+/*
+ * The node is compared without locks, so the stripe version is checked again
+ * afterwards: a node removed meanwhile is not returned, but it could still be
+ * compared just after its removal, hence the reclamation rule above
+ */
+#define _HASH_FRONT_LOOKUP(head, type, field, elm, h, found) do {              \
+  __typeof__(_HASH_FRONT_ENTRY(type, field, h)) _fe =                          \
+      _HASH_FRONT_ENTRY(type, field, h);                                       \
+  unsigned *_fver = &(head)->front_ver[(h) & (HASH_FRONT_STRIPES - 1)];        \
+  (found) = NULL;                                                              \
+  if (_fe->id == (head)->front_id && _fe->hval == (h) &&                       \
+      _fe->gen == __atomic_load_n(&(head)->generation, __ATOMIC_ACQUIRE) &&    \
+      _fe->ver == __atomic_load_n(_fver, __ATOMIC_ACQUIRE) &&                  \
+      (head)->ops->hash_cmp((elm), _fe->node, (head)->ops->hashd) == 0) {      \
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);                                   \
+    if (_fe->ver == __atomic_load_n(_fver, __ATOMIC_RELAXED) &&                \
+        _fe->gen == __atomic_load_n(&(head)->generation, __ATOMIC_RELAXED)) {  \
+      (found) = _fe->node;                                                     \
+    }                                                                          \
+  }                                                                            \
+} while(0)
+/* Called with the bucket of `elt` locked, so its stripe version is stable */
+#define _HASH_FRONT_STORE(head, type, field, elt, h) do {                      \
+  __typeof__(_HASH_FRONT_ENTRY(type, field, h)) _fe =                          \
+      _HASH_FRONT_ENTRY(type, field, h);                                       \
+  _fe->id = (head)->front_id;                                                  \
+  _fe->node = (elt);                                                           \
+  _fe->hval = (h);                                                             \
+  _fe->gen = __atomic_load_n(&(head)->generation, __ATOMIC_RELAXED);           \
+  _fe->ver = __atomic_load_n(&(head)->front_ver[(h) &                          \
+      (HASH_FRONT_STRIPES - 1)], __ATOMIC_RELAXED);                            \
+} while(0)
+#else
+#define _HASH_FRONT_FIELDS
+#define _HASH_FRONT_VERSIONS(head) ((unsigned *)NULL)
+#define _HASH_FRONT_NEW_ID(head) do {} while(0)
+#define _HASH_FRONT_BUMP(head, hv) do {} while(0)
+#define _HASH_FRONT_GENERATE(type, field)
+#define _HASH_FRONT_LOOKUP(head, type, field, elm, h, found) ((found) = NULL)
+#define _HASH_FRONT_STORE(head, type, field, elt, h) do {} while(0)
+#endif
+
+/*
+ * Self-adjusting chains, enabled by HASH_MOVE_TO_FRONT defined before hash.h.
+ * One in 2^HASH_MTF_SAMPLE_LOG2 lookups of each thread that find an element
+ * behind the head of its chain moves it (with the run of its equal keys) to
+ * the head. The bucket is only try-locked for writing after the read lock is
+ * released, so lookups never wait for it and a busy bucket is left as is
+ */
+#ifdef HASH_MOVE_TO_FRONT
+#if !defined(_HASH_USE_CHAINED) || defined(_HASH_USE_CHAINED_LOCKFREE)
+#error "HASH_MOVE_TO_FRONT works with the locked chained table only"
+#endif
+#ifndef HASH_MTF_SAMPLE_LOG2
+#define HASH_MTF_SAMPLE_LOG2 3
+#endif
+static __thread unsigned _hash_mtf_tick __attribute__((__unused__));
+/* Called with the table read locked and `bkt` unlocked */
+#define _HASH_MTF(head, type, field, bkt, elt, h) do {                         \
+  if ((++_hash_mtf_tick & ((1U << HASH_MTF_SAMPLE_LOG2) - 1)) == 0 &&          \
+      HASH_TRYLOCK_NODE_WRITE(head, bkt)) {                                    \
+    struct type *_mprev = NULL, *_mcur = (struct type *)(bkt)->first, *_mlast; \
+    while (_mcur != NULL && _mcur != (elt)) {                                  \
+      _mprev = _mcur;                                                          \
+      _mcur = _mcur->field.next;                                               \
+    }                                                                          \
+    if (_mcur != NULL && _mprev != NULL) {                                     \
+      _mlast = _mcur;                                                          \
+      while (_mlast->field.next != NULL &&                                     \
+          _HASH_KEY_EQ(head, field, _mcur, _mlast->field.next, (h))) {         \
+        _mlast = _mlast->field.next;                                           \
+      }                                                                        \
+      _mprev->field.next = _mlast->field.next;                                 \
+      _mlast->field.next = (struct type *)(bkt)->first;                        \
+      (bkt)->first = (void *)_mcur;                                            \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, bkt);                                         \
+  }                                                                            \
+} while(0)
+#else
+#define _HASH_MTF(head, type, field, bkt, elt, h) do {} while(0)
+#endif
 /*
  * Operations structure, defines all common functions aplicable to a hash table
  */
@@ -128,6 +377,7 @@ struct  _hash_ops_##type##_##field {                                           \
   void (*lockn_read_lock)(void *l, void *d);                                    \
   void (*lockn_read_unlock)(void *l, void *d);                                  \
   void (*lockn_write_lock)(void *l, void *d);                                   \
+  int (*lockn_write_trylock)(void *l, void *d);                                \
   void (*lockn_write_unlock)(void *l, void *d);                                 \
   void (*lockn_destroy)(void *l, void *d);                                      \
   void *locknd;                                                                 \
@@ -139,6 +389,12 @@ struct  _hash_ops_##type##_##field {                                           \
   void *(*alloc)(size_t len, void *d);                                         \
   void (*free)(size_t len, void *p, void *d);                                 \
   void *allocd;                                                                \
+  void (*parallel_for)(size_t n, void (*fn)(void *arg, size_t start, size_t end), \
+      void *arg, void *d);                                                     \
+  void *paralleld;                                                             \
+  void (*on_expand)(unsigned old_num, unsigned new_num, unsigned items,        \
+      uint64_t ns, void *d);                                                   \
+  void *expandd;                                                               \
 }
 #endif
 /*
@@ -174,6 +430,10 @@ typedef struct _hash_node_s {
    unsigned num_items;                                                         \
    unsigned need_expand;                                                       \
    unsigned generation;                                                        \
+   unsigned expands;                                                           \
+   uint64_t expand_ns;                                                         \
+   _HASH_PROBE_FIELDS                                                          \
+   _HASH_FRONT_FIELDS                                                          \
    uint32_t signature; /* used only to find hash tables in external analysis */\
    uint8_t *bloom_bv;                                                          \
    char bloom_nbits;                                                           \
@@ -184,11 +444,15 @@ typedef struct _hash_node_s {
 /*
  * Prior to using of this macro, one should define ops structure with
  * HASH_GENERATE_*(type, field);
+ * The hash function is seeded here rather than by HASH_MAKE_TABLE, so hash
+ * values computed before the first insertion (HASH_HASH, HASH_INSERT_HV) are
+ * the same as those of the table
  */
 #ifndef HASH_INIT
 #define HASH_INIT(head, type, field) do {                                     \
   memset((head), 0, sizeof((*head)));                                         \
   (head)->ops = &_hash_ops_##type##_##field_glob;                             \
+  if ((head)->ops->hash_init) (head)->ops->hash_init((head)->ops->hashd);     \
 } while(0);
 #endif
 
@@ -196,6 +460,7 @@ typedef struct _hash_node_s {
 #define HASH_INIT_OPS(head, ops) do {                                         \
   memset((head), 0, sizeof((*head)));                                         \
   memcpy(&(head)->ops, ops, sizeof((head)->ops));                             \
+  if ((head)->ops->hash_init) (head)->ops->hash_init((head)->ops->hashd);     \
 } while(0);
 #endif
 
@@ -240,6 +505,15 @@ typedef struct _hash_node_s {
      (head)->ops->lockn_write_unlock((node)->lock, (head)->ops->locknd);                 \
    }                                                                           \
 } while(0)
+/*
+ * Non-zero if the node is write locked now. Fails without waiting when the
+ * lock is busy or ops have no `lockn_write_trylock`; a table without locks at
+ * all is always "locked"
+ */
+#define HASH_TRYLOCK_NODE_WRITE(head, node)                                    \
+  ((node)->lock ? ((head)->ops->lockn_write_trylock != NULL &&                 \
+      (head)->ops->lockn_write_trylock((node)->lock,                           \
+        (head)->ops->locknd) == 0) : (head)->resize_lock == NULL)
 
 /* Allocating methods */
 #ifndef HASH_ALLOC_NODES
@@ -269,25 +543,292 @@ typedef struct _hash_node_s {
 #endif
 
 /* Basic ops */
+/*
+ * Counter of items is updated under the read lock of a table, so it is changed
+ * atomically when a table is locked
+ */
+#define _HASH_ITEMS_ADD(head, n) do {                                          \
+  if ((head)->resize_lock)                                                     \
+    __atomic_fetch_add(&(head)->num_items, (n), __ATOMIC_RELAXED);             \
+  else (head)->num_items += (n);                                               \
+} while(0)
+#define _HASH_ITEMS_SUB(head, n) do {                                          \
+  if ((head)->resize_lock)                                                     \
+    __atomic_fetch_sub(&(head)->num_items, (n), __ATOMIC_RELAXED);             \
+  else (head)->num_items -= (n);                                               \
+} while(0)
+
 #ifndef HASH_INSERT
 #define HASH_INSERT(head, type, field, elm) do {                               \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  HASH_INSERT_HV(head, type, field, elm, _hv);                                 \
+} while(0)
+#endif
+
+/*
+ * _HV variants accept a hash value computed by HASH_HASH or HASH_HASH_ELT and
+ * skip hashing.
+ * Table read lock is held until a bucket is unlocked, so an expansion never
+ * runs whilst some bucket is in use
+ */
+#ifndef HASH_INSERT_HV
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  _hash_node_t *_bkt;                                                          \
+  unsigned _gen;                                                               \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  (elm)->field.hv = (h);                                                       \
+  HASH_LOCK_READ(head);                                                        \
+  _gen = (head)->generation;                                                   \
+  _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (elm)->field.hv); \
+  HASH_LOCK_NODE_WRITE(head, _bkt);                                            \
+  HASH_INSERT_BKT(_bkt, type, field, elm);                                     \
+  _HASH_FRONT_BUMP(head, (elm)->field.hv);                                     \
+  if (_bkt->entries >= ((_bkt->expand_mult+1) * HASH_BKT_CAPACITY_THRESH) &&   \
+    (head)->need_expand != 2) {                                                \
+    (head)->need_expand = 1;                                                   \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, _bkt);                                          \
+  _HASH_ITEMS_ADD(head, 1);                                                    \
+  HASH_UNLOCK_READ(head);                                                      \
+  if ((head)->need_expand == 1) {                                              \
+        _HASH_EXPAND_BUCKETS_GEN(head, type, field, _gen);                     \
+  }                                                                            \
+} while(0)
+#endif
+
+/*
+ * Insert `elm` unless an element with the same key exists. Hashing, lookup and
+ * insertion are done once under a single bucket lock. `found` is set to the
+ * existing element or to NULL if `elm` has been inserted
+ */
+#ifndef HASH_FIND_OR_INSERT
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_FIND_OR_INSERT_HV(head, type, field, elm, _hv, found, (void)0);        \
+} while(0)
+#endif
+
+/*
+ * Insert `elm` or call `merge_cb(existing, elm)` whilst the bucket of an
+ * existing element is locked. `elm` is not inserted in the latter case
+ */
+#ifndef HASH_UPSERT
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _hv;                                                               \
+  struct type *_uelt;                                                          \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_FIND_OR_INSERT_HV(head, type, field, elm, _hv, _uelt,                  \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+#endif
+
+#ifndef HASH_FIND_OR_INSERT_HV
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found, (void)0)
+#endif
+
+#ifndef HASH_UPSERT_HV
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, _uelt,                    \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+#endif
+
+/* `on_found` is executed with `_telt` pointing to the existing element */
+#define _HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found, on_found) do { \
+  _hash_node_t *_bkt;                                                          \
+  struct type *_telt;                                                          \
+  unsigned _gen, _probes = 0;                                                  \
   if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  HASH_LOCK_READ(head);                                                        \
+  _gen = (head)->generation;                                                   \
+  _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));             \
+  HASH_LOCK_NODE_WRITE(head, _bkt);                                            \
+  _telt = (struct type *)_bkt->first;                                          \
+  while (_telt != NULL && (_telt->field.hv != (h) ||                           \
+      (head)->ops->hash_cmp((elm), _telt, (head)->ops->hashd) != 0)) {         \
+    _telt = _telt->field.next;                                                 \
+    _probes ++;                                                                \
+  }                                                                            \
+  _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                         \
+  if (_telt != NULL) {                                                         \
+    on_found;                                                                  \
+  }                                                                            \
+  else {                                                                       \
+    (elm)->field.hv = (h);                                                     \
+    HASH_INSERT_BKT(_bkt, type, field, elm);                                   \
+    _HASH_FRONT_BUMP(head, (h));                                               \
+    if (_bkt->entries >= ((_bkt->expand_mult+1) * HASH_BKT_CAPACITY_THRESH) && \
+      (head)->need_expand != 2) {                                              \
+      (head)->need_expand = 1;                                                 \
+    }                                                                          \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, _bkt);                                          \
+  if (_telt == NULL) _HASH_ITEMS_ADD(head, 1);                                 \
+  HASH_UNLOCK_READ(head);                                                      \
+  (found) = _telt;                                                             \
+  if (_telt == NULL && (head)->need_expand == 1) {                             \
+    _HASH_EXPAND_BUCKETS_GEN(head, type, field, _gen);                         \
+  }                                                                            \
+} while(0)
+
+/*
+ * Multimap operations. HASH_INSERT_MULTI links `elm` right after the first
+ * element with an equal key, so all elements with one key form a contiguous
+ * run of a chain. Expansions keep runs contiguous but reverse them, so the
+ * order of elements within a run is unspecified. HASH_FIND_ALL calls
+ * `func(elt, data)` for every element of the run of `elm` (returning 0 stops
+ * the walk) with the bucket read locked, HASH_COUNT_KEY counts them and
+ * HASH_DELETE_ALL unlinks the run and passes its elements to `free_func`
+ * after the bucket is unlocked. Duplicates inserted by HASH_INSERT or
+ * HASH_BUILD_PARALLEL are not grouped.
+ */
+#define _HASH_KEY_EQ(head, field, elm, elt, h)                                 \
+  ((elt)->field.hv == (h) &&                                                   \
+    (head)->ops->hash_cmp((elm), (elt), (head)->ops->hashd) == 0)
+
+#ifndef HASH_INSERT_MULTI
+#define HASH_INSERT_MULTI(head, type, field, elm) do {                         \
   HASH_TYPE _hv;                                                               \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
   _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
-  (elm)->field.hv = _hv;                                                       \
+  HASH_INSERT_MULTI_HV(head, type, field, elm, _hv);                           \
+} while(0)
+#endif
+
+#ifndef HASH_INSERT_MULTI_HV
+#define HASH_INSERT_MULTI_HV(head, type, field, elm, h) do {                   \
+  _hash_node_t *_bkt;                                                          \
+  struct type *_telt;                                                          \
+  unsigned _gen, _probes = 0;                                                  \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  (elm)->field.hv = (h);                                                       \
   HASH_LOCK_READ(head);                                                        \
-  _hash_node_t *bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv); \
-  HASH_LOCK_NODE_WRITE(head, bkt);                                             \
-  (head)->num_items++;                                                         \
-  if (bkt->entries + 1 >= ((bkt->expand_mult+1) * HASH_BKT_CAPACITY_THRESH) && \
+  _gen = (head)->generation;                                                   \
+  _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));             \
+  HASH_LOCK_NODE_WRITE(head, _bkt);                                            \
+  _telt = (struct type *)_bkt->first;                                          \
+  while (_telt != NULL && !_HASH_KEY_EQ(head, field, elm, _telt, h)) {         \
+    _telt = _telt->field.next;                                                 \
+    _probes ++;                                                                \
+  }                                                                            \
+  _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                         \
+  if (_telt != NULL) {                                                         \
+    (elm)->field.next = _telt->field.next;                                     \
+    _telt->field.next = (elm);                                                 \
+    _bkt->entries ++;                                                          \
+  }                                                                            \
+  else {                                                                       \
+    HASH_INSERT_BKT(_bkt, type, field, elm);                                   \
+  }                                                                            \
+  _HASH_FRONT_BUMP(head, (h));                                                 \
+  if (_bkt->entries >= ((_bkt->expand_mult+1) * HASH_BKT_CAPACITY_THRESH) &&   \
     (head)->need_expand != 2) {                                                \
     (head)->need_expand = 1;                                                   \
   }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, _bkt);                                          \
+  _HASH_ITEMS_ADD(head, 1);                                                    \
   HASH_UNLOCK_READ(head);                                                      \
-  HASH_INSERT_BKT(bkt, type, field, elm);                                      \
-  HASH_UNLOCK_NODE_WRITE(head, bkt);                                           \
   if ((head)->need_expand == 1) {                                              \
-        HASH_EXPAND_BUCKETS(head, type, field);                                \
+    _HASH_EXPAND_BUCKETS_GEN(head, type, field, _gen);                         \
+  }                                                                            \
+} while(0)
+#endif
+
+#ifndef HASH_FIND_ALL
+#define HASH_FIND_ALL(head, type, field, elm, func, data) do {                 \
+  if ((head)->buckets != NULL) {                                               \
+    HASH_TYPE _hv;                                                             \
+    _hash_node_t *_bkt;                                                        \
+    struct type *_telt;                                                        \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_LOCK_READ(head);                                                      \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv);           \
+    HASH_LOCK_NODE_READ(head, _bkt);                                           \
+    _telt = (struct type *)_bkt->first;                                        \
+    while (_telt != NULL && !_HASH_KEY_EQ(head, field, elm, _telt, _hv)) {     \
+      _telt = _telt->field.next;                                               \
+    }                                                                          \
+    while (_telt != NULL && _HASH_KEY_EQ(head, field, elm, _telt, _hv)) {      \
+      if (!(func)(_telt, data)) break;                                         \
+      _telt = _telt->field.next;                                               \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(head, _bkt);                                         \
+    HASH_UNLOCK_READ(head);                                                    \
+  }                                                                            \
+} while(0)
+#endif
+
+#ifndef HASH_COUNT_KEY
+#define HASH_COUNT_KEY(head, type, field, elm, cnt) do {                       \
+  (cnt) = 0;                                                                   \
+  if ((head)->buckets != NULL) {                                               \
+    HASH_TYPE _hv;                                                             \
+    _hash_node_t *_bkt;                                                        \
+    struct type *_telt;                                                        \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_LOCK_READ(head);                                                      \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv);           \
+    HASH_LOCK_NODE_READ(head, _bkt);                                           \
+    _telt = (struct type *)_bkt->first;                                        \
+    while (_telt != NULL && !_HASH_KEY_EQ(head, field, elm, _telt, _hv)) {     \
+      _telt = _telt->field.next;                                               \
+    }                                                                          \
+    for (; _telt != NULL && _HASH_KEY_EQ(head, field, elm, _telt, _hv);        \
+        _telt = _telt->field.next) {                                           \
+      (cnt) ++;                                                                \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(head, _bkt);                                         \
+    HASH_UNLOCK_READ(head);                                                    \
+  }                                                                            \
+} while(0)
+#endif
+
+#ifndef HASH_DELETE_ALL
+#define HASH_DELETE_ALL(head, type, field, elm, free_func) do {                \
+  if ((head)->buckets != NULL) {                                               \
+    HASH_TYPE _hv;                                                             \
+    _hash_node_t *_bkt;                                                        \
+    struct type *_telt, *_prev = NULL, *_run, *_last = NULL;                   \
+    unsigned _removed = 0;                                                     \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_LOCK_READ(head);                                                      \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv);           \
+    HASH_LOCK_NODE_WRITE(head, _bkt);                                          \
+    _telt = (struct type *)_bkt->first;                                        \
+    while (_telt != NULL && !_HASH_KEY_EQ(head, field, elm, _telt, _hv)) {     \
+      _prev = _telt;                                                           \
+      _telt = _telt->field.next;                                               \
+    }                                                                          \
+    _run = _telt;                                                              \
+    while (_telt != NULL && _HASH_KEY_EQ(head, field, elm, _telt, _hv)) {      \
+      _last = _telt;                                                           \
+      _telt = _telt->field.next;                                               \
+      _removed ++;                                                             \
+    }                                                                          \
+    if (_removed > 0) {                                                        \
+      if (_prev != NULL) _prev->field.next = _telt;                            \
+      else _bkt->first = (void *)_telt;                                        \
+      _last->field.next = NULL;                                                \
+      _bkt->entries -= _removed;                                               \
+      _HASH_FRONT_BUMP(head, _hv);                                             \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, _bkt);                                        \
+    if (_removed > 0) _HASH_ITEMS_SUB(head, _removed);                         \
+    HASH_UNLOCK_READ(head);                                                    \
+    while (_run != NULL && _removed -- > 0) {                                  \
+      _telt = _run->field.next;                                                \
+      _run->field.next = NULL;                                                 \
+      if ((free_func) != NULL) {                                               \
+        _hash_op_##type##_##field##_delete_node((free_func), _run);            \
+      }                                                                        \
+      _run = _telt;                                                            \
+    }                                                                          \
   }                                                                            \
 } while(0)
 #endif
@@ -296,18 +837,38 @@ typedef struct _hash_node_s {
 #define HASH_FIND_ELT(head, type, field, elm, found) do {                      \
   if ((head)->buckets == NULL) (found) = NULL;                                 \
   else {                                                                       \
-	  HASH_TYPE _hv;                                                             \
-	  struct type *_telt;                                                        \
-	  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
-	  HASH_LOCK_READ(head);                                                      \
-	  _hash_node_t *bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv); \
-	  HASH_LOCK_NODE_READ(head, bkt);                                            \
-	  _telt = (struct type *)bkt->first;                                         \
-	  HASH_UNLOCK_READ(head);                                                    \
-	  while(_telt != NULL && (head)->ops->hash_cmp((elm), _telt, (head)->ops->hashd) != 0) \
-	    _telt = _telt->field.next;                                               \
-	  (found) = _telt;                                                           \
-	  HASH_UNLOCK_NODE_READ((head), bkt);                                        \
+    HASH_TYPE _hv;                                                             \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_FIND_ELT_HV(head, type, field, elm, _hv, found);                      \
+  }                                                                            \
+} while(0)
+#endif
+
+#ifndef HASH_FIND_ELT_HV
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if ((head)->buckets == NULL) (found) = NULL;                                 \
+  else {                                                                       \
+    struct type *_telt;                                                        \
+    _hash_node_t *_bkt;                                                        \
+    unsigned _probes = 0;                                                      \
+    _HASH_FRONT_LOOKUP(head, type, field, elm, h, _telt);                      \
+    if (_telt == NULL) {                                                       \
+      HASH_LOCK_READ(head);                                                    \
+      _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));         \
+      HASH_LOCK_NODE_READ(head, _bkt);                                         \
+      _telt = (struct type *)_bkt->first;                                      \
+      while(_telt != NULL && (head)->ops->hash_cmp((elm), _telt, (head)->ops->hashd) != 0) { \
+        _telt = _telt->field.next;                                             \
+        _probes ++;                                                            \
+      }                                                                        \
+      if (_telt != NULL) _HASH_FRONT_STORE(head, type, field, _telt, (h));     \
+      HASH_UNLOCK_NODE_READ((head), _bkt);                                     \
+      _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                     \
+      if (_telt != NULL && _probes > 0)                                        \
+        _HASH_MTF(head, type, field, _bkt, _telt, (h));                        \
+      HASH_UNLOCK_READ(head);                                                  \
+    }                                                                          \
+    (found) = _telt;                                                           \
   }                                                                            \
 } while(0)
 #endif
@@ -315,26 +876,39 @@ typedef struct _hash_node_s {
 #ifndef HASH_DELETE_ELT
 #define HASH_DELETE_ELT(head, type, field, elm) do {                          \
   if ((head)->buckets != NULL) {                                               \
-    HASH_LOCK_READ(head);                                                      \
+    HASH_TYPE _hv;                                                             \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_DELETE_ELT_HV(head, type, field, elm, _hv);                           \
+  }                                                                            \
+} while(0)
+#endif
+
+#ifndef HASH_DELETE_ELT_HV
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if ((head)->buckets != NULL) {                                               \
     struct type *_telt, *_prev = NULL;                                        \
-    _hash_node_t *bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, _hv); \
-    HASH_LOCK_NODE_WRITE(head, bkt);                                            \
-    _telt = (struct type *)bkt->first;                                        \
-    HASH_UNLOCK_READ(head);                                                    \
+    _hash_node_t *_bkt;                                                        \
+    unsigned _probes = 0;                                                      \
+    HASH_LOCK_READ(head);                                                      \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));           \
+    HASH_LOCK_NODE_WRITE(head, _bkt);                                          \
+    _telt = (struct type *)_bkt->first;                                        \
     while(_telt != NULL && (head)->ops->hash_cmp((elm), _telt, (head)->ops->hashd) != 0) { \
          _prev = _telt;                                                        \
          _telt = _telt->field.next;                                            \
+         _probes ++;                                                           \
     }                                                                          \
+    _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                       \
     if (_telt != NULL) {                                                       \
-      if (prev != NULL) _prev->field.next = _telt->field.next;                 \
-      else bkt->first = (void *)_telt->field.next;                            \
+      if (_prev != NULL) _prev->field.next = _telt->field.next;                \
+      else _bkt->first = (void *)_telt->field.next;                            \
       _telt->field.next = NULL;                                                \
-      HASH_LOCK_READ(head);                                                    \
-      (head)->num_items--;                                                     \
-      HASH_UNLOCK_READ(head);                                                  \
-      bkt->entries --;                                                         \
+      _bkt->entries --;                                                        \
+      _HASH_FRONT_BUMP(head, _telt->field.hv);                                 \
     }                                                                          \
-    HASH_UNLOCK_NODE_WRITE((head), bkt);                                       \
+    HASH_UNLOCK_NODE_WRITE((head), _bkt);                                      \
+    if (_telt != NULL) _HASH_ITEMS_SUB(head, 1);                               \
+    HASH_UNLOCK_READ(head);                                                    \
   }                                                                            \
 } while(0)
 #endif
@@ -343,20 +917,22 @@ typedef struct _hash_node_s {
 #define HASH_CLEANUP_NODES(head, type, field, free_func) do {                 \
   if ((head)->buckets != NULL) {                                               \
       struct type *_telt, *_tmp;                                              \
-      _hash_node_t *bkt;                                                       \
+      _hash_node_t *_bkt;                                                      \
       HASH_LOCK_READ(head);                                                    \
       for (unsigned _i = 0; _i < (head)->num_buckets; _i ++) {                \
-        bkt = &(head)->buckets[_i];                                            \
-        HASH_LOCK_NODE_WRITE(head, bkt);                                       \
-        _telt = (struct type *)bkt->first;                                    \
+        _bkt = &(head)->buckets[_i];                                           \
+        HASH_LOCK_NODE_WRITE(head, _bkt);                                      \
+        _telt = (struct type *)_bkt->first;                                    \
         while(_telt != NULL) {                                                \
           _tmp = _telt;                                                        \
           _telt = _telt->field.next;                                           \
           _tmp->field.next = NULL;                                             \
+          _HASH_FRONT_BUMP(head, _tmp->field.hv);                              \
           if ((free_func) != NULL) _hash_op_##type##_##field##_delete_node((free_func), _tmp); \
         }                                                                      \
-        bkt->first = NULL;                                                     \
-        HASH_UNLOCK_NODE_WRITE(head, bkt);                                   \
+        _bkt->first = NULL;                                                    \
+        _bkt->entries = 0;                                                     \
+        HASH_UNLOCK_NODE_WRITE(head, _bkt);                                    \
       }                                                                        \
       (head)->num_items = 0;                                                   \
       HASH_UNLOCK_READ(head);                                                  \
@@ -390,68 +966,148 @@ typedef struct _hash_node_s {
 /* Private methods */
 #ifndef HASH_MAKE_TABLE
 #define HASH_MAKE_TABLE(head) do {                                             \
+  _HASH_MAKE_BUCKETS(head);                                                    \
+  _HASH_FRONT_NEW_ID(head);                                                    \
+} while(0)
+#endif
+
+/* Allocates buckets and the resize lock, shared with other chained engines */
+#define _HASH_MAKE_BUCKETS(head) do {                                          \
   (head)->num_buckets = HASH_INITIAL_NUM_BUCKETS;                              \
   (head)->log2_num_buckets = HASH_INITIAL_NUM_BUCKETS_LOG2;                    \
   HASH_ALLOC_NODES((head), (head)->buckets, (head)->num_buckets);              \
   if ((head)->ops->lock_init) (head)->resize_lock = (head)->ops->lock_init((head)->ops->lockd); \
-  if ((head)->ops->hash_init) (head)->ops->hash_init((head)->ops->hashd);      \
   (head)->signature = HASH_SIGNATURE;                                          \
 } while(0)
-#endif
 
 #define HASH_ROUNDUP32(x)                                                     \
   (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
 
 #ifndef HASH_EXPAND_BUCKETS
 #define HASH_EXPAND_BUCKETS(head, type, field)                                \
-do {                                                                           \
-  unsigned _saved_generation = (head)->generation;                            \
+  _HASH_EXPAND_BUCKETS_GEN(head, type, field, (head)->generation)
+#endif
+
+/*
+ * Expansion is skipped if the table has been expanded since generation `gen`.
+ * All other operations hold the table read lock whilst they access buckets,
+ * so buckets are not locked here.
+ * As the number of buckets is doubled, old bucket `i` is moved to new buckets
+ * `i` and `i + num_buckets` only, so ranges of old buckets could be rehashed
+ * in parallel by `ops->parallel_for` without any locking.
+ */
+typedef struct _hash_rehash_s {
+  _hash_node_t *old_nodes;
+  _hash_node_t *new_nodes;
+  unsigned new_num;
+  unsigned ideal_chain_maxlen;
+  unsigned nonideal_items;
+} _hash_rehash_t;
+
+#define _HASH_EXPAND_BUCKETS_GEN(head, type, field, gen) do {                  \
+  unsigned _saved_generation = (gen);                                          \
   HASH_LOCK_WRITE(head);                                                       \
   if ((head)->generation == _saved_generation) {                               \
-      _hash_node_t *_new_nodes, *bkt;                                            \
-	  unsigned _new_num = (head)->num_buckets + 1;                              \
-	  HASH_ROUNDUP32(_new_num);                                                 \
-	  HASH_ALLOC_NODES((head), _new_nodes, _new_num);                            \
-	  if (_new_nodes != NULL) {                                                 \
-		(head)->ideal_chain_maxlen =                                               \
-		    ((head)->num_items >> ((head)->log2_num_buckets+1)) +                  \
-		    (((head)->num_items & (((head)->num_buckets*2)-1)) ? 1 : 0);           \
-		(head)->nonideal_items = 0;                                                \
-	  for (size_t _i = 0; _i < (head)->num_buckets; _i ++) {                    \
-		  struct type *_elt = (struct type *)(head)->buckets[_i].first, *_tmp_elt; \
-		  HASH_LOCK_NODE_WRITE(head, &(head)->buckets[_i]);                        \
-		  while (_elt) {                                                          \
-			  _tmp_elt = _elt->field.next;                                           \
-		    bkt = HASH_FIND_BKT(_new_nodes, _new_num, _elt->field.hv);            \
-		    HASH_INSERT_BKT(bkt, type, field, _elt);                               \
-		    if (bkt->entries > (head)->ideal_chain_maxlen) {                       \
-		    	(head)->nonideal_items++;                                            \
-		    	bkt->expand_mult = bkt->entries / (head)->ideal_chain_maxlen;         \
-		    }                                                                      \
-		    _elt = _tmp_elt;                                                       \
-		  }                                                                        \
-		  HASH_UNLOCK_NODE_WRITE(head, &(head)->buckets[_i]);                      \
-    }                                                                          \
-    HASH_FREE_NODES((head), (head)->buckets, (head)->num_buckets);             \
-    (head)->buckets = _new_nodes;                                              \
-    (head)->num_buckets = _new_num;                                            \
-    (head)->log2_num_buckets++;                                                \
-    (head)->ineff_expands = ((head)->nonideal_items > ((head)->num_items >> 1)) ? \
-      ((head)->ineff_expands+1) : 0;                                           \
-    (head)->generation ++;                                                     \
+    _hash_node_t *_new_nodes;                                                  \
+    uint64_t _t0 = HASH_CLOCK_NS();                                            \
+    unsigned _old_num = (head)->num_buckets;                                   \
+    unsigned _new_num = (head)->num_buckets + 1;                               \
+    HASH_ROUNDUP32(_new_num);                                                  \
+    HASH_ALLOC_NODES((head), _new_nodes, _new_num);                            \
+    if (_new_nodes != NULL) {                                                  \
+      (head)->ideal_chain_maxlen =                                             \
+          ((head)->num_items >> ((head)->log2_num_buckets+1)) +                \
+          (((head)->num_items & (((head)->num_buckets*2)-1)) ? 1 : 0);         \
+      _hash_rehash_t _rh;                                                      \
+      _rh.old_nodes = (head)->buckets;                                         \
+      _rh.new_nodes = _new_nodes;                                              \
+      _rh.new_num = _new_num;                                                  \
+      _rh.ideal_chain_maxlen = (head)->ideal_chain_maxlen;                     \
+      _rh.nonideal_items = 0;                                                  \
+      if ((head)->ops->parallel_for &&                                         \
+          (head)->num_buckets >= HASH_PARALLEL_EXPAND_THRESH) {                \
+        (head)->ops->parallel_for((head)->num_buckets,                         \
+            &_hash_op_##type##_##field##_rehash, &_rh, (head)->ops->paralleld); \
+      }                                                                        \
+      else {                                                                   \
+        _hash_op_##type##_##field##_rehash(&_rh, 0, (head)->num_buckets);      \
+      }                                                                        \
+      (head)->nonideal_items = _rh.nonideal_items;                             \
+      HASH_FREE_NODES((head), (head)->buckets, (head)->num_buckets);           \
+      (head)->buckets = _new_nodes;                                            \
+      (head)->num_buckets = _new_num;                                          \
+      (head)->log2_num_buckets++;                                              \
+      (head)->ineff_expands =                                                  \
+          ((head)->nonideal_items > ((head)->num_items >> 1)) ?                \
+          ((head)->ineff_expands+1) : 0;                                       \
+      __atomic_store_n(&(head)->generation, (head)->generation + 1,            \
+          __ATOMIC_RELEASE);                                                   \
+      (head)->expands ++;                                                      \
+      _t0 = HASH_CLOCK_NS() - _t0;                                             \
+      (head)->expand_ns += _t0;                                                \
+      if ((head)->ops->on_expand) (head)->ops->on_expand(_old_num, _new_num,   \
+          (head)->num_items, _t0, (head)->ops->expandd);                       \
     }                                                                          \
   }                                                                            \
   if ((head)->ineff_expands > 1) (head)->need_expand = 2;                      \
   else (head)->need_expand = 0;                                                \
   HASH_UNLOCK_WRITE(head);                                                     \
 } while(0)
-#endif
+
+/*
+ * Call `cb(old_num, new_num, items, ns, d)` after each expansion of a table
+ * (of a shard for a closed table) whilst it is still locked for writing, so
+ * the callback must not access the table
+ */
+#define HASH_ON_EXPAND(head, cb, d) do {                                       \
+    (head)->ops->on_expand = (cb);                                             \
+    (head)->ops->expandd = (d);                                                \
+} while(0)
 
 #ifndef HASH_FIND_BKT
 #define HASH_FIND_BKT(nodes, size, hv)                                        \
   (&(nodes)[(hv) & ((size) - 1)])
 #endif
 
+/*
+ * Fill hash_stats_t `st` walking all chains under the table read lock. Each
+ * bucket is locked whilst it is walked, so concurrent writers are stalled
+ * for a bucket at a time
+ */
+#ifndef HASH_STATS
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->buckets != NULL) {                                               \
+    for (unsigned _i = 0; _i < (head)->num_buckets; _i ++) {                   \
+      _hash_node_t *_bkt = &(head)->buckets[_i];                               \
+      struct type *_telt;                                                      \
+      unsigned _len = 0;                                                       \
+      HASH_LOCK_NODE_READ(head, _bkt);                                         \
+      for (_telt = _bkt->first; _telt != NULL; _telt = _telt->field.next) {    \
+        _len ++;                                                               \
+        _HASH_STATS_HIST_ADD((st)->probe_hist, _len);                          \
+      }                                                                        \
+      HASH_UNLOCK_NODE_READ(head, _bkt);                                       \
+      _HASH_STATS_HIST_ADD((st)->chain_hist, _len);                            \
+      if (_len == 0) (st)->empty_buckets ++;                                   \
+      if (_len > (st)->max_chain) (st)->max_chain = _len;                      \
+      (st)->num_items += _len;                                                 \
+    }                                                                          \
+    (st)->num_buckets = (head)->num_buckets;                                   \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+    (st)->expands = (head)->expands;                                           \
+    (st)->expand_ns = (head)->expand_ns;                                       \
+    (st)->ideal_chain_maxlen = (head)->ideal_chain_maxlen;                     \
+    (st)->nonideal_items = (head)->nonideal_items;                             \
+    (st)->ineff_expands = (head)->ineff_expands;                               \
+    (st)->noexpand = (head)->noexpand;                                         \
+    _HASH_PROBE_COLLECT(head, st);                                             \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+#endif
+
 #ifndef HASH_ITER
 #define HASH_ITER(type, field)                                                \
   struct {                                                                    \
@@ -478,9 +1134,10 @@ do {                                                                           \
 #ifndef HASH_ITERATE_FUNC
 #define HASH_ITERATE_FUNC(head, type, field, func, data) do {                  \
   int _finished = 0;                                                           \
-  _hash_node_t *_node = (head)->buckets,                                       \
-      *_end = (head)->buckets + (head)->num_buckets;                           \
+  _hash_node_t *_node, *_end;                                                  \
   HASH_LOCK_READ(head);                                                        \
+  _node = (head)->buckets;                                                     \
+  _end = (head)->buckets + (head)->num_buckets;                                \
   for (; !_finished && _node != _end; _node ++) {                              \
     if (_node->first) {                                                        \
       HASH_LOCK_NODE_READ(head, _node);                                        \
@@ -495,23 +1152,81 @@ do {                                                                           \
   HASH_UNLOCK_READ(head);                                                      \
 } while(0)
 #endif
+/*
+ * Next cursor of a scan in reverse binary order: high bits of a bucket index
+ * are incremented first, so a cursor of a smaller table still covers all
+ * buckets its elements could be moved to by later expansions
+ */
+static inline unsigned _HU_FUNCTION(_hash_scan_next)(unsigned v, unsigned mask)
+{
+  v |= ~mask;
+  v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+  v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+  v = ((v >> 4) & 0x0f0f0f0fU) | ((v & 0x0f0f0f0fU) << 4);
+  v = __builtin_bswap32(v);
+  v ++;
+  v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+  v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+  v = ((v >> 4) & 0x0f0f0f0fU) | ((v & 0x0f0f0f0fU) << 4);
+  return __builtin_bswap32(v);
+}
 
+/*
+ * Resumable scan in the style of Redis SCAN. Each call visits up to `count`
+ * buckets starting from `cursor` (0 for a new scan), calls `func(elt, data)`
+ * for their elements and stores the next cursor to `cursor`, which is 0 once
+ * the scan is complete. Locks are released between calls, so writers and
+ * expansions are not blocked by long scans. Every element present for the
+ * whole scan is returned at least once even if the table is expanded between
+ * calls, and some elements could be returned more than once. `func` returning
+ * 0 ends the call after the current bucket.
+ */
+#ifndef HASH_SCAN
+#define HASH_SCAN(head, type, field, cursor, count, func, data) do {           \
+  unsigned _left = (count) > 0 ? (count) : 1, _mask, _stop = 0;                \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->buckets == NULL) (cursor) = 0;                                   \
+  else {                                                                       \
+    _mask = (head)->num_buckets - 1;                                           \
+    do {                                                                       \
+      _hash_node_t *_node = &(head)->buckets[(cursor) & _mask];                \
+      if (_node->first) {                                                      \
+        HASH_LOCK_NODE_READ(head, _node);                                      \
+        struct type *_cur = (struct type *)_node->first;                       \
+        for (; _cur != NULL; _cur = _cur->field.next) {                        \
+          if (!(func)(_cur, data)) _stop = 1;                                  \
+        }                                                                      \
+        HASH_UNLOCK_NODE_READ(head, _node);                                    \
+      }                                                                        \
+      (cursor) = _hash_scan_next((cursor), _mask);                             \
+    } while ((cursor) != 0 && !_stop && -- _left > 0);                         \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+#endif
 
 #ifndef HASH_FILTER_FUNC
 #define HASH_FILTER_FUNC(head, type, field, func, free_func, data) do {        \
-  _hash_node_t *_node = (head)->buckets,                                       \
-      *_end = (head)->buckets + (head)->num_buckets;                           \
+  _hash_node_t *_node, *_end;                                                  \
+  unsigned _removed = 0;                                                       \
   HASH_LOCK_READ(head);                                                        \
+  _node = (head)->buckets;                                                     \
+  _end = (head)->buckets + (head)->num_buckets;                                \
   for (; _node != _end; _node ++) {                                            \
     if (_node->first) {                                                        \
       HASH_LOCK_NODE_WRITE(head, _node);                                       \
-      struct type *_cur = (struct type *)_node->first, *_tmp = NULL;           \
+      struct type *_cur = (struct type *)_node->first, *_tmp = NULL, *_del;    \
       while (_cur != NULL) {                                                   \
         if (!(func)(_cur, data)) {                                             \
-          if (_cur == _node->first) _node->first = _cur->field.next;           \
+          if (_tmp == NULL) _node->first = _cur->field.next;                   \
           else _tmp->field.next = _cur->field.next;                            \
+          _del = _cur;                                                         \
           _cur = _cur->field.next;                                             \
-          (free_func)(_cur, data);                                             \
+          _del->field.next = NULL;                                             \
+          _node->entries --;                                                   \
+          _removed ++;                                                         \
+          _HASH_FRONT_BUMP(head, _del->field.hv);                              \
+          (free_func)(_del, data);                                             \
         }                                                                      \
         else {                                                                 \
           _tmp = _cur;                                                         \
@@ -521,15 +1236,194 @@ do {                                                                           \
       HASH_UNLOCK_NODE_WRITE(head, _node);                                     \
     }                                                                          \
   }                                                                            \
+  if (_removed > 0) _HASH_ITEMS_SUB(head, _removed);                           \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+#endif
+
+/*
+ * Parallel versions of iterate and filter. Buckets are split to ranges that
+ * are processed by `ops->parallel_for` (or by the calling thread if it is not
+ * set) taking per-bucket locks as serial versions do. Callbacks are called
+ * concurrently:
+ * - HASH_ITERATE_PARALLEL: `func(elt, data)`, returning 0 stops the walk;
+ * - HASH_REDUCE_PARALLEL: `func(elt, local, data)` accumulates to a zeroed
+ *   private space of `acc_size` bytes, which is merged by `merge(acc, local,
+ *   data)` one range at a time;
+ * - HASH_FILTER_PARALLEL: elements for which `func(elt, data)` returns 0 are
+ *   removed and passed to `free_func(elt, data)` in batches after a bucket
+ *   range is unlocked.
+ */
+typedef struct _hash_parallel_s {
+  _hash_node_t *nodes;
+  void *ops;
+  int (*cb)(void *elt, void *data);
+  int (*reduce_cb)(void *elt, void *local, void *data);
+  void (*merge_cb)(void *acc, void *local, void *data);
+  void (*free_cb)(void *elt, void *data);
+  void *ud;
+  void *acc_space;
+  size_t acc_len;
+  int stop;
+  int merge_lock;
+  unsigned removed;
+  unsigned *front_ver;
+} _hash_parallel_t;
+
+#ifdef __GNUC__
+#define HASH_PREFETCH(p) __builtin_prefetch((p))
+#else
+#define HASH_PREFETCH(p)
+#endif
+
+#define _HASH_PARALLEL_RUN(head, type, field, fn, p) do {                      \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->buckets != NULL) {                                               \
+    (p)->nodes = (head)->buckets;                                              \
+    (p)->ops = (head)->ops;                                                    \
+    if ((head)->ops->parallel_for) {                                           \
+      (head)->ops->parallel_for((head)->num_buckets,                           \
+          &_hash_op_##type##_##field##_##fn, (p), (head)->ops->paralleld);     \
+    }                                                                          \
+    else {                                                                     \
+      _hash_op_##type##_##field##_##fn((p), 0, (head)->num_buckets);           \
+    }                                                                          \
+    if ((p)->removed > 0) _HASH_ITEMS_SUB(head, (p)->removed);                 \
+  }                                                                            \
   HASH_UNLOCK_READ(head);                                                      \
 } while(0)
+
+#define HASH_ITERATE_PARALLEL(head, type, field, func, data) do {              \
+  _hash_parallel_t _par;                                                       \
+  memset(&_par, 0, sizeof(_par));                                              \
+  _par.cb = (int (*)(void *, void *))(func);                                   \
+  _par.ud = (data);                                                            \
+  _HASH_PARALLEL_RUN(head, type, field, iterate_range, &_par);                 \
+} while(0)
+
+#define HASH_REDUCE_PARALLEL(head, type, field, func, merge, acc, acc_size,    \
+    data) do {                                                                 \
+  _hash_parallel_t _par;                                                       \
+  memset(&_par, 0, sizeof(_par));                                              \
+  _par.reduce_cb = (int (*)(void *, void *, void *))(func);                    \
+  _par.merge_cb = (void (*)(void *, void *, void *))(merge);                   \
+  _par.acc_space = (acc);                                                      \
+  _par.acc_len = (acc_size);                                                   \
+  _par.ud = (data);                                                            \
+  _HASH_PARALLEL_RUN(head, type, field, iterate_range, &_par);                 \
+} while(0)
+
+#define HASH_FILTER_PARALLEL(head, type, field, func, free_func, data) do {    \
+  _hash_parallel_t _par;                                                       \
+  memset(&_par, 0, sizeof(_par));                                              \
+  _par.cb = (int (*)(void *, void *))(func);                                   \
+  _par.free_cb = (void (*)(void *, void *))(free_func);                        \
+  _par.ud = (data);                                                            \
+  _par.front_ver = _HASH_FRONT_VERSIONS(head);                                 \
+  _HASH_PARALLEL_RUN(head, type, field, filter_range, &_par);                  \
+} while(0)
+
+#ifndef HASH_FILTER_BATCH
+#define HASH_FILTER_BATCH 64
 #endif
 
+/*
+ * Bulk construction of a table from an array of `n` elements. Elements are
+ * hashed and radix partitioned by their destination bucket in parallel by
+ * `ops->parallel_for`, then each range of buckets is linked without locking.
+ * The finished buckets array is published under the table write lock. If the
+ * table is not empty, elements are inserted one by one.
+ */
+#ifndef HASH_BUILD_LOAD
+#define HASH_BUILD_LOAD 2                /* average chain of a built table   */
+#endif
+#ifndef HASH_BUILD_PARTITIONS
+#define HASH_BUILD_PARTITIONS 1024
+#endif
+
+typedef struct _hash_build_s {
+  void *elts;
+  void *ops;
+  void **sorted;
+  size_t *counts;
+  size_t *cursors;
+  _hash_node_t *nodes;
+  unsigned num_buckets;
+  unsigned part_shift;
+  unsigned nparts;
+} _hash_build_t;
+
+#define _HASH_BUILD_STEP(head, type, field, fn, b, n) do {                     \
+  if ((head)->ops->parallel_for) {                                             \
+    (head)->ops->parallel_for((n), &_hash_op_##type##_##field##_##fn, (b),     \
+        (head)->ops->paralleld);                                               \
+  }                                                                            \
+  else {                                                                       \
+    _hash_op_##type##_##field##_##fn((b), 0, (n));                             \
+  }                                                                            \
+} while(0)
+
+#define HASH_BUILD_PARALLEL(head, type, field, array, n) do {                  \
+  _hash_build_t _bld;                                                          \
+  size_t _bn = (n), _off = 0;                                                  \
+  unsigned _bnum = _bn / HASH_BUILD_LOAD, _blog2 = 0;                          \
+  int _bdone = 0;                                                              \
+  memset(&_bld, 0, sizeof(_bld));                                              \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  if (_bnum < HASH_INITIAL_NUM_BUCKETS) _bnum = HASH_INITIAL_NUM_BUCKETS;      \
+  HASH_ROUNDUP32(_bnum);                                                       \
+  while ((1U << _blog2) < _bnum) _blog2 ++;                                    \
+  _bld.nparts = _bnum < HASH_BUILD_PARTITIONS ? _bnum : HASH_BUILD_PARTITIONS; \
+  while ((_bnum >> _bld.part_shift) > _bld.nparts) _bld.part_shift ++;         \
+  _bld.elts = (array);                                                         \
+  _bld.ops = (head)->ops;                                                      \
+  _bld.num_buckets = _bnum;                                                    \
+  _bld.sorted = malloc(sizeof(void *) * (_bn ? _bn : 1));                      \
+  _bld.counts = calloc(_bld.nparts, sizeof(size_t));                           \
+  _bld.cursors = calloc(_bld.nparts, sizeof(size_t));                          \
+  HASH_ALLOC_NODES((head), _bld.nodes, _bnum);                                 \
+  if (_bld.sorted && _bld.counts && _bld.cursors && _bld.nodes) {              \
+    _HASH_BUILD_STEP(head, type, field, build_hash, &_bld, _bn);               \
+    for (unsigned _p = 0; _p < _bld.nparts; _p ++) {                           \
+      _bld.cursors[_p] = _off;                                                 \
+      _off += _bld.counts[_p];                                                 \
+    }                                                                          \
+    _HASH_BUILD_STEP(head, type, field, build_scatter, &_bld, _bn);            \
+    _HASH_BUILD_STEP(head, type, field, build_link, &_bld, _bnum);             \
+    HASH_LOCK_WRITE(head);                                                     \
+    if ((head)->num_items == 0) {                                              \
+      HASH_FREE_NODES((head), (head)->buckets, (head)->num_buckets);           \
+      (head)->buckets = _bld.nodes;                                            \
+      (head)->num_buckets = _bnum;                                             \
+      (head)->log2_num_buckets = _blog2;                                       \
+      (head)->num_items = _bn;                                                 \
+      (head)->need_expand = 0;                                                 \
+      (head)->nonideal_items = 0;                                              \
+      (head)->ineff_expands = 0;                                               \
+      __atomic_store_n(&(head)->generation, (head)->generation + 1,            \
+          __ATOMIC_RELEASE);                                                   \
+      _bld.nodes = NULL;                                                       \
+      _bdone = 1;                                                              \
+    }                                                                          \
+    HASH_UNLOCK_WRITE(head);                                                   \
+  }                                                                            \
+  if (_bld.nodes) HASH_FREE_NODES((head), _bld.nodes, _bnum);                  \
+  free(_bld.sorted);                                                           \
+  free(_bld.counts);                                                           \
+  free(_bld.cursors);                                                          \
+  if (!_bdone) {                                                               \
+    for (size_t _k = 0; _k < _bn; _k ++) {                                     \
+      HASH_INSERT(head, type, field, &(array)[_k]);                            \
+    }                                                                          \
+  }                                                                            \
+} while(0)
+
 typedef struct _hash_generic_hash_s {
   void* (*hash_init)(void *d, unsigned seed, void *space, unsigned spacelen);
   void (*hash_update)(void *s, const unsigned char *in, size_t inlen, void *d);
   HASH_TYPE (*hash_final)(void *s, void *d);
   unsigned seed;
+  int seeded; /* seed is shared by all tables of a type, so it is set once */
   void *d;
 } _hash_generic_hash_t;
 /*
@@ -809,10 +1703,14 @@ typedef struct _hash_filter_data_s {
  * Generic operations generator
  */
 #define HASH_GENERATE_OPS(type, field, keyfield, hashf, cmpf, d)               \
+		_HASH_FRONT_GENERATE(type, field)                              \
 		static void _HU_FUNCTION(_hash_op_##type##_##field##_init_hash)(void *ud)  \
 		{                                                                          \
 		  _hash_filter_data_t *dt = (_hash_filter_data_t *)ud;                     \
-		  if (dt) dt->ht->seed = HASH_RANDOM_SEED();                               \
+		  if (dt && !dt->ht->seeded) {                                 \
+		    dt->ht->seed = HASH_RANDOM_SEED();                         \
+		    dt->ht->seeded = 1;                                        \
+		  }                                                            \
 		}                                                                          \
 		static HASH_OPS(type, field) _hash_ops_##type##_##field_glob = {           \
 		  .hash_func = (hashf),                                                    \
@@ -829,13 +1727,228 @@ typedef struct _hash_filter_data_s {
       HASH_FIND_ELT(_h, type, field, &s, p);                                    \
       return p;                                                                \
     }                                                                          \
+    static HASH_TYPE _HU_FUNCTION(_hash_op_##type##_##field##_hash_key)(void *_head, const void *k) \
+    {                                                                          \
+      struct type s;                                                           \
+      HASH_HEAD(, type, field) *_h;                                            \
+      memcpy((&s.keyfield), k, sizeof(s.keyfield));                            \
+      DECLTYPE_ASSIGN(_h, _head);                                              \
+      return HASH_HASH_ELT(_h, &s);                                            \
+    }                                                                          \
     static void _HU_FUNCTION(_hash_op_##type##_##field##_delete_node)(void (*free_func)(struct type *p), struct type *p) { \
        if (free_func != NULL) free_func(p);                                    \
+    }                                                                          \
+    _HASH_GENERATE_ENGINE(type, field)
+
+#ifdef _HASH_USE_CHAINED
+/*
+ * Moves chains of old buckets [start, end) to the new buckets array
+ */
+#define _HASH_GENERATE_ENGINE(type, field)                                     \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_rehash)(void *arg,    \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_rehash_t *rh = (_hash_rehash_t *)arg;                              \
+      _hash_node_t *bkt;                                                       \
+      struct type *elt, *tmp;                                                  \
+      unsigned nonideal = 0;                                                   \
+      for (size_t i = start; i < end; i ++) {                                  \
+        elt = (struct type *)rh->old_nodes[i].first;                           \
+        while (elt) {                                                          \
+          tmp = elt->field.next;                                               \
+          bkt = HASH_FIND_BKT(rh->new_nodes, rh->new_num, elt->field.hv);      \
+          HASH_INSERT_BKT(bkt, type, field, elt);                              \
+          if (bkt->entries > rh->ideal_chain_maxlen) {                         \
+            nonideal ++;                                                       \
+            bkt->expand_mult = bkt->entries / rh->ideal_chain_maxlen;          \
+          }                                                                    \
+          elt = tmp;                                                           \
+        }                                                                      \
+      }                                                                        \
+      if (nonideal > 0) {                                                      \
+        __atomic_fetch_add(&rh->nonideal_items, nonideal, __ATOMIC_RELAXED);   \
+      }                                                                        \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_iterate_range)(void *arg, \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_parallel_t *p = (_hash_parallel_t *)arg;                           \
+      struct { struct _hash_ops_##type##_##field *ops; } h;                    \
+      _hash_node_t *node;                                                      \
+      struct type *cur;                                                        \
+      void *local = NULL;                                                      \
+      h.ops = (struct _hash_ops_##type##_##field *)p->ops;                     \
+      if (p->reduce_cb) {                                                      \
+        local = calloc(1, p->acc_len ? p->acc_len : 1);                        \
+        if (local == NULL) return;                                             \
+      }                                                                        \
+      for (size_t i = start; i < end; i ++) {                                  \
+        if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) break;                \
+        node = &p->nodes[i];                                                   \
+        if (i + 1 < end) HASH_PREFETCH(p->nodes[i + 1].first);                 \
+        if (node->first == NULL) continue;                                     \
+        HASH_LOCK_NODE_READ(&h, node);                                         \
+        for (cur = (struct type *)node->first; cur != NULL;                    \
+            cur = cur->field.next) {                                           \
+          HASH_PREFETCH(cur->field.next);                                      \
+          if (p->reduce_cb) p->reduce_cb(cur, local, p->ud);                   \
+          else if (!p->cb(cur, p->ud)) {                                       \
+            __atomic_store_n(&p->stop, 1, __ATOMIC_RELAXED);                   \
+            break;                                                             \
+          }                                                                    \
+        }                                                                      \
+        HASH_UNLOCK_NODE_READ(&h, node);                                       \
+      }                                                                        \
+      if (local != NULL) {                                                     \
+        while (__atomic_exchange_n(&p->merge_lock, 1, __ATOMIC_ACQUIRE)) {}    \
+        p->merge_cb(p->acc_space, local, p->ud);                               \
+        __atomic_store_n(&p->merge_lock, 0, __ATOMIC_RELEASE);                 \
+        free(local);                                                           \
+      }                                                                        \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_free_batch)(          \
+        _hash_parallel_t *p, struct type *batch)                               \
+    {                                                                          \
+      struct type *del;                                                        \
+      while (batch != NULL) {                                                  \
+        del = batch;                                                           \
+        batch = batch->field.next;                                             \
+        del->field.next = NULL;                                                \
+        if (p->free_cb) p->free_cb(del, p->ud);                                \
+      }                                                                        \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_filter_range)(void *arg, \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_parallel_t *p = (_hash_parallel_t *)arg;                           \
+      struct { struct _hash_ops_##type##_##field *ops; } h;                    \
+      _hash_node_t *node;                                                      \
+      struct type *cur, *prev, *del, *batch = NULL;                            \
+      unsigned removed = 0, nbatch = 0;                                        \
+      h.ops = (struct _hash_ops_##type##_##field *)p->ops;                     \
+      for (size_t i = start; i < end; i ++) {                                  \
+        node = &p->nodes[i];                                                   \
+        if (i + 1 < end) HASH_PREFETCH(p->nodes[i + 1].first);                 \
+        if (node->first == NULL) continue;                                     \
+        HASH_LOCK_NODE_WRITE(&h, node);                                        \
+        cur = (struct type *)node->first;                                      \
+        prev = NULL;                                                           \
+        while (cur != NULL) {                                                  \
+          HASH_PREFETCH(cur->field.next);                                      \
+          if (!p->cb(cur, p->ud)) {                                            \
+            if (prev == NULL) node->first = cur->field.next;                   \
+            else prev->field.next = cur->field.next;                           \
+            del = cur;                                                         \
+            cur = cur->field.next;                                             \
+            node->entries --;                                                  \
+            _HASH_FRONT_BUMP_VER(p->front_ver, del->field.hv);                 \
+            del->field.next = batch;                                           \
+            batch = del;                                                       \
+            nbatch ++;                                                         \
+          }                                                                    \
+          else {                                                               \
+            prev = cur;                                                        \
+            cur = cur->field.next;                                             \
+          }                                                                    \
+        }                                                                      \
+        HASH_UNLOCK_NODE_WRITE(&h, node);                                      \
+        if (nbatch >= HASH_FILTER_BATCH) {                                     \
+          _hash_op_##type##_##field##_free_batch(p, batch);                    \
+          batch = NULL;                                                        \
+          removed += nbatch;                                                   \
+          nbatch = 0;                                                          \
+        }                                                                      \
+      }                                                                        \
+      _hash_op_##type##_##field##_free_batch(p, batch);                        \
+      removed += nbatch;                                                       \
+      if (removed > 0) {                                                       \
+        __atomic_fetch_add(&p->removed, removed, __ATOMIC_RELAXED);            \
+      }                                                                        \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_build_hash)(void *arg, \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_build_t *b = (_hash_build_t *)arg;                                 \
+      struct _hash_ops_##type##_##field *ops =                                 \
+          (struct _hash_ops_##type##_##field *)b->ops;                         \
+      struct type *elt;                                                        \
+      size_t *local = calloc(b->nparts, sizeof(size_t));                       \
+      for (size_t i = start; i < end; i ++) {                                  \
+        elt = &((struct type *)b->elts)[i];                                    \
+        elt->field.hv = ops->hash_func(elt, ops->hashd);                       \
+        elt->field.next = NULL;                                                \
+        if (local) local[(elt->field.hv & (b->num_buckets - 1)) >> b->part_shift] ++; \
+        else __atomic_fetch_add(&b->counts[(elt->field.hv &                    \
+            (b->num_buckets - 1)) >> b->part_shift], 1, __ATOMIC_RELAXED);     \
+      }                                                                        \
+      if (local) {                                                             \
+        for (unsigned p = 0; p < b->nparts; p ++) {                            \
+          if (local[p]) __atomic_fetch_add(&b->counts[p], local[p], __ATOMIC_RELAXED); \
+        }                                                                      \
+        free(local);                                                           \
+      }                                                                        \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_build_scatter)(void *arg, \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_build_t *b = (_hash_build_t *)arg;                                 \
+      struct type *elt;                                                        \
+      unsigned p;                                                              \
+      size_t *local = calloc(b->nparts, sizeof(size_t));                       \
+      if (local) {                                                             \
+        for (size_t i = start; i < end; i ++) {                                \
+          elt = &((struct type *)b->elts)[i];                                  \
+          local[(elt->field.hv & (b->num_buckets - 1)) >> b->part_shift] ++;   \
+        }                                                                      \
+        for (p = 0; p < b->nparts; p ++) {                                     \
+          if (local[p]) local[p] = __atomic_fetch_add(&b->cursors[p], local[p], \
+              __ATOMIC_RELAXED);                                               \
+        }                                                                      \
+      }                                                                        \
+      for (size_t i = start; i < end; i ++) {                                  \
+        elt = &((struct type *)b->elts)[i];                                    \
+        p = (elt->field.hv & (b->num_buckets - 1)) >> b->part_shift;           \
+        if (local) b->sorted[local[p] ++] = elt;                               \
+        else b->sorted[__atomic_fetch_add(&b->cursors[p], 1, __ATOMIC_RELAXED)] = elt; \
+      }                                                                        \
+      free(local);                                                             \
+    }                                                                          \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_build_link)(void *arg, \
+        size_t start, size_t end)                                              \
+    {                                                                          \
+      _hash_build_t *b = (_hash_build_t *)arg;                                 \
+      struct type *elt;                                                        \
+      _hash_node_t *bkt;                                                       \
+      size_t idx;                                                              \
+      for (unsigned p = start >> b->part_shift;                                \
+          p <= (end - 1) >> b->part_shift; p ++) {                             \
+        /* Cursors point to the end of partitions after scattering */          \
+        for (size_t i = b->cursors[p] - b->counts[p]; i < b->cursors[p]; i ++) { \
+          elt = (struct type *)b->sorted[i];                                   \
+          idx = elt->field.hv & (b->num_buckets - 1);                          \
+          if (idx < start || idx >= end) continue;                             \
+          if (i + 1 < b->cursors[p]) HASH_PREFETCH(b->sorted[i + 1]);          \
+          bkt = &b->nodes[idx];                                                \
+          HASH_INSERT_BKT(bkt, type, field, elt);                              \
+        }                                                                      \
+      }                                                                        \
     }
+#elif !defined(_HASH_GENERATE_ENGINE)
+#define _HASH_GENERATE_ENGINE(type, field)
+#endif
 
 #define HASH_FIND(head, type, field, key)                                     \
   (_hash_op_##type##_##field##_find((head), (void *)(key)))
 
+/*
+ * Hash value of an element or a key as used by the table, for _HV variants of
+ * operations. Tables of the same type share their hash function and its seed
+ */
+#define HASH_HASH_ELT(head, elm)                                               \
+  ((head)->ops->hash_func((elm), (head)->ops->hashd))
+#define HASH_HASH(head, type, field, key)                                      \
+  (_hash_op_##type##_##field##_hash_key((head), (void *)(key)))
+
 #ifdef HASH_BLOOM
 #define HASH_BLOOM_BITLEN (1ULL << HASH_BLOOM)
 #define HASH_BLOOM_BYTELEN (HASH_BLOOM_BITLEN/8) + ((HASH_BLOOM_BITLEN%8) ? 1:0)
@@ -0,0 +1,284 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_CACHE_H_
+#define HASH_CACHE_H_
+
+#ifdef __hash_h_included
+#error "hash_cache.h redefines HASH_ENTRY and must be included before hash.h"
+#endif
+
+#include <stdint.h>
+
+/*
+ * Hash entry with a cache word. It fits the padding after a hash value on
+ * LP64, so elements are not grown: the top bit is a CLOCK reference bit and
+ * the rest is the size charged to the byte budget of a cache
+ */
+#define HASH_ENTRY(type)                                                       \
+struct {                                                                       \
+  struct type *next;                                                           \
+  HASH_TYPE hv;                                                                \
+  uint32_t cache;                                                              \
+}
+
+#include "hash.h"
+
+#if !defined(_HASH_USE_CHAINED) || defined(_HASH_USE_CHAINED_LOCKFREE)
+#error "hash_cache.h works with the locked chained table only"
+#endif
+
+/*
+ * Bounded cache on top of the chained table. A cache holds at most `max_items`
+ * elements and `max_bytes` of charged sizes (0 disables a limit), and an insert
+ * over a limit evicts elements by CLOCK: a shared hand is an atomic bucket
+ * counter, so evicting threads take distinct buckets under their own bucket
+ * locks. A referenced element in a bucket under the hand loses its bit,
+ * an unreferenced one is unlinked and passed to `free_func` after the bucket
+ * is unlocked. Lookups set reference bits under bucket read locks.
+ *
+ * An element returned by a cache could be evicted by another thread at any
+ * time, so shared caches should copy values by HASH_CACHE_FIND_ELT_COPY or
+ * make `free_func` drop a reference instead of freeing an element.
+ *
+ *   HASH_CACHE_INIT(&head, node, hh, 100000, 64 << 20, node_free);
+ *   HASH_INIT_PTHREAD_RWLOCK(HASH_CACHE_TABLE(&head), node, hh);
+ *   HASH_CACHE_MAKE_TABLE(&head);
+ *   HASH_CACHE_INSERT(&head, node, hh, elt, sizeof(*elt) + elt->len, found);
+ */
+
+#define HASH_CACHE_REF 0x80000000U
+#define HASH_CACHE_SIZE_MAX 0x7fffffffU
+
+/* Buckets visited by one eviction: two passes clear and evict everything */
+#ifndef HASH_CACHE_EVICT_SWEEPS
+#define HASH_CACHE_EVICT_SWEEPS 2
+#endif
+
+#define HASH_CACHE_HEAD(name, type, field)                                     \
+  struct name {                                                                \
+    HASH_HEAD(, type, field) table;                                            \
+    unsigned max_items;                                                        \
+    size_t max_bytes;                                                          \
+    size_t bytes;                                                              \
+    unsigned hand;                                                             \
+    unsigned evictions;                                                        \
+    void (*free_func)(struct type *);                                          \
+  }
+
+#define HASH_CACHE_TABLE(head) (&(head)->table)
+
+#define HASH_CACHE_INIT(head, type, field, maxi, maxb, ffunc) do {             \
+  HASH_INIT(HASH_CACHE_TABLE(head), type, field);                              \
+  (head)->max_items = (maxi);                                                  \
+  (head)->max_bytes = (maxb);                                                  \
+  (head)->bytes = 0;                                                           \
+  (head)->hand = 0;                                                            \
+  (head)->evictions = 0;                                                       \
+  (head)->free_func = (ffunc);                                                 \
+} while(0)
+
+/* Should be called prior to sharing of a cache between threads */
+#define HASH_CACHE_MAKE_TABLE(head) HASH_MAKE_TABLE(HASH_CACHE_TABLE(head))
+
+#define HASH_CACHE_SIZE(elm, field) ((elm)->field.cache & HASH_CACHE_SIZE_MAX)
+
+/* Readers hold a bucket read lock, so the bit is set atomically if unset */
+#define _HASH_CACHE_TOUCH(elm, field) do {                                     \
+  if (!(__atomic_load_n(&(elm)->field.cache, __ATOMIC_RELAXED) &               \
+      HASH_CACHE_REF)) {                                                       \
+    __atomic_fetch_or(&(elm)->field.cache, HASH_CACHE_REF, __ATOMIC_RELAXED);  \
+  }                                                                            \
+} while(0)
+
+#define HASH_CACHE_OVER(head)                                                  \
+  (((head)->max_items != 0 && __atomic_load_n(&(head)->table.num_items,        \
+      __ATOMIC_RELAXED) > (head)->max_items) ||                                \
+  ((head)->max_bytes != 0 && __atomic_load_n(&(head)->bytes,                   \
+      __ATOMIC_RELAXED) > (head)->max_bytes))
+
+/*
+ * Advances the hand until a cache is within its limits. Every bucket is
+ * visited by one thread at a time and victims are freed out of locks, so
+ * the amortized cost of an insert is a constant number of bucket visits
+ */
+#define HASH_CACHE_EVICT(head, type, field) do {                               \
+  struct type *_victims = NULL, *_cur, *_prev, *_next;                         \
+  _hash_node_t *_bkt;                                                          \
+  unsigned _left, _evicted = 0;                                                \
+  HASH_LOCK_READ(HASH_CACHE_TABLE(head));                                      \
+  _left = (head)->table.num_buckets * HASH_CACHE_EVICT_SWEEPS;                 \
+  while (_left -- > 0 && HASH_CACHE_OVER(head)) {                              \
+    _bkt = &(head)->table.buckets[__atomic_fetch_add(&(head)->hand, 1,         \
+        __ATOMIC_RELAXED) & ((head)->table.num_buckets - 1)];                  \
+    if (_bkt->first == NULL) continue;                                         \
+    HASH_LOCK_NODE_WRITE(HASH_CACHE_TABLE(head), _bkt);                        \
+    _prev = NULL;                                                              \
+    for (_cur = (struct type *)_bkt->first; _cur != NULL; _cur = _next) {      \
+      _next = _cur->field.next;                                                \
+      if (__atomic_load_n(&_cur->field.cache, __ATOMIC_RELAXED) &              \
+          HASH_CACHE_REF) {                                                    \
+        __atomic_fetch_and(&_cur->field.cache, HASH_CACHE_SIZE_MAX,            \
+            __ATOMIC_RELAXED);                                                 \
+        _prev = _cur;                                                          \
+      }                                                                        \
+      else if (HASH_CACHE_OVER(head)) {                                        \
+        if (_prev != NULL) _prev->field.next = _next;                          \
+        else _bkt->first = (void *)_next;                                      \
+        _bkt->entries --;                                                      \
+        _HASH_FRONT_BUMP(HASH_CACHE_TABLE(head), _cur->field.hv);              \
+        _HASH_ITEMS_SUB(HASH_CACHE_TABLE(head), 1);                            \
+        __atomic_fetch_sub(&(head)->bytes, HASH_CACHE_SIZE(_cur, field),       \
+            __ATOMIC_RELAXED);                                                 \
+        _cur->field.next = _victims;                                           \
+        _victims = _cur;                                                       \
+        _evicted ++;                                                           \
+      }                                                                        \
+      else {                                                                   \
+        _prev = _cur;                                                          \
+      }                                                                        \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(HASH_CACHE_TABLE(head), _bkt);                      \
+  }                                                                            \
+  HASH_UNLOCK_READ(HASH_CACHE_TABLE(head));                                    \
+  if (_evicted > 0) {                                                          \
+    __atomic_fetch_add(&(head)->evictions, _evicted, __ATOMIC_RELAXED);        \
+  }                                                                            \
+  while (_victims != NULL) {                                                   \
+    _next = _victims->field.next;                                              \
+    _victims->field.next = NULL;                                               \
+    if ((head)->free_func) (head)->free_func(_victims);                        \
+    _victims = _next;                                                          \
+  }                                                                            \
+} while(0)
+
+/*
+ * Inserts `elm` charged by `size` bytes unless an equal element is cached:
+ * then `found` is set to it and it is marked as referenced. New elements start
+ * referenced, so they survive one pass of the hand
+ */
+#define HASH_CACHE_INSERT(head, type, field, elm, size, found) do {            \
+  HASH_TYPE _chv;                                                              \
+  size_t _csize = (size);                                                      \
+  if ((head)->table.buckets == NULL) HASH_CACHE_MAKE_TABLE(head);              \
+  if (_csize > HASH_CACHE_SIZE_MAX) _csize = HASH_CACHE_SIZE_MAX;              \
+  (elm)->field.cache = HASH_CACHE_REF | (uint32_t)_csize;                      \
+  _chv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);        \
+  _HASH_FIND_OR_INSERT_HV(HASH_CACHE_TABLE(head), type, field, elm, _chv,      \
+      found, _HASH_CACHE_TOUCH(_telt, field));                                 \
+  if ((found) == NULL) {                                                       \
+    __atomic_fetch_add(&(head)->bytes, _csize, __ATOMIC_RELAXED);              \
+    if (HASH_CACHE_OVER(head)) HASH_CACHE_EVICT(head, type, field);            \
+  }                                                                            \
+} while(0)
+
+#define _HASH_CACHE_FIND(head, type, field, elm, found, on_found) do {         \
+  (found) = NULL;                                                              \
+  if ((head)->table.buckets != NULL) {                                         \
+    struct type *_telt;                                                        \
+    _hash_node_t *_bkt;                                                        \
+    HASH_TYPE _chv;                                                            \
+    unsigned _probes = 0;                                                      \
+    _chv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);      \
+    HASH_LOCK_READ(HASH_CACHE_TABLE(head));                                    \
+    _bkt = HASH_FIND_BKT((head)->table.buckets, (head)->table.num_buckets,     \
+        _chv);                                                                 \
+    HASH_LOCK_NODE_READ(HASH_CACHE_TABLE(head), _bkt);                         \
+    _telt = (struct type *)_bkt->first;                                        \
+    while (_telt != NULL && (_telt->field.hv != _chv ||                        \
+        (head)->table.ops->hash_cmp((elm), _telt,                              \
+          (head)->table.ops->hashd) != 0)) {                                   \
+      _telt = _telt->field.next;                                               \
+      _probes ++;                                                              \
+    }                                                                          \
+    if (_telt != NULL) {                                                       \
+      _HASH_CACHE_TOUCH(_telt, field);                                         \
+      on_found;                                                                \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(HASH_CACHE_TABLE(head), _bkt);                       \
+    _HASH_PROBE_SAMPLE(HASH_CACHE_TABLE(head), _probes + (_telt != NULL));     \
+    HASH_UNLOCK_READ(HASH_CACHE_TABLE(head));                                  \
+    (found) = _telt;                                                           \
+  }                                                                            \
+} while(0)
+
+#define HASH_CACHE_FIND_ELT(head, type, field, elm, found)                     \
+  _HASH_CACHE_FIND(head, type, field, elm, found, (void)0)
+
+/*
+ * Copies `sizeof(*dst)` bytes of a found element to `dst` whilst its bucket is
+ * locked, so the copy is consistent even if the element is evicted afterwards
+ */
+#define HASH_CACHE_FIND_ELT_COPY(head, type, field, elm, dst, found)           \
+  _HASH_CACHE_FIND(head, type, field, elm, found,                              \
+      memcpy((dst), _telt, sizeof(*(dst))))
+
+/* Removes an equal element, if any, and passes it to `free_func` */
+#define HASH_CACHE_DELETE_ELT(head, type, field, elm) do {                     \
+  if ((head)->table.buckets != NULL) {                                         \
+    struct type *_telt, *_prev = NULL;                                         \
+    _hash_node_t *_bkt;                                                        \
+    HASH_TYPE _chv;                                                            \
+    _chv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);      \
+    HASH_LOCK_READ(HASH_CACHE_TABLE(head));                                    \
+    _bkt = HASH_FIND_BKT((head)->table.buckets, (head)->table.num_buckets,     \
+        _chv);                                                                 \
+    HASH_LOCK_NODE_WRITE(HASH_CACHE_TABLE(head), _bkt);                        \
+    _telt = (struct type *)_bkt->first;                                        \
+    while (_telt != NULL && (_telt->field.hv != _chv ||                        \
+        (head)->table.ops->hash_cmp((elm), _telt,                              \
+          (head)->table.ops->hashd) != 0)) {                                   \
+      _prev = _telt;                                                           \
+      _telt = _telt->field.next;                                               \
+    }                                                                          \
+    if (_telt != NULL) {                                                       \
+      if (_prev != NULL) _prev->field.next = _telt->field.next;                \
+      else _bkt->first = (void *)_telt->field.next;                            \
+      _telt->field.next = NULL;                                                \
+      _bkt->entries --;                                                        \
+      _HASH_FRONT_BUMP(HASH_CACHE_TABLE(head), _chv);                          \
+      _HASH_ITEMS_SUB(HASH_CACHE_TABLE(head), 1);                              \
+      __atomic_fetch_sub(&(head)->bytes, HASH_CACHE_SIZE(_telt, field),        \
+          __ATOMIC_RELAXED);                                                   \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(HASH_CACHE_TABLE(head), _bkt);                      \
+    HASH_UNLOCK_READ(HASH_CACHE_TABLE(head));                                  \
+    if (_telt != NULL && (head)->free_func) (head)->free_func(_telt);          \
+  }                                                                            \
+} while(0)
+
+#define HASH_CACHE_COUNT(head)                                                 \
+  __atomic_load_n(&(head)->table.num_items, __ATOMIC_RELAXED)
+
+#define HASH_CACHE_BYTES(head) __atomic_load_n(&(head)->bytes, __ATOMIC_RELAXED)
+
+#define HASH_CACHE_STATS(head, type, field, st)                                \
+  HASH_STATS(HASH_CACHE_TABLE(head), type, field, st)
+
+#define HASH_CACHE_DESTROY(head, type, field) do {                             \
+  if ((head)->table.buckets != NULL) {                                         \
+    HASH_DESTROY(HASH_CACHE_TABLE(head), type, field, (head)->free_func);      \
+  }                                                                            \
+  (head)->bytes = 0;                                                           \
+} while(0)
+
+#endif /* HASH_CACHE_H_ */
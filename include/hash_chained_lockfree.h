@@ -0,0 +1,579 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_CHAINED_LOCKFREE_H_
+#define HASH_CHAINED_LOCKFREE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Lock-free writers of the chained table, this header is included before
+ * hash.h. Buckets are Harris/Michael lists: an element is pushed to a bucket
+ * by CAS on its head and deleted by marking the low bit of its `next` pointer
+ * first and unlinking it afterwards, which any thread passing by helps to
+ * do. Insertions, deletions and lookups never take bucket locks, so writers
+ * of a hot bucket do not queue behind each other. Expansion is done as for
+ * chained tables under the table write lock, all other operations hold the
+ * table read lock.
+ *
+ * Unlinked elements could still be read by concurrent operations. They are
+ * reclaimed by epochs: HASH_DELETE_ELT_FREE passes an element to `free_func`
+ * once every operation that has started before the deletion is done. A found
+ * element could be used after the lookup within HASH_LF_ENTER/HASH_LF_EXIT.
+ *
+ * Caveats:
+ * - an element removed by HASH_DELETE_ELT must not be freed or inserted again
+ *   before HASH_LF_SYNCHRONIZE returns;
+ * - `merge_cb` of HASH_UPSERT runs concurrently with other operations on the
+ *   same element, so it should update it atomically;
+ * - iteration (HASH_ITERATE*, HASH_FILTER*) must not run concurrently with
+ *   deletions, HASH_STATS could;
+ * - per-type functions must be generated by HASH_LOCKFREE_GENERATE(type, field)
+ *   after HASH_GENERATE_*.
+ */
+#define _HASH_USE_CHAINED_LOCKFREE 1
+
+/* Threads share this number of reader counters of a table */
+#ifndef HASH_LF_EBR_SLOTS
+#define HASH_LF_EBR_SLOTS 32
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _HASH_LF_RELAX() __builtin_ia32_pause()
+#else
+#define _HASH_LF_RELAX() do {} while(0)
+#endif
+
+#define _HASH_LF_MARKED(p) ((uintptr_t)(p) & 1)
+#define _HASH_LF_MARK(p) ((__typeof(p))((uintptr_t)(p) | 1))
+#define _HASH_LF_UNMARK(p) ((__typeof(p))((uintptr_t)(p) & ~(uintptr_t)1))
+#define _HASH_LF_NEXT(elm, field)                                              \
+  __atomic_load_n(&(elm)->field.next, __ATOMIC_ACQUIRE)
+
+/*
+ * Epoch based reclamation. Operations are counted in the slot of their
+ * thread for the global epoch they have started in, and the epoch is advanced
+ * when no operation of the previous epoch is left. Elements retired in epoch
+ * `e` are freed when the epoch becomes `e + 2`, as operations that could have
+ * seen them belong to `e` or `e + 1`.
+ */
+typedef struct _hash_ebr_rec_s {
+  struct _hash_ebr_rec_s *next;
+  void *p;
+  void (*free_func)(void *p);
+} _hash_ebr_rec_t;
+
+typedef struct _hash_ebr_slot_s {
+  unsigned active[3];
+} __attribute__((aligned(64))) _hash_ebr_slot_t;
+
+typedef struct _hash_ebr_s {
+  unsigned epoch;
+  unsigned advancing;
+  _hash_ebr_rec_t *limbo[3];
+  _hash_ebr_slot_t slots[HASH_LF_EBR_SLOTS];
+} _hash_ebr_t;
+
+static unsigned _hash_ebr_threads __attribute__((__unused__));
+static __thread unsigned _hash_ebr_slot_id __attribute__((__unused__));
+
+static inline _hash_ebr_slot_t *
+_hash_ebr_slot(_hash_ebr_t *ebr)
+{
+  if (_hash_ebr_slot_id == 0) {
+    _hash_ebr_slot_id = __atomic_fetch_add(&_hash_ebr_threads, 1,
+        __ATOMIC_RELAXED) % HASH_LF_EBR_SLOTS + 1;
+  }
+  return &ebr->slots[_hash_ebr_slot_id - 1];
+}
+
+/* Returns the epoch to be passed to _hash_ebr_exit */
+static inline unsigned
+_hash_ebr_enter(_hash_ebr_t *ebr)
+{
+  _hash_ebr_slot_t *s = _hash_ebr_slot(ebr);
+  unsigned e;
+
+  for (;;) {
+    e = __atomic_load_n(&ebr->epoch, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(&s->active[e % 3], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ebr->epoch, __ATOMIC_SEQ_CST) == e) return e;
+    __atomic_fetch_sub(&s->active[e % 3], 1, __ATOMIC_RELEASE);
+  }
+}
+
+static inline void
+_hash_ebr_exit(_hash_ebr_t *ebr, unsigned e)
+{
+  __atomic_fetch_sub(&_hash_ebr_slot(ebr)->active[e % 3], 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+_hash_ebr_free_list(_hash_ebr_rec_t *rec)
+{
+  _hash_ebr_rec_t *next;
+
+  for (; rec != NULL; rec = next) {
+    next = rec->next;
+    rec->free_func(rec->p);
+    free(rec);
+  }
+}
+
+/*
+ * Moves to the next epoch unless some operation of the previous one is still
+ * running and frees elements retired two epochs ago. Nothing is retired to
+ * that list meanwhile, as no operation of that epoch is left
+ */
+static inline void
+_hash_ebr_advance(_hash_ebr_t *ebr)
+{
+  _hash_ebr_rec_t *rec;
+  unsigned e;
+
+  if (__atomic_exchange_n(&ebr->advancing, 1, __ATOMIC_ACQUIRE)) return;
+  e = __atomic_load_n(&ebr->epoch, __ATOMIC_RELAXED);
+  for (unsigned i = 0; i < HASH_LF_EBR_SLOTS; i ++) {
+    if (__atomic_load_n(&ebr->slots[i].active[(e + 2) % 3],
+        __ATOMIC_SEQ_CST) != 0) {
+      __atomic_store_n(&ebr->advancing, 0, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+  rec = __atomic_exchange_n(&ebr->limbo[(e + 1) % 3], NULL, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&ebr->epoch, e + 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&ebr->advancing, 0, __ATOMIC_RELEASE);
+  _hash_ebr_free_list(rec);
+}
+
+/* Called from an operation of epoch `e`, returns 0 if out of memory */
+static inline int
+_hash_ebr_retire(_hash_ebr_t *ebr, unsigned e, void *p,
+    void (*free_func)(void *p))
+{
+  _hash_ebr_rec_t *rec = malloc(sizeof(*rec));
+
+  if (rec == NULL) return 0;
+  rec->p = p;
+  rec->free_func = free_func;
+  rec->next = __atomic_load_n(&ebr->limbo[e % 3], __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&ebr->limbo[e % 3], &rec->next, rec, 1,
+      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/* Waits until operations running at the moment are done */
+static inline void
+_hash_ebr_synchronize(_hash_ebr_t *ebr)
+{
+  unsigned e = __atomic_load_n(&ebr->epoch, __ATOMIC_ACQUIRE);
+
+  while (__atomic_load_n(&ebr->epoch, __ATOMIC_ACQUIRE) - e < 2) {
+    _hash_ebr_advance(ebr);
+    _HASH_LF_RELAX();
+  }
+}
+
+#define HASH_HEAD(name, type, field)                                           \
+  struct name {                                                                \
+   _hash_node_t *buckets;                                                      \
+   struct _hash_ops_##type##_##field *ops;                                     \
+   unsigned num_buckets, log2_num_buckets;                                     \
+   unsigned ideal_chain_maxlen;                                                \
+   unsigned nonideal_items;                                                    \
+   unsigned ineff_expands, noexpand;                                           \
+   unsigned num_items;                                                         \
+   unsigned need_expand;                                                       \
+   unsigned generation;                                                        \
+   unsigned expands;                                                           \
+   uint64_t expand_ns;                                                         \
+   _HASH_PROBE_FIELDS                                                          \
+   uint32_t signature; /* used only to find hash tables in external analysis */ \
+   uint8_t *bloom_bv;                                                          \
+   char bloom_nbits;                                                           \
+   void *resize_lock;                                                          \
+   _hash_ebr_t *ebr;                                                           \
+  }
+
+/* Buckets have no locks */
+#define HASH_ALLOC_NODES(head, nodes, size) do {                               \
+  if ((head)->ops->alloc) (nodes) = (head)->ops->alloc(sizeof(*(nodes)) * (size), \
+      (head)->ops->allocd);                                                    \
+  else (nodes) = malloc(sizeof(*(nodes)) * (size));                            \
+  if ((nodes) != NULL) memset(nodes, 0, sizeof(*(nodes)) * (size));            \
+} while(0)
+
+#define HASH_FREE_NODES(head, nodes, size) do {                                \
+  if ((head)->ops->free) (head)->ops->free(sizeof(*(nodes)) * (size), (nodes), (head)->ops->allocd); \
+  else free(nodes);                                                            \
+} while(0)
+
+#define _HASH_LF_ENTRIES_ADD(head, bkt) do {                                   \
+  if (__atomic_add_fetch(&(bkt)->entries, 1, __ATOMIC_RELAXED) >=              \
+      (((bkt)->expand_mult+1) * HASH_BKT_CAPACITY_THRESH) &&                   \
+      (head)->need_expand != 2) {                                              \
+    (head)->need_expand = 1;                                                   \
+  }                                                                            \
+} while(0)
+
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  _hash_node_t *_bkt;                                                          \
+  unsigned _gen;                                                               \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  (elm)->field.hv = (h);                                                       \
+  HASH_LOCK_READ(head);                                                        \
+  _gen = (head)->generation;                                                   \
+  _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (elm)->field.hv); \
+  _hash_lf_##type##_##field##_push(_bkt, (elm));                               \
+  _HASH_LF_ENTRIES_ADD(head, _bkt);                                            \
+  _HASH_ITEMS_ADD(head, 1);                                                    \
+  HASH_UNLOCK_READ(head);                                                      \
+  if ((head)->need_expand == 1) {                                              \
+    _HASH_EXPAND_BUCKETS_GEN(head, type, field, _gen);                         \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_LF_FIND_OR_INSERT_HV(head, type, field, elm, _hv, found, (void)0);     \
+} while(0)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_LF_FIND_OR_INSERT_HV(head, type, field, elm, h, found, (void)0)
+
+/* `merge_cb` is not serialized with other operations, see above */
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _hv;                                                               \
+  struct type *_uelt;                                                          \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_LF_FIND_OR_INSERT_HV(head, type, field, elm, _hv, _uelt,               \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_LF_FIND_OR_INSERT_HV(head, type, field, elm, h, _uelt,                 \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+
+/* `on_found` is executed with `_telt` pointing to the existing element */
+#define _HASH_LF_FIND_OR_INSERT_HV(head, type, field, elm, h, found, on_found) do { \
+  _hash_node_t *_bkt;                                                          \
+  struct type *_telt;                                                          \
+  unsigned _gen, _ep, _probes;                                                 \
+  if ((head)->buckets == NULL) HASH_MAKE_TABLE(head);                          \
+  HASH_LOCK_READ(head);                                                        \
+  _ep = _hash_ebr_enter((head)->ebr);                                          \
+  _gen = (head)->generation;                                                   \
+  _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));             \
+  (elm)->field.hv = (h);                                                       \
+  _telt = _hash_lf_##type##_##field##_insert((head)->ops, _bkt, (elm),         \
+      &_probes);                                                               \
+  _HASH_PROBE_SAMPLE(head, _probes);                                           \
+  if (_telt != NULL) {                                                         \
+    on_found;                                                                  \
+  }                                                                            \
+  else {                                                                       \
+    _HASH_LF_ENTRIES_ADD(head, _bkt);                                          \
+  }                                                                            \
+  _hash_ebr_exit((head)->ebr, _ep);                                            \
+  if (_telt == NULL) _HASH_ITEMS_ADD(head, 1);                                 \
+  HASH_UNLOCK_READ(head);                                                      \
+  (found) = _telt;                                                             \
+  if (_telt == NULL && (head)->need_expand == 1) {                             \
+    _HASH_EXPAND_BUCKETS_GEN(head, type, field, _gen);                         \
+  }                                                                            \
+} while(0)
+
+/* Wait-free walk skipping deleted elements */
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if ((head)->buckets == NULL) (found) = NULL;                                 \
+  else {                                                                       \
+    struct type *_telt, *_tnext;                                               \
+    _hash_node_t *_bkt;                                                        \
+    unsigned _ep, _probes = 0;                                                 \
+    HASH_LOCK_READ(head);                                                      \
+    _ep = _hash_ebr_enter((head)->ebr);                                        \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));           \
+    _telt = (struct type *)__atomic_load_n(&_bkt->first, __ATOMIC_ACQUIRE);    \
+    while (_telt != NULL) {                                                    \
+      _tnext = _HASH_LF_NEXT(_telt, field);                                    \
+      if (!_HASH_LF_MARKED(_tnext) && _telt->field.hv == (h) &&                \
+          (head)->ops->hash_cmp((elm), _telt, (head)->ops->hashd) == 0) break; \
+      _telt = _HASH_LF_UNMARK(_tnext);                                         \
+      _probes ++;                                                              \
+    }                                                                          \
+    _hash_ebr_exit((head)->ebr, _ep);                                          \
+    _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                       \
+    HASH_UNLOCK_READ(head);                                                    \
+    (found) = _telt;                                                           \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h)                          \
+  _HASH_LF_DELETE_ELT_HV(head, type, field, elm, h, NULL)
+
+/*
+ * Unlink an element with the key of `elm` and pass it to `free_func` once no
+ * running operation could see it. `free_func` could be called by any thread
+ * that deletes elements later
+ */
+#define HASH_DELETE_ELT_FREE(head, type, field, elm, free_func) do {           \
+  if ((head)->buckets != NULL) {                                               \
+    HASH_TYPE _dhv;                                                            \
+    _dhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    _HASH_LF_DELETE_ELT_HV(head, type, field, elm, _dhv, free_func);           \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_FREE_HV(head, type, field, elm, h, free_func)          \
+  _HASH_LF_DELETE_ELT_HV(head, type, field, elm, h, free_func)
+
+#define _HASH_LF_DELETE_ELT_HV(head, type, field, elm, h, free_func) do {      \
+  if ((head)->buckets != NULL) {                                               \
+    struct type *_telt;                                                        \
+    _hash_node_t *_bkt;                                                        \
+    unsigned _ep, _probes;                                                     \
+    int _retired = 0;                                                          \
+    HASH_LOCK_READ(head);                                                      \
+    _ep = _hash_ebr_enter((head)->ebr);                                        \
+    _bkt = HASH_FIND_BKT((head)->buckets, (head)->num_buckets, (h));           \
+    _telt = _hash_lf_##type##_##field##_delete((head)->ops, _bkt, (elm), (h),  \
+        &_probes);                                                             \
+    _HASH_PROBE_SAMPLE(head, _probes + (_telt != NULL));                       \
+    if (_telt != NULL) {                                                       \
+      __atomic_fetch_sub(&_bkt->entries, 1, __ATOMIC_RELAXED);                 \
+      if ((free_func) != NULL) {                                               \
+        _retired = _hash_ebr_retire((head)->ebr, _ep, _telt,                   \
+            (void (*)(void *))(free_func));                                    \
+      }                                                                        \
+    }                                                                          \
+    _hash_ebr_exit((head)->ebr, _ep);                                          \
+    if (_telt != NULL) _HASH_ITEMS_SUB(head, 1);                               \
+    HASH_UNLOCK_READ(head);                                                    \
+    if (_telt != NULL && (free_func) != NULL) {                                \
+      if (_retired) _hash_ebr_advance((head)->ebr);                            \
+      else {                                                                   \
+        _hash_ebr_synchronize((head)->ebr);                                    \
+        _hash_op_##type##_##field##_delete_node((free_func), _telt);           \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+} while(0)
+
+/*
+ * Elements found between HASH_LF_ENTER and HASH_LF_EXIT are not freed by
+ * HASH_DELETE_ELT_FREE meanwhile. HASH_LF_SYNCHRONIZE must not be called
+ * in between by the same thread
+ */
+#define HASH_LF_ENTER(head) _hash_ebr_enter((head)->ebr)
+#define HASH_LF_EXIT(head, epoch) _hash_ebr_exit((head)->ebr, (epoch))
+
+/* Waits until operations that have started before are done */
+#define HASH_LF_SYNCHRONIZE(head) do {                                         \
+  if ((head)->ebr != NULL) _hash_ebr_synchronize((head)->ebr);                 \
+} while(0)
+
+#define HASH_MAKE_TABLE(head) do {                                             \
+  _HASH_MAKE_BUCKETS(head);                                                    \
+  (head)->ebr = calloc(1, sizeof(*(head)->ebr));                               \
+} while(0)
+
+/* Retired elements are freed as well */
+#define HASH_DESTROY(head, type, field, free_func) do {                        \
+  HASH_CLEANUP_NODES(head, type, field, free_func);                            \
+  HASH_LOCK_WRITE(head);                                                       \
+  if ((head)->buckets != NULL)                                                 \
+    HASH_FREE_NODES((head), (head)->buckets, (head)->num_buckets);             \
+  (head)->buckets = NULL;                                                      \
+  (head)->num_buckets = 0;                                                     \
+  (head)->log2_num_buckets = 0;                                                \
+  (head)->generation = 0;                                                      \
+  (head)->num_items = 0;                                                       \
+  if ((head)->ebr != NULL) {                                                   \
+    for (unsigned _e = 0; _e < 3; _e ++)                                       \
+      _hash_ebr_free_list((head)->ebr->limbo[_e]);                             \
+    free((head)->ebr);                                                         \
+    (head)->ebr = NULL;                                                        \
+  }                                                                            \
+  HASH_UNLOCK_WRITE(head);                                                     \
+  if ((head)->ops->lock_destroy) (head)->ops->lock_destroy((head)->resize_lock, (head)->ops->lockd); \
+} while(0)
+
+/*
+ * Same as the chained HASH_STATS, but deleted elements are skipped and
+ * unlinked ones are not freed whilst chains are walked
+ */
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->buckets != NULL) {                                               \
+    unsigned _ep = _hash_ebr_enter((head)->ebr);                               \
+    for (unsigned _i = 0; _i < (head)->num_buckets; _i ++) {                   \
+      _hash_node_t *_bkt = &(head)->buckets[_i];                               \
+      struct type *_telt, *_tnext;                                             \
+      unsigned _len = 0;                                                       \
+      _telt = (struct type *)__atomic_load_n(&_bkt->first, __ATOMIC_ACQUIRE);  \
+      for (; _telt != NULL; _telt = _HASH_LF_UNMARK(_tnext)) {                 \
+        _tnext = _HASH_LF_NEXT(_telt, field);                                  \
+        if (_HASH_LF_MARKED(_tnext)) continue;                                 \
+        _len ++;                                                               \
+        _HASH_STATS_HIST_ADD((st)->probe_hist, _len);                          \
+      }                                                                        \
+      _HASH_STATS_HIST_ADD((st)->chain_hist, _len);                            \
+      if (_len == 0) (st)->empty_buckets ++;                                   \
+      if (_len > (st)->max_chain) (st)->max_chain = _len;                      \
+      (st)->num_items += _len;                                                 \
+    }                                                                          \
+    _hash_ebr_exit((head)->ebr, _ep);                                          \
+    (st)->num_buckets = (head)->num_buckets;                                   \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+    (st)->expands = (head)->expands;                                           \
+    (st)->expand_ns = (head)->expand_ns;                                       \
+    (st)->ideal_chain_maxlen = (head)->ideal_chain_maxlen;                     \
+    (st)->nonideal_items = (head)->nonideal_items;                             \
+    (st)->ineff_expands = (head)->ineff_expands;                               \
+    (st)->noexpand = (head)->noexpand;                                         \
+    _HASH_PROBE_COLLECT(head, st);                                             \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+
+/*
+ * Generate lock-free helpers for the specified hash type. Links of a bucket
+ * are addressed by the preceding element, NULL stands for the bucket head
+ */
+#define HASH_LOCKFREE_GENERATE(type, field)                                    \
+  static int _HU_FUNCTION(_hash_lf_##type##_##field##_cas)(_hash_node_t *bkt,  \
+      struct type *pred, struct type *expected, struct type *desired) {        \
+    if (pred == NULL) {                                                        \
+      void *exp = expected;                                                    \
+      return __atomic_compare_exchange_n(&bkt->first, &exp, (void *)desired,   \
+          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);                              \
+    }                                                                          \
+    return __atomic_compare_exchange_n(&pred->field.next, &expected, desired,  \
+        0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);                                \
+  }                                                                            \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_push)(                  \
+      _hash_node_t *bkt, struct type *elm) {                                   \
+    struct type *first;                                                        \
+    do {                                                                       \
+      first = (struct type *)__atomic_load_n(&bkt->first, __ATOMIC_ACQUIRE);   \
+      elm->field.next = first;                                                 \
+    } while (!_hash_lf_##type##_##field##_cas(bkt, NULL, first, elm));         \
+  }                                                                            \
+  /*                                                                           \
+   * Find a live element with the key of `elm` unlinking deleted elements on   \
+   * the way. `*first` is set to the bucket head the walk has started from     \
+   */                                                                          \
+  static struct type* _HU_FUNCTION(_hash_lf_##type##_##field##_find)(          \
+      struct _hash_ops_##type##_##field *ops, _hash_node_t *bkt,               \
+      const struct type *elm, HASH_TYPE hv, struct type **first,               \
+      unsigned *probes) {                                                      \
+    struct type *pred, *cur, *next;                                            \
+  retry:                                                                       \
+    pred = NULL;                                                               \
+    cur = (struct type *)__atomic_load_n(&bkt->first, __ATOMIC_ACQUIRE);       \
+    *first = cur;                                                              \
+    *probes = 0;                                                               \
+    while (cur != NULL) {                                                      \
+      next = _HASH_LF_NEXT(cur, field);                                        \
+      if (_HASH_LF_MARKED(next)) {                                             \
+        next = _HASH_LF_UNMARK(next);                                          \
+        if (!_hash_lf_##type##_##field##_cas(bkt, pred, cur, next))            \
+          goto retry;                                                          \
+        if (pred == NULL) *first = next;                                       \
+        cur = next;                                                            \
+        continue;                                                              \
+      }                                                                        \
+      (*probes) ++;                                                            \
+      if (cur->field.hv == hv && ops->hash_cmp(elm, cur, ops->hashd) == 0)     \
+        return cur;                                                            \
+      pred = cur;                                                              \
+      cur = next;                                                              \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+  /*                                                                           \
+   * Push `elm` unless a live element with the same key exists, which is       \
+   * returned. A concurrent insertion of the same key changes the bucket head, \
+   * so the CAS fails and the bucket is searched again                         \
+   */                                                                          \
+  static struct type* _HU_FUNCTION(_hash_lf_##type##_##field##_insert)(        \
+      struct _hash_ops_##type##_##field *ops, _hash_node_t *bkt,               \
+      struct type *elm, unsigned *probes) {                                    \
+    struct type *found, *first;                                                \
+    for (;;) {                                                                 \
+      found = _hash_lf_##type##_##field##_find(ops, bkt, elm, elm->field.hv,   \
+          &first, probes);                                                     \
+      if (found != NULL) return found;                                         \
+      elm->field.next = first;                                                 \
+      if (_hash_lf_##type##_##field##_cas(bkt, NULL, first, elm)) return NULL; \
+    }                                                                          \
+  }                                                                            \
+  /* Walk a bucket unlinking marked elements until `elm` is gone */            \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_unlink)(                \
+      _hash_node_t *bkt, struct type *elm) {                                   \
+    struct type *pred, *cur, *next;                                            \
+  retry:                                                                       \
+    pred = NULL;                                                               \
+    cur = (struct type *)__atomic_load_n(&bkt->first, __ATOMIC_ACQUIRE);       \
+    while (cur != NULL) {                                                      \
+      next = _HASH_LF_NEXT(cur, field);                                        \
+      if (_HASH_LF_MARKED(next)) {                                             \
+        next = _HASH_LF_UNMARK(next);                                          \
+        if (!_hash_lf_##type##_##field##_cas(bkt, pred, cur, next))            \
+          goto retry;                                                          \
+        if (cur == elm) return;                                                \
+        cur = next;                                                            \
+        continue;                                                              \
+      }                                                                        \
+      pred = cur;                                                              \
+      cur = next;                                                              \
+    }                                                                          \
+  }                                                                            \
+  /* Returns the unlinked element, the one who has marked it unlinks it */     \
+  static struct type* _HU_FUNCTION(_hash_lf_##type##_##field##_delete)(        \
+      struct _hash_ops_##type##_##field *ops, _hash_node_t *bkt,               \
+      const struct type *elm, HASH_TYPE hv, unsigned *probes) {                \
+    struct type *found, *first, *next;                                         \
+    for (;;) {                                                                 \
+      found = _hash_lf_##type##_##field##_find(ops, bkt, elm, hv, &first,      \
+          probes);                                                             \
+      if (found == NULL) return NULL;                                          \
+      next = _HASH_LF_NEXT(found, field);                                      \
+      while (!_HASH_LF_MARKED(next)) {                                         \
+        if (__atomic_compare_exchange_n(&found->field.next, &next,             \
+            _HASH_LF_MARK(next), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {     \
+          _hash_lf_##type##_##field##_unlink(bkt, found);                      \
+          return found;                                                        \
+        }                                                                      \
+      }                                                                        \
+      /* Deleted by another thread, look for another element with this key */  \
+    }                                                                          \
+  }
+
+#endif /* HASH_CHAINED_LOCKFREE_H_ */
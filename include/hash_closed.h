@@ -25,6 +25,34 @@
 
 #define _HASH_USE_CLOSED 1
 #define _HASH_UPPER_BOUND 0.6
+
+/*
+ * Closed table is split to 2^HASH_CLOSED_SHARDS_LOG2 shards selected by the
+ * top bits of a hash value. Each shard is a separate open addressing table with
+ * its own lock and its own resize schedule, so operations on different shards
+ * never contend. Shard locks are created by `lockn_*` ops, therefore both
+ * HASH_INIT_PTHREAD_RWLOCK and HASH_INIT_PTHREAD_MUTEX could be used.
+ */
+#ifndef HASH_CLOSED_SHARDS_LOG2
+#define HASH_CLOSED_SHARDS_LOG2 0
+#endif
+#define HASH_CLOSED_SHARDS (1U << HASH_CLOSED_SHARDS_LOG2)
+
+#if HASH_CLOSED_SHARDS_LOG2 > 0
+#define _HASH_CLOSED_SHARD_IDX(h)                                              \
+  ((unsigned)((h) >> (sizeof(HASH_TYPE) * 8 - HASH_CLOSED_SHARDS_LOG2)))
+/* Avoid false sharing of shards counters */
+# ifdef __GNUC__
+#   define _HASH_CLOSED_SHARD_ALIGN __attribute__((aligned(64)))
+# endif
+#else
+#define _HASH_CLOSED_SHARD_IDX(h) 0U
+#endif
+
+#ifndef _HASH_CLOSED_SHARD_ALIGN
+#define _HASH_CLOSED_SHARD_ALIGN
+#endif
+
 /* No need to store anything in the value itself */
 #define HASH_ENTRY(type)                                                       \
 struct {                                                                       \
@@ -35,115 +63,272 @@ struct {                                                                       \
 #define HASH_HEAD(name, type, field)                                           \
 struct name {                                                                  \
    struct _hash_ops_##type##_##field *ops;                                     \
-   struct type *nodes;                                                         \
-   unsigned n_buckets, n_occupied, upper_bound;                                \
-   unsigned need_expand;                                                       \
-   unsigned generation;                                                        \
+   struct {                                                                    \
+     struct type *nodes;                                                       \
+     unsigned n_buckets, n_occupied, n_deleted, upper_bound;                   \
+     unsigned need_expand;                                                     \
+     unsigned generation;                                                      \
+     uint64_t expand_ns;                                                       \
+     _HASH_PROBE_FIELDS                                                        \
+     void *lock;                                                               \
+   } _HASH_CLOSED_SHARD_ALIGN shards[HASH_CLOSED_SHARDS];                      \
 }
 
 /* Basic ops */
-#define _HASH_NODE_EMPTY(node, field) (((node)->field.flags & 0x1) == 0)
-#define _HASH_NODE_ERASE(node, field) ((node)->field.flags &= ~0x1)
-#define _HASH_NODE_FILL(node, field) ((node)->field.flags |= 0x1)
+#define _HASH_NODE_FILLED 0x1
+#define _HASH_NODE_DELETED 0x2
+/* Node has no live element (it is either free or deleted) */
+#define _HASH_NODE_EMPTY(node, field) (((node)->field.flags & _HASH_NODE_FILLED) == 0)
+/* Node has never been used, so probing stops here */
+#define _HASH_NODE_FREE(node, field) ((node)->field.flags == 0)
+#define _HASH_NODE_ERASE(node, field) ((node)->field.flags = _HASH_NODE_DELETED)
+#define _HASH_NODE_FILL(node, field) ((node)->field.flags = _HASH_NODE_FILLED)
+
+#define HASH_SHARD(head, hv) (&(head)->shards[_HASH_CLOSED_SHARD_IDX(hv)])
 
 /*
  * We use quadratic probe here:
  * http://en.wikipedia.org/wiki/Quadratic_probing
+ *
+ * The whole operation is performed under the write lock of a shard, including
+ * the possible expansion of that shard.
  */
 #define HASH_INSERT(head, type, field, elm) do {                               \
-  if ((head)->nodes == NULL) HASH_MAKE_TABLE(head);                            \
   HASH_TYPE _hv;                                                               \
-  struct type *_h = (elm);                                                     \
-  if ((head)->n_occupied >= (head)->upper_bound) {                             \
-    (head)->need_expand = 1;                                                   \
-  }                                                                            \
   _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
-  (elm)->field.hv = _hv;                                                       \
-  HASH_FIND_BKT(head, type, field, _hv, _h);                                   \
-  memcpy(_h, elm, sizeof(*_h));                                                \
-  _HASH_NODE_FILL(_h, field);                                                  \
-  (head)->n_occupied ++;                                                       \
-  if ((head)->need_expand == 1) {                                              \
-    HASH_EXPAND_BUCKETS(head, type, field);                                    \
+  HASH_INSERT_HV(head, type, field, elm, _hv);                                 \
+} while(0)
+
+/* _HV variants accept a hash value computed by HASH_HASH or HASH_HASH_ELT */
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  HASH_TYPE _ihv = (h);                                                        \
+  if ((head)->shards[0].nodes == NULL) HASH_MAKE_TABLE(head);                  \
+  (elm)->field.hv = _ihv;                                                      \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                          \
+  _HASH_INSERT_SHARD(head, HASH_SHARD(head, _ihv), type, field, elm, _ihv);    \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                        \
+} while(0)
+
+#define _HASH_INSERT_SHARD(head, sh, type, field, elm, h) do {                 \
+  struct type *_hslot;                                                         \
+  HASH_FIND_BKT(head, sh, type, field, h, elm, _hslot);                        \
+  _HASH_FILL_SLOT(head, sh, type, field, elm, _hslot);                         \
+} while(0)
+
+/* Copies `elm` to the slot returned by HASH_FIND_BKT, slot is invalidated */
+#define _HASH_FILL_SLOT(head, sh, type, field, elm, slot) do {                 \
+  if (_HASH_NODE_FREE(slot, field)) (sh)->n_occupied ++;                       \
+  else if (_HASH_NODE_EMPTY(slot, field)) (sh)->n_deleted --;                  \
+  memcpy(slot, elm, sizeof(*(slot)));                                          \
+  _HASH_NODE_FILL(slot, field);                                                \
+  if ((sh)->n_occupied >= (sh)->upper_bound) {                                 \
+    (sh)->need_expand = 1;                                                     \
+    HASH_EXPAND_SHARD(head, sh, type, field);                                  \
   }                                                                            \
 } while(0)
 
+/*
+ * Insert `elm` unless an element with the same key exists, `found` is set to
+ * the existing element (valid as HASH_FIND_ELT result) or to NULL if `elm` has
+ * been inserted
+ */
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _fohv;                                                             \
+  _fohv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+  _HASH_FIND_OR_INSERT_CLOSED(head, type, field, elm, _fohv, found, (void)0);  \
+} while(0)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_FIND_OR_INSERT_CLOSED(head, type, field, elm, h, found, (void)0)
+
+/* Existing element is merged in place whilst its shard is locked */
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _uhv;                                                              \
+  _uhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                    \
+  HASH_UPSERT_HV(head, type, field, elm, _uhv, merge_cb);                      \
+} while(0)
+
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_FIND_OR_INSERT_CLOSED(head, type, field, elm, h, _uelt,                \
+      (merge_cb)(_hslot, (elm)));                                              \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define _HASH_FIND_OR_INSERT_CLOSED(head, type, field, elm, h, found, on_found) do { \
+  HASH_TYPE _hv = (h);                                                         \
+  struct type *_hslot;                                                         \
+  if ((head)->shards[0].nodes == NULL) HASH_MAKE_TABLE(head);                  \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                           \
+  HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot);   \
+  if (!_HASH_NODE_EMPTY(_hslot, field)) {                                      \
+    on_found;                                                                  \
+    (found) = _hslot;                                                          \
+  }                                                                            \
+  else {                                                                       \
+    (elm)->field.hv = _hv;                                                     \
+    _HASH_FILL_SLOT(head, HASH_SHARD(head, _hv), type, field, elm, _hslot);    \
+    (found) = NULL;                                                            \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+} while(0)
+
+/*
+ * Found element points to the storage of a shard, so it is valid merely until
+ * the next insertion to the same shard. Concurrent readers should use
+ * HASH_FIND_ELT_COPY instead.
+ */
 #define HASH_FIND_ELT(head, type, field, elm, found) do {                      \
-  if ((head)->nodes == NULL) (found) = NULL;                                   \
+  if ((head)->shards[0].nodes == NULL) (found) = NULL;                         \
+  else {                                                                       \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_HV(head, type, field, elm, _fhv, found);                     \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if ((head)->shards[0].nodes == NULL) (found) = NULL;                         \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    (found) = _HASH_NODE_EMPTY(_hslot, field) ? NULL : _hslot;                 \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/*
+ * Copy the found element to `dst` whilst the shard is still locked, `found` is
+ * set to `dst` or to NULL if nothing has been found
+ */
+#define HASH_FIND_ELT_COPY(head, type, field, elm, dst, found) do {            \
+  if ((head)->shards[0].nodes == NULL) (found) = NULL;                         \
   else {                                                                       \
-    HASH_TYPE _hv;                                                             \
-    (found) = (elm);                                                           \
-    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
-    HASH_FIND_BKT(head, type, field, _hv, found);                              \
-    if (_HASH_NODE_EMPTY(found, field)) (found) = NULL;                        \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_COPY_HV(head, type, field, elm, _fhv, dst, found);           \
   }                                                                            \
 } while(0)
 
+#define HASH_FIND_ELT_COPY_HV(head, type, field, elm, h, dst, found) do {      \
+  if ((head)->shards[0].nodes == NULL) (found) = NULL;                         \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (_HASH_NODE_EMPTY(_hslot, field)) (found) = NULL;                       \
+    else {                                                                     \
+      memcpy((dst), _hslot, sizeof(*_hslot));                                  \
+      (found) = (dst);                                                         \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/*
+ * Deleted nodes are marked as such to keep probe sequences unbroken, they are
+ * reused by insertions and dropped completely on the next expansion
+ */
 #define HASH_DELETE_ELT(head, type, field, elm) do {                           \
-  if ((head)->buckets != NULL) {                                               \
-    struct type *_h;                                                           \
-    HASH_FIND_BKT(head, type, field, _hv, _h);                                 \
-    if (!_HASH_NODE_EMPTY(_h, field)) {                                        \
-      _HASH_NODE_ERASE(_h,field);                                              \
-      (head)->n_occupied --;                                                   \
+  if ((head)->shards[0].nodes != NULL) {                                       \
+    HASH_TYPE _dhv;                                                            \
+    _dhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_DELETE_ELT_HV(head, type, field, elm, _dhv);                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if ((head)->shards[0].nodes != NULL) {                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (!_HASH_NODE_EMPTY(_hslot, field)) {                                    \
+      _HASH_NODE_ERASE(_hslot, field);                                         \
+      HASH_SHARD(head, _hv)->n_deleted ++;                                     \
     }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                       \
   }                                                                            \
 } while(0)
 
 #define HASH_CLEANUP_NODES(head, type, field, free_func) do {                  \
-  if ((head)->nodes != NULL) {                                                 \
-      struct type *_bkt;                                                       \
-      for (unsigned _i = 0; _i < (head)->n_buckets; _i ++) {                   \
-        _bkt = &(head)->nodes[_i];                                             \
-        if(_HASH_NODE_EMPTY(_bkt, field)) continue;                            \
-        if ((free_func) != NULL) _hash_op_##type##_##field##_delete_node((free_func), _bkt); \
-        _HASH_NODE_ERASE(_bkt, field);                                         \
+  if ((head)->shards[0].nodes != NULL) {                                       \
+    struct type *_bkt;                                                         \
+    for (unsigned _s = 0; _s < HASH_CLOSED_SHARDS; _s ++) {                    \
+      HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
+      for (unsigned _i = 0; _i < (head)->shards[_s].n_buckets; _i ++) {        \
+        _bkt = &(head)->shards[_s].nodes[_i];                                  \
+        if(!_HASH_NODE_EMPTY(_bkt, field) && (free_func) != NULL)              \
+          _hash_op_##type##_##field##_delete_node((free_func), _bkt);          \
+        _bkt->field.flags = 0;                                                 \
       }                                                                        \
-      (head)->n_occupied = 0;                                                  \
+      (head)->shards[_s].n_occupied = 0;                                       \
+      (head)->shards[_s].n_deleted = 0;                                        \
+      HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                       \
     }                                                                          \
+  }                                                                            \
 } while(0)
 
 #define HASH_DESTROY(head, type, field, free_func) do {                        \
   HASH_CLEANUP_NODES(head, type, field, free_func);                            \
-  HASH_FREE_NODES((head), (head)->nodes, (head)->n_buckets);                   \
-  (head)->nodes = NULL;                                                        \
-  (head)->n_buckets = 0;                                                       \
-  (head)->n_occupied = 0;                                                      \
-  (head)->generation = 0;                                                      \
+  for (unsigned _s = 0; _s < HASH_CLOSED_SHARDS; _s ++) {                      \
+    if ((head)->shards[_s].nodes != NULL)                                      \
+      HASH_FREE_NODES((head), (head)->shards[_s].nodes,                        \
+          (head)->shards[_s].n_buckets);                                       \
+    if ((head)->shards[_s].lock && (head)->ops->lockn_destroy)                 \
+      (head)->ops->lockn_destroy((head)->shards[_s].lock, (head)->ops->locknd); \
+    memset(&(head)->shards[_s], 0, sizeof((head)->shards[_s]));                \
+  }                                                                            \
 } while(0)
 
 /*
- * Find hash value in the nodes using quadratic probing
+ * Find hash value in the nodes of a shard using quadratic probing
  * The size of hash table *MUST* be power of two as c1=c2=1/2
+ * Returns either the node with the same key or the node to insert a new key to
+ * (the first deleted node met or the first free one)
  */
-#define HASH_FIND_BKT(head, type, field, h, bkt) do {                          \
-  unsigned _idx, _step = 0, _mask, _limit;                                     \
-  struct type *_cur;                                                           \
-  _mask = (head)->n_buckets - 1;                                               \
-  _limit = _mask + 1;                                                          \
+#define HASH_FIND_BKT(head, sh, type, field, h, elm, bkt) do {                 \
+  unsigned _idx, _step = 0, _mask;                                             \
+  struct type *_cur, *_tomb = NULL;                                            \
+  _mask = (sh)->n_buckets - 1;                                                 \
   _idx = (h) & _mask;                                                          \
-  _cur = &(head)->nodes[_idx];                                                 \
-  if (!_HASH_NODE_EMPTY(_cur, field)) {                                        \
-    /* We need to find the place for inserting */                              \
-    for(;;) {                                                                  \
-      if (_HASH_NODE_EMPTY(_cur, field)) {                                     \
+  for(;;) {                                                                    \
+    _cur = &(sh)->nodes[_idx];                                                 \
+    if (_HASH_NODE_FREE(_cur, field)) {                                        \
+      if (_tomb != NULL) _cur = _tomb;                                         \
+      break;                                                                   \
+    }                                                                          \
+    else if (_HASH_NODE_EMPTY(_cur, field)) {                                  \
+      if (_tomb == NULL) _tomb = _cur;                                         \
+    }                                                                          \
+    else if (_cur->field.hv == (h)) {                                          \
+      /* Need to compare */                                                    \
+      if ((head)->ops->hash_cmp((elm), _cur, (head)->ops->hashd) == 0) {       \
         break;                                                                 \
       }                                                                        \
-      else if (_cur->field.hv == (h)) {                                        \
-        /* Need to compare */                                                  \
-        if ((head)->ops->hash_cmp((bkt), _cur, (head)->ops->hashd) == 0) {     \
-          break;                                                               \
-        }                                                                      \
-      }                                                                        \
-      ++_step;                                                                 \
-      _idx = ((h) + (_step*_step + _step) / 2) & _mask;                        \
-      /*_idx = ((_idx) + _step) & _mask; */                                    \
-      _cur = &(head)->nodes[_idx];                                             \
     }                                                                          \
+    ++_step;                                                                   \
+    _idx = ((h) + (_step*_step + _step) / 2) & _mask;                          \
   }                                                                            \
+  _HASH_PROBE_SAMPLE(sh, _step + 1);                                           \
   (bkt) = _cur;                                                                \
 } while(0)
 
+/* Keys are unique on rehashing, so we just look for a free node */
+#define _HASH_FIND_FREE_BKT(sh, field, h, bkt) do {                            \
+  unsigned _idx, _step = 0, _mask;                                             \
+  _mask = (sh)->n_buckets - 1;                                                 \
+  _idx = (h) & _mask;                                                          \
+  while (!_HASH_NODE_FREE(&(sh)->nodes[_idx], field)) {                        \
+    ++_step;                                                                   \
+    _idx = ((h) + (_step*_step + _step) / 2) & _mask;                          \
+  }                                                                            \
+  (bkt) = &(sh)->nodes[_idx];                                                  \
+} while(0)
+
 #define HASH_ALLOC_NODES(head, nodes, size) do {                               \
   if ((head)->ops->alloc) (nodes) = (head)->ops->alloc(sizeof(*(nodes)) * (size), \
       (head)->ops->allocd);                                                    \
@@ -156,42 +341,111 @@ struct name {                                                                  \
   else free(nodes);                                                            \
 } while(0)
 
-#define HASH_EXPAND_BUCKETS(head, type, field)                                 \
+/*
+ * Must be called with the shard locked for writing. Deleted nodes are dropped,
+ * so the shard is doubled merely if live elements fill it enough.
+ */
+#define HASH_EXPAND_SHARD(head, sh, type, field)                               \
 do {                                                                           \
-  unsigned _saved_generation = (head)->generation;                             \
-  if ((head)->generation == _saved_generation) {                               \
-    struct type *old_nodes = (head)->nodes;                                    \
-    unsigned _old_num = (head)->n_buckets;                                     \
-    unsigned _new_num = (head)->n_buckets + 1;                                 \
-    HASH_ROUNDUP32(_new_num);                                                  \
-    HASH_ALLOC_NODES((head), (head)->nodes, _new_num);                         \
-    if ((head)->nodes != NULL) {                                               \
-    (head)->n_buckets = _new_num;                                              \
+  struct type *old_nodes = (sh)->nodes;                                        \
+  unsigned _old_num = (sh)->n_buckets;                                         \
+  unsigned _live = (sh)->n_occupied - (sh)->n_deleted;                         \
+  unsigned _new_num = _live * 2 >= (sh)->upper_bound ? _old_num * 2 : _old_num; \
+  uint64_t _t0 = HASH_CLOCK_NS();                                              \
+  HASH_ALLOC_NODES((head), (sh)->nodes, _new_num);                             \
+  if ((sh)->nodes != NULL) {                                                   \
+    (sh)->n_buckets = _new_num;                                                \
     for (unsigned _i = 0; _i < _old_num; _i ++) {                              \
-      struct type *_h, *_onode;                                                \
+      struct type *_hslot, *_onode;                                            \
       _onode = &old_nodes[_i];                                                 \
       if(_HASH_NODE_EMPTY(_onode, field)) continue;                            \
-      HASH_FIND_BKT(head, type, field, _onode->field.hv, _h);                  \
-      memcpy(_h, _onode, sizeof(*_h));                                         \
+      _HASH_FIND_FREE_BKT(sh, field, _onode->field.hv, _hslot);                \
+      memcpy(_hslot, _onode, sizeof(*_hslot));                                 \
     }                                                                          \
     HASH_FREE_NODES(head, old_nodes, _old_num);                                \
-    (head)->generation ++;                                                     \
-    HASH_UPPER_BOUND(head);                                                    \
-    }                                                                          \
-    else (head)->nodes = old_nodes;                                            \
+    (sh)->n_occupied = _live;                                                  \
+    (sh)->n_deleted = 0;                                                       \
+    (sh)->generation ++;                                                       \
+    _t0 = HASH_CLOCK_NS() - _t0;                                               \
+    (sh)->expand_ns += _t0;                                                    \
+    if ((head)->ops->on_expand) (head)->ops->on_expand(_old_num, _new_num,     \
+        _live, _t0, (head)->ops->expandd);                                     \
+    HASH_UPPER_BOUND(sh);                                                      \
+  }                                                                            \
+  else (sh)->nodes = old_nodes;                                                \
+  (sh)->need_expand = 0;                                                       \
+} while(0)
+
+#define HASH_EXPAND_BUCKETS(head, type, field)                                 \
+do {                                                                           \
+  for (unsigned _s = 0; _s < HASH_CLOSED_SHARDS; _s ++) {                      \
+    HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                           \
+    HASH_EXPAND_SHARD(head, &(head)->shards[_s], type, field);                 \
+    HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
   }                                                                            \
-  (head)->need_expand = 0;                                                     \
 } while(0)
 
+/*
+ * All shards are allocated at once, so the first insertion must not race with
+ * other operations. Call this macro explicitly before sharing a table between
+ * threads.
+ */
 #define HASH_MAKE_TABLE(head) do {                                             \
-  (head)->n_buckets = HASH_INITIAL_NUM_BUCKETS;                                \
-  (head)->n_occupied = 0;                                                      \
-  (head)->generation = 0;                                                      \
-  HASH_UPPER_BOUND(head);                                                      \
-  HASH_ALLOC_NODES((head), (head)->nodes, (head)->n_buckets);                  \
+  for (unsigned _s = 0; _s < HASH_CLOSED_SHARDS; _s ++) {                      \
+    (head)->shards[_s].n_buckets = HASH_INITIAL_NUM_BUCKETS;                   \
+    (head)->shards[_s].n_occupied = 0;                                         \
+    (head)->shards[_s].n_deleted = 0;                                          \
+    (head)->shards[_s].generation = 0;                                         \
+    (head)->shards[_s].expand_ns = 0;                                          \
+    HASH_UPPER_BOUND(&(head)->shards[_s]);                                     \
+    HASH_ALLOC_NODES((head), (head)->shards[_s].nodes,                         \
+        (head)->shards[_s].n_buckets);                                         \
+    if ((head)->ops->lockn_init)                                               \
+      (head)->shards[_s].lock = (head)->ops->lockn_init((head)->ops->locknd);  \
+  }                                                                            \
+} while(0)
+
+/*
+ * Fill hash_stats_t `st` locking one shard at a time. Probe length of each
+ * element is found by replaying its probe sequence, chains are not applicable,
+ * so `chain_hist` is left empty and `max_chain` is the longest probe sequence.
+ * Each shard expansion (including rehashing that merely drops deleted nodes)
+ * is counted as a resize.
+ */
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  if ((head)->shards[0].nodes != NULL) {                                       \
+    for (unsigned _s = 0; _s < HASH_CLOSED_SHARDS; _s ++) {                    \
+      HASH_LOCK_NODE_READ(head, &(head)->shards[_s]);                          \
+      unsigned _mask = (head)->shards[_s].n_buckets - 1;                       \
+      for (unsigned _i = 0; _i <= _mask; _i ++) {                              \
+        struct type *_cur = &(head)->shards[_s].nodes[_i];                     \
+        unsigned _idx, _step = 0;                                              \
+        if (_HASH_NODE_EMPTY(_cur, field)) {                                   \
+          if (_HASH_NODE_FREE(_cur, field)) (st)->empty_buckets ++;            \
+          else (st)->deleted_buckets ++;                                       \
+          continue;                                                            \
+        }                                                                      \
+        _idx = _cur->field.hv & _mask;                                         \
+        while (_idx != _i) {                                                   \
+          ++_step;                                                             \
+          _idx = (_cur->field.hv + (_step*_step + _step) / 2) & _mask;         \
+        }                                                                      \
+        _HASH_STATS_HIST_ADD((st)->probe_hist, _step + 1);                     \
+        if (_step + 1 > (st)->max_chain) (st)->max_chain = _step + 1;          \
+        (st)->num_items ++;                                                    \
+      }                                                                        \
+      (st)->num_buckets += (head)->shards[_s].n_buckets;                       \
+      (st)->expands += (head)->shards[_s].generation;                          \
+      (st)->expand_ns += (head)->shards[_s].expand_ns;                         \
+      _HASH_PROBE_COLLECT(&(head)->shards[_s], st);                            \
+      HASH_UNLOCK_NODE_READ(head, &(head)->shards[_s]);                        \
+    }                                                                          \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+  }                                                                            \
 } while(0)
 
-#define HASH_UPPER_BOUND(head)                                                 \
-  ((head)->upper_bound = ((head)->n_buckets * _HASH_UPPER_BOUND + 0.5))
+#define HASH_UPPER_BOUND(sh)                                                   \
+  ((sh)->upper_bound = ((sh)->n_buckets * _HASH_UPPER_BOUND + 0.5))
 
 #endif /* HASH_CLOSED_H_ */
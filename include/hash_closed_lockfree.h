@@ -0,0 +1,524 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_CLOSED_LOCKFREE_H_
+#define HASH_CLOSED_LOCKFREE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Lock-free mode of the closed addressing table, it is used instead of
+ * hash_closed.h. Nodes are claimed by CAS on a word composed of a hash value
+ * and flags and an element is published with release semantics, so lookups
+ * are wait-free and never block on writers. When a table is filled, a new one
+ * is allocated and all threads that see it help to move nodes.
+ *
+ * Caveats:
+ * - an element is immutable once inserted: inserting an existing key leaves
+ *   the stored element untouched;
+ * - deleted nodes are not reused until the next resize;
+ * - old tables are freed merely by HASH_DESTROY, so found elements stay
+ *   readable until then (but they may be superseded by copies in newer tables);
+ * - HASH_TYPE must be 32 bits wide;
+ * - per-type functions must be generated by HASH_LOCKFREE_GENERATE(type, field)
+ *   after HASH_GENERATE_*.
+ */
+#define _HASH_USE_CLOSED_LOCKFREE 1
+#define _HASH_UPPER_BOUND 0.6
+
+/* Number of nodes migrated by a thread at once */
+#ifndef HASH_LF_MIGRATE_CHUNK
+#define HASH_LF_MIGRATE_CHUNK 1024
+#endif
+/* Number of chunks migrated by each operation that meets a resize */
+#ifndef HASH_LF_HELP_CHUNKS
+#define HASH_LF_HELP_CHUNKS 2
+#endif
+
+#define _HASH_LF_FILLED 0x1
+#define _HASH_LF_DELETED 0x2
+/* Node is claimed but an element is not published yet */
+#define _HASH_LF_BUSY 0x4
+/* Node is frozen for migration (if filled) or migrated */
+#define _HASH_LF_MOVED 0x8
+/* Node has been free when migrated, so it terminates probe sequences */
+#define _HASH_LF_WAS_FREE 0x10
+
+#define _HASH_LF_INSERTED 0
+#define _HASH_LF_EXISTS 1
+#define _HASH_LF_REDIRECT 2
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _HASH_LF_RELAX() __builtin_ia32_pause()
+#else
+#define _HASH_LF_RELAX() do {} while(0)
+#endif
+
+#define HASH_ENTRY(type)                                                       \
+union {                                                                        \
+  struct {                                                                     \
+    HASH_TYPE hv;                                                              \
+    uint32_t flags;                                                            \
+  };                                                                           \
+  uint64_t word;                                                               \
+}
+
+typedef union _hash_lf_word_u {
+  struct {
+    uint32_t hv;
+    uint32_t flags;
+  } s;
+  uint64_t w;
+} _hash_lf_word_t;
+
+#define _HASH_LF_WORD(h, f) (((_hash_lf_word_t){ .s = { (h), (f) } }).w)
+#define _HASH_LF_LOAD(node, field)                                             \
+  __atomic_load_n(&(node)->field.word, __ATOMIC_ACQUIRE)
+#define _HASH_LF_CAS(node, field, expected, desired)                           \
+  __atomic_compare_exchange_n(&(node)->field.word, (expected), (desired), 0,   \
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+typedef struct _hash_lf_table_s {
+  void *nodes;
+  unsigned n_buckets, upper_bound, n_chunks;
+  unsigned n_occupied, n_deleted;
+  unsigned migrate_pos, migrated;
+  struct _hash_lf_table_s *next, *prev;
+} _hash_lf_table_t;
+
+#define HASH_HEAD(name, type, field)                                           \
+struct name {                                                                  \
+   struct _hash_ops_##type##_##field *ops;                                     \
+   _hash_lf_table_t *table;                                                    \
+}
+
+#define HASH_INSERT(head, type, field, elm)                                    \
+  HASH_INSERT_HV(head, type, field, elm,                                       \
+      (head)->ops->hash_func((elm), (head)->ops->hashd))
+
+/* _HV variants accept a hash value computed by HASH_HASH or HASH_HASH_ELT */
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  (elm)->field.hv = (h);                                                       \
+  (void)_hash_lf_##type##_##field##_insert((head)->ops, &(head)->table,        \
+      (elm), NULL);                                                            \
+} while(0)
+
+/*
+ * `found` is set to the stored element with the same key or to NULL if `elm`
+ * has been inserted. If `elm` could not be stored as a table allocation has
+ * failed, `found` is set to `elm` itself. There is no HASH_UPSERT as stored
+ * elements are immutable
+ */
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found)                     \
+  HASH_FIND_OR_INSERT_HV(head, type, field, elm,                               \
+      (head)->ops->hash_func((elm), (head)->ops->hashd), found)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found) do {          \
+  int _ins = 0;                                                                \
+  struct type *_st;                                                            \
+  (elm)->field.hv = (h);                                                       \
+  _st = _hash_lf_##type##_##field##_insert((head)->ops, &(head)->table,        \
+      (elm), &_ins);                                                           \
+  if (_st == NULL) (found) = (elm);                                            \
+  else (found) = _ins ? NULL : _st;                                            \
+} while(0)
+
+/* Wait-free: nodes that are being inserted are skipped */
+#define HASH_FIND_ELT(head, type, field, elm, found)                           \
+  HASH_FIND_ELT_HV(head, type, field, elm,                                     \
+      (head)->ops->hash_func((elm), (head)->ops->hashd), found)
+
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  _hash_lf_table_t *_t = __atomic_load_n(&(head)->table, __ATOMIC_ACQUIRE);    \
+  struct type *_fnd = NULL;                                                    \
+  if (_t != NULL) {                                                            \
+    HASH_TYPE _hv = (h);                                                       \
+    while (_t != NULL && _fnd == NULL) {                                       \
+      struct type *_cur, *_nodes = (struct type *)_t->nodes;                   \
+      unsigned _mask = _t->n_buckets - 1, _idx = _hv & _mask, _step = 0;       \
+      _hash_lf_word_t _w;                                                      \
+      for (;;) {                                                               \
+        _cur = &_nodes[_idx];                                                  \
+        _w.w = _HASH_LF_LOAD(_cur, field);                                     \
+        if (_w.s.flags == 0 || (_w.s.flags & _HASH_LF_WAS_FREE)) break;        \
+        if ((_w.s.flags & _HASH_LF_FILLED) && _w.s.hv == _hv &&                \
+            (head)->ops->hash_cmp((elm), _cur, (head)->ops->hashd) == 0) {     \
+          _fnd = _cur;                                                         \
+          break;                                                               \
+        }                                                                      \
+        if (++_step > _mask) break;                                            \
+        _idx = (_hv + (_step*_step + _step) / 2) & _mask;                      \
+      }                                                                        \
+      _t = __atomic_load_n(&_t->next, __ATOMIC_ACQUIRE);                       \
+    }                                                                          \
+  }                                                                            \
+  (found) = _fnd;                                                              \
+} while(0)
+
+#define HASH_DELETE_ELT(head, type, field, elm)                                \
+  HASH_DELETE_ELT_HV(head, type, field, elm,                                   \
+      (head)->ops->hash_func((elm), (head)->ops->hashd))
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if (__atomic_load_n(&(head)->table, __ATOMIC_ACQUIRE) != NULL) {             \
+    (elm)->field.hv = (h);                                                     \
+    (void)_hash_lf_##type##_##field##_delete((head)->ops, &(head)->table,      \
+        (elm));                                                                \
+  }                                                                            \
+} while(0)
+
+/* Cleanup and destroy must not run concurrently with other operations */
+#define HASH_CLEANUP_NODES(head, type, field, free_func) do {                  \
+  if ((head)->table != NULL) {                                                 \
+    _hash_lf_table_t *_t;                                                      \
+    _t = _hash_lf_##type##_##field##_finish((head)->ops, &(head)->table);      \
+    for (unsigned _i = 0; _i < _t->n_buckets; _i ++) {                         \
+      struct type *_bkt = &((struct type *)_t->nodes)[_i];                     \
+      if ((_bkt->field.flags & _HASH_LF_FILLED) && (free_func) != NULL)        \
+        _hash_op_##type##_##field##_delete_node((free_func), _bkt);            \
+      _bkt->field.word = 0;                                                    \
+    }                                                                          \
+    _t->n_occupied = 0;                                                        \
+    _t->n_deleted = 0;                                                         \
+  }                                                                            \
+} while(0)
+
+#define HASH_DESTROY(head, type, field, free_func) do {                        \
+  HASH_CLEANUP_NODES(head, type, field, free_func);                            \
+  if ((head)->table != NULL) {                                                 \
+    _hash_lf_table_t *_t = (head)->table, *_tmp;                               \
+    while (_t != NULL) {                                                       \
+      _tmp = _t->prev;                                                         \
+      _hash_lf_##type##_##field##_free_table((head)->ops, _t);                 \
+      _t = _tmp;                                                               \
+    }                                                                          \
+    (head)->table = NULL;                                                      \
+  }                                                                            \
+} while(0)
+
+#define HASH_UPPER_BOUND(t)                                                    \
+  ((t)->upper_bound = ((t)->n_buckets * _HASH_UPPER_BOUND + 0.5))
+
+/*
+ * Generate lock-free helpers for the specified hash type
+ */
+#define HASH_LOCKFREE_GENERATE(type, field)                                    \
+  typedef char _hash_lf_hv_check_##type##_##field[                             \
+      sizeof(HASH_TYPE) == sizeof(uint32_t) ? 1 : -1];                         \
+  static _hash_lf_table_t* _HU_FUNCTION(_hash_lf_##type##_##field##_alloc_table)( \
+      struct _hash_ops_##type##_##field *ops, unsigned n_buckets) {            \
+    _hash_lf_table_t *t;                                                       \
+    size_t len = sizeof(struct type) * n_buckets;                              \
+    if (ops->alloc) t = ops->alloc(sizeof(*t), ops->allocd);                   \
+    else t = malloc(sizeof(*t));                                               \
+    if (t == NULL) return NULL;                                                \
+    memset(t, 0, sizeof(*t));                                                  \
+    if (ops->alloc) t->nodes = ops->alloc(len, ops->allocd);                   \
+    else t->nodes = malloc(len);                                               \
+    if (t->nodes == NULL) {                                                    \
+      if (ops->free) ops->free(sizeof(*t), t, ops->allocd);                    \
+      else free(t);                                                            \
+      return NULL;                                                             \
+    }                                                                          \
+    memset(t->nodes, 0, len);                                                  \
+    t->n_buckets = n_buckets;                                                  \
+    t->n_chunks = (n_buckets + HASH_LF_MIGRATE_CHUNK - 1) / HASH_LF_MIGRATE_CHUNK; \
+    HASH_UPPER_BOUND(t);                                                       \
+    return t;                                                                  \
+  }                                                                            \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_free_table)(            \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t) {           \
+    if (ops->free) {                                                           \
+      ops->free(sizeof(struct type) * t->n_buckets, t->nodes, ops->allocd);    \
+      ops->free(sizeof(*t), t, ops->allocd);                                   \
+    }                                                                          \
+    else {                                                                     \
+      free(t->nodes);                                                          \
+      free(t);                                                                 \
+    }                                                                          \
+  }                                                                            \
+  static _hash_lf_table_t* _HU_FUNCTION(_hash_lf_##type##_##field##_first)(    \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t **pt) {         \
+    _hash_lf_table_t *t, *expected = NULL;                                     \
+    t = _hash_lf_##type##_##field##_alloc_table(ops, HASH_INITIAL_NUM_BUCKETS); \
+    if (t == NULL) return NULL;                                                \
+    if (!__atomic_compare_exchange_n(pt, &expected, t, 0, __ATOMIC_ACQ_REL,    \
+        __ATOMIC_ACQUIRE)) {                                                   \
+      _hash_lf_##type##_##field##_free_table(ops, t);                          \
+      return expected;                                                         \
+    }                                                                          \
+    return t;                                                                  \
+  }                                                                            \
+  /* Copy everything but the hash entry that is published atomically */        \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_copy)(struct type *dst, \
+      const struct type *src) {                                                \
+    const size_t off = offsetof(struct type, field),                           \
+        end = off + sizeof(dst->field);                                        \
+    memcpy(dst, src, off);                                                     \
+    memcpy((char *)dst + end, (const char *)src + end, sizeof(*dst) - end);    \
+  }                                                                            \
+  /* Allocate the next table unless some other thread has done it already */   \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_grow)(                  \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t) {           \
+    _hash_lf_table_t *nt, *expected = NULL;                                    \
+    unsigned live, n_buckets = t->n_buckets;                                   \
+    if (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) != NULL) return;           \
+    live = __atomic_load_n(&t->n_occupied, __ATOMIC_RELAXED) -                 \
+        __atomic_load_n(&t->n_deleted, __ATOMIC_RELAXED);                      \
+    /* Deleted nodes are dropped, so we might not need to grow */              \
+    if (live * 2 >= t->upper_bound) n_buckets *= 2;                            \
+    nt = _hash_lf_##type##_##field##_alloc_table(ops, n_buckets);              \
+    if (nt == NULL) return;                                                    \
+    nt->prev = t;                                                              \
+    if (!__atomic_compare_exchange_n(&t->next, &expected, nt, 0,               \
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {                                 \
+      _hash_lf_##type##_##field##_free_table(ops, nt);                         \
+    }                                                                          \
+  }                                                                            \
+  /*                                                                           \
+   * Put an element to the specified table if there is no such a key. Migrated \
+   * copies must not resurrect deleted keys, so they treat deleted nodes with  \
+   * the same key as existing ones.                                            \
+   */                                                                          \
+  static int _HU_FUNCTION(_hash_lf_##type##_##field##_put)(                    \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t,             \
+      const struct type *src, HASH_TYPE hv, int migrating, struct type **res) { \
+    struct type *cur, *nodes = (struct type *)t->nodes;                        \
+    unsigned mask = t->n_buckets - 1, idx = hv & mask, step = 0;               \
+    _hash_lf_word_t w;                                                         \
+    for (;;) {                                                                 \
+      cur = &nodes[idx];                                                       \
+      w.w = _HASH_LF_LOAD(cur, field);                                         \
+      if (w.s.flags == 0) {                                                    \
+        if (_HASH_LF_CAS(cur, field, &w.w, _HASH_LF_WORD(hv, _HASH_LF_BUSY))) { \
+          _hash_lf_##type##_##field##_copy(cur, src);                          \
+          __atomic_store_n(&cur->field.word,                                   \
+              _HASH_LF_WORD(hv, _HASH_LF_FILLED), __ATOMIC_RELEASE);           \
+          __atomic_fetch_add(&t->n_occupied, 1, __ATOMIC_RELAXED);             \
+          *res = cur;                                                          \
+          return _HASH_LF_INSERTED;                                            \
+        }                                                                      \
+        /* Node has been changed, so recheck it */                             \
+        continue;                                                              \
+      }                                                                        \
+      if (w.s.flags & _HASH_LF_MOVED) return _HASH_LF_REDIRECT;                \
+      if (w.s.hv == hv) {                                                      \
+        if (w.s.flags & _HASH_LF_BUSY) {                                       \
+          /* Wait for the same hash value to be published */                   \
+          _HASH_LF_RELAX();                                                    \
+          continue;                                                            \
+        }                                                                      \
+        if (((w.s.flags & _HASH_LF_FILLED) || migrating) &&                    \
+            ops->hash_cmp(src, cur, ops->hashd) == 0) {                        \
+          *res = cur;                                                          \
+          return _HASH_LF_EXISTS;                                              \
+        }                                                                      \
+      }                                                                        \
+      if (++step > mask) return _HASH_LF_REDIRECT;                             \
+      idx = (hv + (step*step + step) / 2) & mask;                              \
+    }                                                                          \
+  }                                                                            \
+  static void _hash_lf_##type##_##field##_migrate_path(                        \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t,             \
+      const struct type *elm, HASH_TYPE hv);                                   \
+  /*                                                                           \
+   * Migrate a single node to the next table, returns non-zero if the node     \
+   * has been free (so it terminates probe sequences in the old table)         \
+   */                                                                          \
+  static int _HU_FUNCTION(_hash_lf_##type##_##field##_migrate_node)(           \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t,             \
+      struct type *cur) {                                                      \
+    _hash_lf_word_t w;                                                         \
+    _hash_lf_table_t *nt;                                                      \
+    struct type *res;                                                          \
+    for (;;) {                                                                 \
+      w.w = _HASH_LF_LOAD(cur, field);                                         \
+      if (w.s.flags & _HASH_LF_MOVED) {                                        \
+        if (w.s.flags & _HASH_LF_FILLED) break;                                \
+        return (w.s.flags & _HASH_LF_WAS_FREE) != 0;                           \
+      }                                                                        \
+      if (w.s.flags == 0) {                                                    \
+        if (_HASH_LF_CAS(cur, field, &w.w,                                     \
+            _HASH_LF_WORD(0, _HASH_LF_MOVED|_HASH_LF_WAS_FREE))) return 1;     \
+      }                                                                        \
+      else if (w.s.flags & _HASH_LF_BUSY) {                                    \
+        _HASH_LF_RELAX();                                                      \
+      }                                                                        \
+      else if (w.s.flags & _HASH_LF_DELETED) {                                 \
+        if (_HASH_LF_CAS(cur, field, &w.w,                                     \
+            _HASH_LF_WORD(w.s.hv, _HASH_LF_MOVED))) return 0;                  \
+      }                                                                        \
+      else if (_HASH_LF_CAS(cur, field, &w.w,                                  \
+            _HASH_LF_WORD(w.s.hv, _HASH_LF_FILLED|_HASH_LF_MOVED))) {          \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+    /* Node is frozen, so any thread could copy it (only one copy succeeds) */ \
+    nt = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);                          \
+    while (_hash_lf_##type##_##field##_put(ops, nt, cur, w.s.hv, 1, &res)      \
+        == _HASH_LF_REDIRECT) {                                                \
+      _hash_lf_##type##_##field##_grow(ops, nt);                               \
+      _hash_lf_##type##_##field##_migrate_path(ops, nt, cur, w.s.hv);          \
+      nt = __atomic_load_n(&nt->next, __ATOMIC_ACQUIRE);                       \
+    }                                                                          \
+    w.s.flags = _HASH_LF_FILLED|_HASH_LF_MOVED;                                \
+    _HASH_LF_CAS(cur, field, &w.w, _HASH_LF_WORD(w.s.hv, _HASH_LF_MOVED));     \
+    return 0;                                                                  \
+  }                                                                            \
+  /* Migrate the whole probe sequence of a key from the old table */           \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_migrate_path)(          \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t *t,             \
+      const struct type *_HU(elm), HASH_TYPE hv) {                             \
+    struct type *nodes = (struct type *)t->nodes;                              \
+    unsigned mask = t->n_buckets - 1, idx = hv & mask, step = 0;               \
+    while (!_hash_lf_##type##_##field##_migrate_node(ops, t, &nodes[idx])) {   \
+      if (++step > mask) break;                                                \
+      idx = (hv + (step*step + step) / 2) & mask;                              \
+    }                                                                          \
+  }                                                                            \
+  /* Replace the current table with the next one if it has been migrated */    \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_publish)(               \
+      _hash_lf_table_t **pt) {                                                 \
+    _hash_lf_table_t *t = __atomic_load_n(pt, __ATOMIC_ACQUIRE), *nt;          \
+    while ((nt = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL &&       \
+        __atomic_load_n(&t->migrated, __ATOMIC_ACQUIRE) == t->n_chunks) {      \
+      if (__atomic_compare_exchange_n(pt, &t, nt, 0, __ATOMIC_ACQ_REL,         \
+          __ATOMIC_ACQUIRE)) {                                                 \
+        t = nt;                                                                \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  /* Migrate up to `max_chunks` chunks of the table */                         \
+  static void _HU_FUNCTION(_hash_lf_##type##_##field##_help)(                  \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t **pt,           \
+      _hash_lf_table_t *t, unsigned max_chunks) {                              \
+    struct type *nodes = (struct type *)t->nodes;                              \
+    unsigned chunk, i, last;                                                   \
+    while (max_chunks-- > 0 &&                                                 \
+        __atomic_load_n(&t->migrate_pos, __ATOMIC_RELAXED) < t->n_chunks &&    \
+        (chunk = __atomic_fetch_add(&t->migrate_pos, 1, __ATOMIC_RELAXED)) <   \
+        t->n_chunks) {                                                         \
+      i = chunk * HASH_LF_MIGRATE_CHUNK;                                       \
+      last = i + HASH_LF_MIGRATE_CHUNK;                                        \
+      if (last > t->n_buckets) last = t->n_buckets;                            \
+      for (; i < last; i ++) {                                                 \
+        _hash_lf_##type##_##field##_migrate_node(ops, t, &nodes[i]);           \
+      }                                                                        \
+      if (__atomic_add_fetch(&t->migrated, 1, __ATOMIC_ACQ_REL) == t->n_chunks) \
+        _hash_lf_##type##_##field##_publish(pt);                               \
+    }                                                                          \
+  }                                                                            \
+  /* Complete all pending migrations and return the current table */           \
+  static _hash_lf_table_t* _HU_FUNCTION(_hash_lf_##type##_##field##_finish)(   \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t **pt) {         \
+    _hash_lf_table_t *t = __atomic_load_n(pt, __ATOMIC_ACQUIRE);               \
+    while (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) != NULL) {              \
+      _hash_lf_##type##_##field##_help(ops, pt, t, t->n_chunks);               \
+      while (__atomic_load_n(&t->migrated, __ATOMIC_ACQUIRE) != t->n_chunks)   \
+        _HASH_LF_RELAX();                                                      \
+      _hash_lf_##type##_##field##_publish(pt);                                 \
+      t = __atomic_load_n(pt, __ATOMIC_ACQUIRE);                               \
+    }                                                                          \
+    return t;                                                                  \
+  }                                                                            \
+  /*                                                                           \
+   * Insert an element unless its key exists, returns the stored element and   \
+   * sets `inserted` to non-zero if it has been inserted by this call          \
+   */                                                                          \
+  static struct type* _HU_FUNCTION(_hash_lf_##type##_##field##_insert)(        \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t **pt,           \
+      const struct type *elm, int *inserted) {                                 \
+    _hash_lf_table_t *t, *nt;                                                  \
+    struct type *res = NULL;                                                   \
+    HASH_TYPE hv = elm->field.hv;                                              \
+    int st;                                                                    \
+    if ((t = __atomic_load_n(pt, __ATOMIC_ACQUIRE)) == NULL &&                 \
+        (t = _hash_lf_##type##_##field##_first(ops, pt)) == NULL) return NULL; \
+    for (;;) {                                                                 \
+      if ((nt = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL) {        \
+        _hash_lf_##type##_##field##_help(ops, pt, t, HASH_LF_HELP_CHUNKS);     \
+        _hash_lf_##type##_##field##_migrate_path(ops, t, elm, hv);             \
+        t = nt;                                                                \
+        continue;                                                              \
+      }                                                                        \
+      st = _hash_lf_##type##_##field##_put(ops, t, elm, hv, 0, &res);          \
+      if (st == _HASH_LF_INSERTED) {                                           \
+        if (__atomic_load_n(&t->n_occupied, __ATOMIC_RELAXED) >= t->upper_bound) \
+          _hash_lf_##type##_##field##_grow(ops, t);                            \
+        break;                                                                 \
+      }                                                                        \
+      else if (st == _HASH_LF_EXISTS) {                                        \
+        break;                                                                 \
+      }                                                                        \
+      /* Table is full or being migrated */                                    \
+      _hash_lf_##type##_##field##_grow(ops, t);                                \
+      if (__atomic_load_n(&t->next, __ATOMIC_ACQUIRE) == NULL) return NULL;    \
+    }                                                                          \
+    if (inserted) *inserted = (st == _HASH_LF_INSERTED);                       \
+    return res;                                                                \
+  }                                                                            \
+  static struct type* _HU_FUNCTION(_hash_lf_##type##_##field##_delete)(        \
+      struct _hash_ops_##type##_##field *ops, _hash_lf_table_t **pt,           \
+      const struct type *elm) {                                                \
+    _hash_lf_table_t *t = __atomic_load_n(pt, __ATOMIC_ACQUIRE), *nt;          \
+    HASH_TYPE hv = elm->field.hv;                                              \
+    struct type *cur, *nodes;                                                  \
+    unsigned mask, idx, step;                                                  \
+    _hash_lf_word_t w;                                                         \
+  restart:                                                                     \
+    if ((nt = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL) {          \
+      _hash_lf_##type##_##field##_help(ops, pt, t, HASH_LF_HELP_CHUNKS);       \
+      _hash_lf_##type##_##field##_migrate_path(ops, t, elm, hv);               \
+      t = nt;                                                                  \
+      goto restart;                                                            \
+    }                                                                          \
+    nodes = (struct type *)t->nodes;                                           \
+    mask = t->n_buckets - 1;                                                   \
+    idx = hv & mask;                                                           \
+    step = 0;                                                                  \
+    for (;;) {                                                                 \
+      cur = &nodes[idx];                                                       \
+      w.w = _HASH_LF_LOAD(cur, field);                                         \
+      if (w.s.flags == 0) return NULL;                                         \
+      if (w.s.flags & _HASH_LF_MOVED) goto restart;                            \
+      if (w.s.hv == hv) {                                                      \
+        if (w.s.flags & _HASH_LF_BUSY) {                                       \
+          _HASH_LF_RELAX();                                                    \
+          continue;                                                            \
+        }                                                                      \
+        if ((w.s.flags & _HASH_LF_FILLED) &&                                   \
+            ops->hash_cmp(elm, cur, ops->hashd) == 0) {                        \
+          if (_HASH_LF_CAS(cur, field, &w.w,                                   \
+              _HASH_LF_WORD(hv, _HASH_LF_DELETED))) {                          \
+            __atomic_fetch_add(&t->n_deleted, 1, __ATOMIC_RELAXED);            \
+            return cur;                                                        \
+          }                                                                    \
+          continue;                                                            \
+        }                                                                      \
+      }                                                                        \
+      if (++step > mask) return NULL;                                          \
+      idx = (hv + (step*step + step) / 2) & mask;                              \
+    }                                                                          \
+  }
+
+#endif /* HASH_CLOSED_LOCKFREE_H_ */
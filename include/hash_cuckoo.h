@@ -0,0 +1,621 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_CUCKOO_H_
+#define HASH_CUCKOO_H_
+
+#include <stdint.h>
+
+#define _HASH_USE_CUCKOO 1
+
+/*
+ * Bucketized cuckoo table. Each element has two candidate buckets of
+ * HASH_CUCKOO_SLOTS slots, so a lookup compares at most 2 * HASH_CUCKOO_SLOTS
+ * stored hash values in two (prefetched) buckets, plus a small stash that is
+ * scanned merely when it is not empty. The first bucket is selected by the low
+ * bits of a hash value and the second one by xoring them with a mix of the
+ * whole hash value with HASH_CUCKOO_SEED, so both buckets of a stored element
+ * are known without rehashing its key.
+ *
+ * An insertion to full buckets looks for the shortest path of displacements
+ * to a free slot by BFS (up to HASH_CUCKOO_BFS_MAX buckets), then falls back
+ * to the stash and finally to doubling the table. Elements sharing a hash
+ * value cannot be separated by doubling, so an element is refused when its
+ * buckets and the stash are full of such elements, or when it still has no
+ * slot after HASH_CUCKOO_MAX_GROW doublings. HASH_FIND_OR_INSERT then sets
+ * `found` to the element itself, as when memory is exhausted. Elements
+ * are stored inside of a table like in hash_closed.h, so sharding, locking
+ * (`lockn_*` ops) and the validity of found elements follow the same rules.
+ */
+#define HASH_CUCKOO_SLOTS 4
+#ifndef HASH_CUCKOO_STASH
+#define HASH_CUCKOO_STASH 8
+#endif
+#ifndef HASH_CUCKOO_BFS_MAX
+#define HASH_CUCKOO_BFS_MAX 256
+#endif
+#ifndef HASH_CUCKOO_MAX_GROW
+#define HASH_CUCKOO_MAX_GROW 3
+#endif
+#ifndef HASH_CUCKOO_MAX_LOAD
+#define HASH_CUCKOO_MAX_LOAD 0.95
+#endif
+#ifndef HASH_CUCKOO_SEED
+#define HASH_CUCKOO_SEED 0x9e3779b97f4a7c15ULL
+#endif
+
+#ifndef HASH_CUCKOO_SHARDS_LOG2
+#define HASH_CUCKOO_SHARDS_LOG2 0
+#endif
+#define HASH_CUCKOO_SHARDS (1U << HASH_CUCKOO_SHARDS_LOG2)
+
+#if HASH_CUCKOO_SHARDS_LOG2 > 0
+#define _HASH_CUCKOO_SHARD_IDX(h)                                              \
+  ((unsigned)((h) >> (sizeof(HASH_TYPE) * 8 - HASH_CUCKOO_SHARDS_LOG2)))
+# ifdef __GNUC__
+#   define _HASH_CUCKOO_SHARD_ALIGN __attribute__((aligned(64)))
+# endif
+#else
+#define _HASH_CUCKOO_SHARD_IDX(h) 0U
+#endif
+
+#ifndef _HASH_CUCKOO_SHARD_ALIGN
+#define _HASH_CUCKOO_SHARD_ALIGN
+#endif
+
+#define HASH_ENTRY(type)                                                       \
+struct {                                                                       \
+  HASH_TYPE hv;                                                                \
+  uint32_t flags;                                                              \
+}
+
+/*
+ * `nodes` holds `n_buckets * HASH_CUCKOO_SLOTS` slots followed by
+ * HASH_CUCKOO_STASH slots of the stash
+ */
+#define HASH_HEAD(name, type, field)                                           \
+struct name {                                                                  \
+   struct _hash_ops_##type##_##field *ops;                                     \
+   struct {                                                                    \
+     struct type *nodes;                                                       \
+     unsigned n_buckets, n_items, n_stashed, upper_bound;                      \
+     unsigned need_expand;                                                     \
+     unsigned generation;                                                      \
+     uint64_t expand_ns;                                                       \
+     _HASH_PROBE_FIELDS                                                        \
+     void *lock;                                                               \
+   } _HASH_CUCKOO_SHARD_ALIGN shards[HASH_CUCKOO_SHARDS];                      \
+}
+
+/* A step of BFS: bucket reached by moving element `slot` of bucket `parent` */
+struct _hash_cuckoo_step {
+  unsigned bkt;
+  int parent;
+  unsigned slot;
+};
+
+/* Second hash function, the stored hash value is mixed with another seed */
+static inline unsigned
+_hash_cuckoo_alt(uint64_t h)
+{
+  h ^= HASH_CUCKOO_SEED;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (unsigned)h;
+}
+
+#define _HASH_NODE_FILLED 0x1
+#define _HASH_NODE_EMPTY(node, field) ((node)->field.flags == 0)
+#define _HASH_NODE_FILL(node, field) ((node)->field.flags = _HASH_NODE_FILLED)
+#define _HASH_NODE_ERASE(node, field) ((node)->field.flags = 0)
+
+/*
+ * Whether a table has been made. Checked without locks, so shard arrays are
+ * published atomically and never reset to NULL whilst a table is in use
+ */
+#define _HASH_CUCKOO_MADE(head)                                                \
+  (__atomic_load_n(&(head)->shards[0].nodes, __ATOMIC_RELAXED) != NULL)
+#define HASH_SHARD(head, hv) (&(head)->shards[_HASH_CUCKOO_SHARD_IDX(hv)])
+#define _HASH_CUCKOO_B1(sh, h) ((unsigned)(h) & ((sh)->n_buckets - 1))
+#define _HASH_CUCKOO_B2(sh, h)                                                 \
+  (((unsigned)(h) ^ _hash_cuckoo_alt(h)) & ((sh)->n_buckets - 1))
+#define _HASH_CUCKOO_BUCKET(sh, b)                                             \
+  (&(sh)->nodes[(size_t)(b) * HASH_CUCKOO_SLOTS])
+#define _HASH_CUCKOO_STASH(sh)                                                 \
+  (&(sh)->nodes[(size_t)(sh)->n_buckets * HASH_CUCKOO_SLOTS])
+#define _HASH_CUCKOO_NSLOTS(n) ((size_t)(n) * HASH_CUCKOO_SLOTS + HASH_CUCKOO_STASH)
+
+#define HASH_INSERT(head, type, field, elm) do {                               \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  HASH_INSERT_HV(head, type, field, elm, _hv);                                 \
+} while(0)
+
+/*
+ * An existing element with the same key is replaced. An element that could
+ * not be placed is dropped, HASH_FIND_OR_INSERT reports that
+ */
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  HASH_TYPE _ihv = (h);                                                        \
+  struct type *_islot;                                                         \
+  if (!_HASH_CUCKOO_MADE(head)) HASH_MAKE_TABLE(head);                         \
+  (elm)->field.hv = _ihv;                                                      \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                          \
+  HASH_FIND_BKT(head, HASH_SHARD(head, _ihv), type, field, _ihv, elm, _islot); \
+  if (_islot != NULL) {                                                        \
+    memcpy(_islot, (elm), sizeof(*_islot));                                    \
+    _HASH_NODE_FILL(_islot, field);                                            \
+  }                                                                            \
+  else _hash_op_##type##_##field##_cuckoo_add((head), HASH_SHARD(head, _ihv),  \
+      (elm));                                                                  \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                        \
+} while(0)
+
+/*
+ * Insert `elm` unless an element with the same key exists, `found` is set to
+ * the existing element (valid as HASH_FIND_ELT result) or to NULL if `elm` has
+ * been inserted. If `elm` could not be placed, `found` is set to `elm` itself
+ */
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _fohv;                                                             \
+  _fohv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+  _HASH_FIND_OR_INSERT_CUCKOO(head, type, field, elm, _fohv, found, (void)0);  \
+} while(0)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_FIND_OR_INSERT_CUCKOO(head, type, field, elm, h, found, (void)0)
+
+/* Existing element is merged in place whilst its shard is locked */
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _uhv;                                                              \
+  _uhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                    \
+  HASH_UPSERT_HV(head, type, field, elm, _uhv, merge_cb);                      \
+} while(0)
+
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_FIND_OR_INSERT_CUCKOO(head, type, field, elm, h, _uelt,                \
+      (merge_cb)(_hslot, (elm)));                                              \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define _HASH_FIND_OR_INSERT_CUCKOO(head, type, field, elm, h, found, on_found) do { \
+  HASH_TYPE _hv = (h);                                                         \
+  struct type *_hslot;                                                         \
+  if (!_HASH_CUCKOO_MADE(head)) HASH_MAKE_TABLE(head);                         \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                           \
+  HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot);   \
+  if (_hslot != NULL) {                                                        \
+    on_found;                                                                  \
+    (found) = _hslot;                                                          \
+  }                                                                            \
+  else {                                                                       \
+    (elm)->field.hv = _hv;                                                     \
+    if (_hash_op_##type##_##field##_cuckoo_add((head), HASH_SHARD(head, _hv),  \
+        (elm))) (found) = NULL;                                                \
+    else (found) = (elm);                                                      \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+} while(0)
+
+/*
+ * Found element points to the storage of a shard, so it is valid merely until
+ * the next insertion to the same shard (that could move it to its other
+ * bucket). Concurrent readers should use HASH_FIND_ELT_COPY instead.
+ */
+#define HASH_FIND_ELT(head, type, field, elm, found) do {                      \
+  if (!_HASH_CUCKOO_MADE(head)) (found) = NULL;                                \
+  else {                                                                       \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_HV(head, type, field, elm, _fhv, found);                     \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if (!_HASH_CUCKOO_MADE(head)) (found) = NULL;                                \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, found);  \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/*
+ * Copy the found element to `dst` whilst the shard is still locked, `found` is
+ * set to `dst` or to NULL if nothing has been found
+ */
+#define HASH_FIND_ELT_COPY(head, type, field, elm, dst, found) do {            \
+  if (!_HASH_CUCKOO_MADE(head)) (found) = NULL;                                \
+  else {                                                                       \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_COPY_HV(head, type, field, elm, _fhv, dst, found);           \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_COPY_HV(head, type, field, elm, h, dst, found) do {      \
+  if (!_HASH_CUCKOO_MADE(head)) (found) = NULL;                                \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (_hslot == NULL) (found) = NULL;                                        \
+    else {                                                                     \
+      memcpy((dst), _hslot, sizeof(*_hslot));                                  \
+      (found) = (dst);                                                         \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/* No tombstones are needed as elements never leave their two buckets */
+#define HASH_DELETE_ELT(head, type, field, elm) do {                           \
+  if (_HASH_CUCKOO_MADE(head)) {                                               \
+    HASH_TYPE _dhv;                                                            \
+    _dhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_DELETE_ELT_HV(head, type, field, elm, _dhv);                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if (_HASH_CUCKOO_MADE(head)) {                                               \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (_hslot != NULL) {                                                      \
+      if (_hslot >= _HASH_CUCKOO_STASH(HASH_SHARD(head, _hv)))                 \
+        HASH_SHARD(head, _hv)->n_stashed --;                                   \
+      _HASH_NODE_ERASE(_hslot, field);                                         \
+      HASH_SHARD(head, _hv)->n_items --;                                       \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                       \
+  }                                                                            \
+} while(0)
+
+#define HASH_CLEANUP_NODES(head, type, field, free_func) do {                  \
+  if (_HASH_CUCKOO_MADE(head)) {                                               \
+    struct type *_bkt;                                                         \
+    for (unsigned _s = 0; _s < HASH_CUCKOO_SHARDS; _s ++) {                    \
+      HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
+      for (size_t _i = 0;                                                      \
+          _i < _HASH_CUCKOO_NSLOTS((head)->shards[_s].n_buckets); _i ++) {     \
+        _bkt = &(head)->shards[_s].nodes[_i];                                  \
+        if(!_HASH_NODE_EMPTY(_bkt, field) && (free_func) != NULL)              \
+          _hash_op_##type##_##field##_delete_node((free_func), _bkt);          \
+        _bkt->field.flags = 0;                                                 \
+      }                                                                        \
+      (head)->shards[_s].n_items = 0;                                          \
+      (head)->shards[_s].n_stashed = 0;                                        \
+      HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                       \
+    }                                                                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_DESTROY(head, type, field, free_func) do {                        \
+  HASH_CLEANUP_NODES(head, type, field, free_func);                            \
+  for (unsigned _s = 0; _s < HASH_CUCKOO_SHARDS; _s ++) {                      \
+    if ((head)->shards[_s].nodes != NULL)                                      \
+      HASH_FREE_NODES((head), (head)->shards[_s].nodes,                        \
+          _HASH_CUCKOO_NSLOTS((head)->shards[_s].n_buckets));                  \
+    if ((head)->shards[_s].lock && (head)->ops->lockn_destroy)                 \
+      (head)->ops->lockn_destroy((head)->shards[_s].lock, (head)->ops->locknd); \
+    memset(&(head)->shards[_s], 0, sizeof((head)->shards[_s]));                \
+  }                                                                            \
+} while(0)
+
+/*
+ * Sets `found` to the element with the same key or to NULL. Both buckets are
+ * prefetched before comparing, the number of buckets scanned (3 for the
+ * stash) is sampled as the probe length.
+ */
+#define HASH_FIND_BKT(head, sh, type, field, h, elm, found) do {               \
+  unsigned _b[2], _nb, _probes = 0;                                            \
+  struct type *_cur;                                                           \
+  (found) = NULL;                                                              \
+  _b[0] = _HASH_CUCKOO_B1(sh, h);                                              \
+  _b[1] = _HASH_CUCKOO_B2(sh, h);                                              \
+  _nb = _b[1] == _b[0] ? 1 : 2;                                                \
+  HASH_PREFETCH(_HASH_CUCKOO_BUCKET(sh, _b[0]));                               \
+  HASH_PREFETCH(_HASH_CUCKOO_BUCKET(sh, _b[1]));                               \
+  for (unsigned _k = 0; _k < _nb && (found) == NULL; _k ++) {                  \
+    _cur = _HASH_CUCKOO_BUCKET(sh, _b[_k]);                                    \
+    _probes ++;                                                                \
+    for (unsigned _s = 0; _s < HASH_CUCKOO_SLOTS; _s ++, _cur ++) {            \
+      if (_cur->field.hv == (h) && !_HASH_NODE_EMPTY(_cur, field) &&           \
+          (head)->ops->hash_cmp((elm), _cur, (head)->ops->hashd) == 0) {       \
+        (found) = _cur;                                                        \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  if ((found) == NULL && (sh)->n_stashed > 0) {                                \
+    _cur = _HASH_CUCKOO_STASH(sh);                                             \
+    _probes ++;                                                                \
+    for (unsigned _s = 0; _s < HASH_CUCKOO_STASH; _s ++, _cur ++) {            \
+      if (_cur->field.hv == (h) && !_HASH_NODE_EMPTY(_cur, field) &&           \
+          (head)->ops->hash_cmp((elm), _cur, (head)->ops->hashd) == 0) {       \
+        (found) = _cur;                                                        \
+        break;                                                                 \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  _HASH_PROBE_SAMPLE(sh, _probes);                                             \
+} while(0)
+
+#define HASH_ALLOC_NODES(head, nodes, size) do {                               \
+  if ((head)->ops->alloc) (nodes) = (head)->ops->alloc(sizeof(*(nodes)) * (size), \
+      (head)->ops->allocd);                                                    \
+  else (nodes) = malloc(sizeof(*(nodes)) * (size));                            \
+  if ((nodes) != NULL) memset(nodes, 0, sizeof(*(nodes)) * (size));            \
+} while(0)
+
+#define HASH_FREE_NODES(head, nodes, size) do {                                \
+  if ((head)->ops->free) (head)->ops->free(sizeof(*(nodes)) * (size), (nodes), (head)->ops->allocd); \
+  else free(nodes);                                                            \
+} while(0)
+
+/* Doubles every shard, must not race with other operations on a shard */
+#define HASH_EXPAND_BUCKETS(head, type, field)                                 \
+do {                                                                           \
+  for (unsigned _s = 0; _s < HASH_CUCKOO_SHARDS; _s ++) {                      \
+    HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                           \
+    _hash_op_##type##_##field##_cuckoo_expand((head), &(head)->shards[_s]);    \
+    HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
+  }                                                                            \
+} while(0)
+
+/*
+ * All shards are allocated at once, so the first insertion must not race with
+ * other operations. Call this macro explicitly before sharing a table between
+ * threads. HASH_INITIAL_NUM_BUCKETS slots are split to buckets.
+ */
+#define HASH_MAKE_TABLE(head) do {                                             \
+  for (unsigned _s = 0; _s < HASH_CUCKOO_SHARDS; _s ++) {                      \
+    (head)->shards[_s].n_buckets = HASH_INITIAL_NUM_BUCKETS / HASH_CUCKOO_SLOTS; \
+    (head)->shards[_s].n_items = 0;                                            \
+    (head)->shards[_s].n_stashed = 0;                                          \
+    (head)->shards[_s].generation = 0;                                         \
+    (head)->shards[_s].expand_ns = 0;                                          \
+    HASH_UPPER_BOUND(&(head)->shards[_s]);                                     \
+    HASH_ALLOC_NODES((head), (head)->shards[_s].nodes,                         \
+        _HASH_CUCKOO_NSLOTS((head)->shards[_s].n_buckets));                    \
+    if ((head)->ops->lockn_init)                                               \
+      (head)->shards[_s].lock = (head)->ops->lockn_init((head)->ops->locknd);  \
+  }                                                                            \
+} while(0)
+
+/*
+ * Fill hash_stats_t `st` locking one shard at a time. Slots are counted as
+ * buckets, so `load_factor` is the share of used slots, and `chain_hist`
+ * counts cuckoo buckets by their used slots. Probe length of an element is 1
+ * in its first bucket, 2 in its second one and 3 in the stash.
+ */
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  if (_HASH_CUCKOO_MADE(head)) {                                               \
+    for (unsigned _s = 0; _s < HASH_CUCKOO_SHARDS; _s ++) {                    \
+      __typeof(&(head)->shards[0]) _sh = &(head)->shards[_s];                  \
+      HASH_LOCK_NODE_READ(head, _sh);                                          \
+      for (unsigned _b = 0; _b < _sh->n_buckets; _b ++) {                      \
+        struct type *_cur = _HASH_CUCKOO_BUCKET(_sh, _b);                      \
+        unsigned _used = 0;                                                    \
+        for (unsigned _k = 0; _k < HASH_CUCKOO_SLOTS; _k ++, _cur ++) {        \
+          if (_HASH_NODE_EMPTY(_cur, field)) {                                 \
+            (st)->empty_buckets ++;                                            \
+            continue;                                                          \
+          }                                                                    \
+          _used ++;                                                            \
+          _HASH_STATS_HIST_ADD((st)->probe_hist,                               \
+              _HASH_CUCKOO_B1(_sh, _cur->field.hv) == _b ? 1 : 2);             \
+        }                                                                      \
+        _HASH_STATS_HIST_ADD((st)->chain_hist, _used);                         \
+        (st)->num_items += _used;                                              \
+      }                                                                        \
+      for (unsigned _k = 0; _k < HASH_CUCKOO_STASH; _k ++) {                   \
+        if (!_HASH_NODE_EMPTY(&_HASH_CUCKOO_STASH(_sh)[_k], field)) {          \
+          _HASH_STATS_HIST_ADD((st)->probe_hist, 3);                           \
+          (st)->num_items ++;                                                  \
+        }                                                                      \
+      }                                                                        \
+      (st)->num_buckets += _sh->n_buckets * HASH_CUCKOO_SLOTS;                 \
+      (st)->expands += _sh->generation;                                        \
+      (st)->expand_ns += _sh->expand_ns;                                       \
+      _HASH_PROBE_COLLECT(_sh, st);                                            \
+      HASH_UNLOCK_NODE_READ(head, _sh);                                        \
+    }                                                                          \
+    for (unsigned _k = 1; _k <= 3; _k ++)                                      \
+      if ((st)->probe_hist[_k] > 0) (st)->max_chain = _k;                      \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+  }                                                                            \
+} while(0)
+
+#define HASH_UPPER_BOUND(sh)                                                   \
+  ((sh)->upper_bound = ((sh)->n_buckets * HASH_CUCKOO_SLOTS *                  \
+      HASH_CUCKOO_MAX_LOAD + 0.5))
+
+/*
+ * Per type functions: placement of an element by BFS over displacements,
+ * shard expansion and insertion of a new element. Shards are passed as void
+ * pointers as every HASH_HEAD declares its own anonymous shard type.
+ */
+#define _HASH_GENERATE_ENGINE(type, field)                                     \
+    typedef __typeof(((HASH_HEAD(, type, field) *)0)->shards[0])               \
+        _hash_cuckoo_shard_##type##_##field;                                   \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_cuckoo_place)(         \
+        void *_sh, struct type *elm)                                           \
+    {                                                                          \
+      _hash_cuckoo_shard_##type##_##field *sh = _sh;                           \
+      struct _hash_cuckoo_step q[HASH_CUCKOO_BFS_MAX];                         \
+      unsigned n = 0, fs;                                                      \
+      HASH_TYPE h = elm->field.hv;                                             \
+      struct type *bkt;                                                        \
+      q[n].bkt = _HASH_CUCKOO_B1(sh, h);                                       \
+      q[n ++].parent = -1;                                                     \
+      if (_HASH_CUCKOO_B2(sh, h) != q[0].bkt) {                                \
+        q[n].bkt = _HASH_CUCKOO_B2(sh, h);                                     \
+        q[n ++].parent = -1;                                                   \
+      }                                                                        \
+      for (unsigned i = 0; i < n; i ++) {                                      \
+        bkt = _HASH_CUCKOO_BUCKET(sh, q[i].bkt);                               \
+        for (fs = 0; fs < HASH_CUCKOO_SLOTS; fs ++) {                          \
+          if (_HASH_NODE_EMPTY(&bkt[fs], field)) break;                        \
+        }                                                                      \
+        if (fs < HASH_CUCKOO_SLOTS) {                                          \
+          /* Move elements along the path, the last free slot is at root */    \
+          while (q[i].parent != -1) {                                          \
+            struct type *from =                                                \
+                &_HASH_CUCKOO_BUCKET(sh, q[q[i].parent].bkt)[q[i].slot];       \
+            memcpy(&bkt[fs], from, sizeof(*from));                             \
+            fs = q[i].slot;                                                    \
+            i = q[i].parent;                                                   \
+            bkt = _HASH_CUCKOO_BUCKET(sh, q[i].bkt);                           \
+          }                                                                    \
+          memcpy(&bkt[fs], elm, sizeof(*elm));                                 \
+          _HASH_NODE_FILL(&bkt[fs], field);                                    \
+          return 1;                                                            \
+        }                                                                      \
+        for (unsigned s = 0; s < HASH_CUCKOO_SLOTS &&                          \
+            n < HASH_CUCKOO_BFS_MAX; s ++) {                                   \
+          HASH_TYPE oh = bkt[s].field.hv;                                      \
+          unsigned alt = _HASH_CUCKOO_B1(sh, oh);                              \
+          int p;                                                               \
+          if (alt == q[i].bkt) alt = _HASH_CUCKOO_B2(sh, oh);                  \
+          /* A path must not visit a bucket twice */                           \
+          for (p = i; p != -1 && q[p].bkt != alt; p = q[p].parent);            \
+          if (p != -1) continue;                                               \
+          q[n].bkt = alt;                                                      \
+          q[n].parent = i;                                                     \
+          q[n ++].slot = s;                                                    \
+        }                                                                      \
+      }                                                                        \
+      bkt = _HASH_CUCKOO_STASH(sh);                                            \
+      for (fs = 0; fs < HASH_CUCKOO_STASH; fs ++) {                            \
+        if (_HASH_NODE_EMPTY(&bkt[fs], field)) {                               \
+          memcpy(&bkt[fs], elm, sizeof(*elm));                                 \
+          _HASH_NODE_FILL(&bkt[fs], field);                                    \
+          sh->n_stashed ++;                                                    \
+          return 1;                                                            \
+        }                                                                      \
+      }                                                                        \
+      return 0;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Doubles a shard until all its elements are placed, at most              \
+     * HASH_CUCKOO_MAX_GROW times. 0 if they could not be placed               \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_cuckoo_expand)(        \
+        void *_head, void *_sh)                                                \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      _hash_cuckoo_shard_##type##_##field *sh = _sh;                           \
+      struct type *old_nodes = sh->nodes, *nodes;                              \
+      unsigned old_num = sh->n_buckets, new_num = old_num, grow = 0;           \
+      unsigned old_stashed = sh->n_stashed;                                    \
+      size_t nold = _HASH_CUCKOO_NSLOTS(old_num), i;                           \
+      uint64_t t0 = HASH_CLOCK_NS();                                           \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      for (;;) {                                                               \
+        new_num *= 2;                                                          \
+        if (grow ++ < HASH_CUCKOO_MAX_GROW)                                    \
+          HASH_ALLOC_NODES(head, nodes, _HASH_CUCKOO_NSLOTS(new_num));         \
+        else nodes = NULL;              /* Give up as if out of memory */      \
+        if (nodes == NULL) {                                                   \
+          __atomic_store_n(&sh->nodes, old_nodes, __ATOMIC_RELAXED);           \
+          sh->n_buckets = old_num;                                             \
+          sh->n_stashed = old_stashed;                                         \
+          sh->need_expand = 0;                                                 \
+          return 0;                                                            \
+        }                                                                      \
+        __atomic_store_n(&sh->nodes, nodes, __ATOMIC_RELAXED);                 \
+        sh->n_buckets = new_num;                                               \
+        sh->n_stashed = 0;                                                     \
+        for (i = 0; i < nold; i ++) {                                          \
+          if (_HASH_NODE_EMPTY(&old_nodes[i], field)) continue;                \
+          if (!_hash_op_##type##_##field##_cuckoo_place(sh, &old_nodes[i]))    \
+            break;                                                             \
+        }                                                                      \
+        if (i == nold) break;                                                  \
+        HASH_FREE_NODES(head, nodes, _HASH_CUCKOO_NSLOTS(new_num));            \
+      }                                                                        \
+      HASH_FREE_NODES(head, old_nodes, nold);                                  \
+      sh->generation ++;                                                       \
+      t0 = HASH_CLOCK_NS() - t0;                                               \
+      sh->expand_ns += t0;                                                     \
+      if (head->ops->on_expand) head->ops->on_expand(                          \
+          old_num * HASH_CUCKOO_SLOTS, new_num * HASH_CUCKOO_SLOTS,            \
+          sh->n_items, t0, head->ops->expandd);                                \
+      HASH_UPPER_BOUND(sh);                                                    \
+      sh->need_expand = 0;                                                     \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Whether both buckets of `h` and the stash hold merely elements with     \
+     * hash value `h`, which stay there however many times a shard is doubled  \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_cuckoo_full)(          \
+        void *_sh, HASH_TYPE h)                                                \
+    {                                                                          \
+      _hash_cuckoo_shard_##type##_##field *sh = _sh;                           \
+      struct type *bkt[3];                                                     \
+      unsigned nslots[3] = {HASH_CUCKOO_SLOTS, HASH_CUCKOO_SLOTS,              \
+          HASH_CUCKOO_STASH};                                                  \
+      bkt[0] = _HASH_CUCKOO_BUCKET(sh, _HASH_CUCKOO_B1(sh, h));                \
+      bkt[1] = _HASH_CUCKOO_BUCKET(sh, _HASH_CUCKOO_B2(sh, h));                \
+      bkt[2] = _HASH_CUCKOO_STASH(sh);                                         \
+      for (unsigned k = 0; k < 3; k ++) {                                      \
+        for (unsigned s = 0; s < nslots[k]; s ++) {                            \
+          if (_HASH_NODE_EMPTY(&bkt[k][s], field) || bkt[k][s].field.hv != h)  \
+            return 0;                                                          \
+        }                                                                      \
+      }                                                                        \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Adds a new element to a locked shard, 0 if it could not be placed after \
+     * HASH_CUCKOO_MAX_GROW doublings (or at once if doubling could not help)  \
+     * or if out of memory                                                     \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_cuckoo_add)(           \
+        void *_head, void *_sh, struct type *elm)                              \
+    {                                                                          \
+      _hash_cuckoo_shard_##type##_##field *sh = _sh;                           \
+      unsigned grow = 0;                                                       \
+      while (!_hash_op_##type##_##field##_cuckoo_place(sh, elm)) {             \
+        if (grow ++ == HASH_CUCKOO_MAX_GROW ||                                 \
+            _hash_op_##type##_##field##_cuckoo_full(sh, elm->field.hv))        \
+          return 0;                                                            \
+        sh->need_expand = 1;                                                   \
+        if (!_hash_op_##type##_##field##_cuckoo_expand(_head, sh)) return 0;   \
+      }                                                                        \
+      if (++ sh->n_items >= sh->upper_bound) {                                 \
+        sh->need_expand = 1;                                                   \
+        _hash_op_##type##_##field##_cuckoo_expand(_head, sh);                  \
+      }                                                                        \
+      return 1;                                                                \
+    }
+
+#endif /* HASH_CUCKOO_H_ */
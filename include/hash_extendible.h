@@ -0,0 +1,542 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_EXTENDIBLE_H_
+#define HASH_EXTENDIBLE_H_
+
+#include <stdint.h>
+
+#define _HASH_USE_EXTENDIBLE 1
+
+/*
+ * Extendible hashing. Elements are chained as in hash.h, but buckets are
+ * grouped to pages of 2^HASH_EXTENDIBLE_PAGE_LOG2 buckets. A directory of
+ * 2^depth page pointers is indexed by the low `depth` bits of a hash value
+ * and a bucket within a page by its top bits. Every page has a local depth:
+ * 2^(depth - local depth) directory slots point to it.
+ *
+ * A page holding more than HASH_EXTENDIBLE_PAGE_LOAD elements per bucket is
+ * split alone: elements with the next bit of a hash value set move to a new
+ * sibling page, so memory and rehash work of a resize are proportional to one
+ * page. Only when the local depth of a page reaches the directory depth the
+ * directory (merely pointers) is doubled under the table write lock. Splits
+ * hold the table read lock and the lock of the page being split, so other
+ * pages stay available, and HASH_ON_EXPAND callbacks of different pages
+ * could run concurrently. Pages are not merged back by deletions.
+ *
+ * A page whose elements share all directory bits of their hash values (e.g.
+ * duplicate keys or colliding hash values) is not split, as splits would
+ * move nothing and only double the directory up to its maximal depth. Such
+ * a page is left overfull until the number of its elements doubles.
+ */
+#ifndef HASH_EXTENDIBLE_PAGE_LOG2
+#define HASH_EXTENDIBLE_PAGE_LOG2 6
+#endif
+#define HASH_EXTENDIBLE_PAGE_BUCKETS (1U << HASH_EXTENDIBLE_PAGE_LOG2)
+#ifndef HASH_EXTENDIBLE_PAGE_LOAD
+#define HASH_EXTENDIBLE_PAGE_LOAD 2
+#endif
+#define HASH_EXTENDIBLE_PAGE_MAX                                               \
+  (HASH_EXTENDIBLE_PAGE_BUCKETS * HASH_EXTENDIBLE_PAGE_LOAD)
+/* Bits of a hash value left for the directory */
+#define HASH_EXTENDIBLE_MAX_DEPTH                                              \
+  (sizeof(HASH_TYPE) * 8 - HASH_EXTENDIBLE_PAGE_LOG2)
+
+typedef struct _hash_ext_page_s {
+  void *lock;
+  unsigned depth;
+  unsigned items;
+  unsigned split_items;     /* A page with more elements is split */
+  void *first[HASH_EXTENDIBLE_PAGE_BUCKETS];
+} _hash_ext_page_t;
+
+#define HASH_HEAD(name, type, field)                                           \
+struct name {                                                                  \
+   _hash_ext_page_t **dir;                                                     \
+   struct _hash_ops_##type##_##field *ops;                                     \
+   unsigned depth;                                                             \
+   unsigned num_pages;                                                         \
+   unsigned num_items;                                                         \
+   unsigned generation;                                                        \
+   unsigned expands;                                                           \
+   uint64_t expand_ns;                                                         \
+   _HASH_PROBE_FIELDS                                                          \
+   void *resize_lock;                                                          \
+}
+
+#define _HASH_EXT_DIR_IDX(head, h) ((unsigned)(h) & ((1U << (head)->depth) - 1))
+#define _HASH_EXT_BKT_IDX(h)                                                   \
+  ((unsigned)((h) >> (sizeof(HASH_TYPE) * 8 - HASH_EXTENDIBLE_PAGE_LOG2)))
+/* A page is visited once when the directory is walked from its first slot */
+#define _HASH_EXT_PAGE_FIRST(pg, i) ((i) < (1U << (pg)->depth))
+
+/*
+ * Sets `pg` to the page of `h` locked for reading or writing. The directory
+ * slot is checked again once the page is locked, as the page could have been
+ * split in between
+ */
+#define _HASH_EXT_LOCK_PAGE(head, h, pg, LOCK, UNLOCK) do {                    \
+  _hash_ext_page_t **_slot = &(head)->dir[_HASH_EXT_DIR_IDX(head, h)];         \
+  for (;;) {                                                                   \
+    (pg) = __atomic_load_n(_slot, __ATOMIC_ACQUIRE);                           \
+    LOCK(head, pg);                                                            \
+    if ((pg) == __atomic_load_n(_slot, __ATOMIC_ACQUIRE)) break;               \
+    UNLOCK(head, pg);                                                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_INSERT(head, type, field, elm) do {                               \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  HASH_INSERT_HV(head, type, field, elm, _hv);                                 \
+} while(0)
+
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  _hash_ext_page_t *_pg;                                                       \
+  int _split;                                                                  \
+  if ((head)->dir == NULL) HASH_MAKE_TABLE(head);                              \
+  (elm)->field.hv = (h);                                                       \
+  HASH_LOCK_READ(head);                                                        \
+  _HASH_EXT_LOCK_PAGE(head, (elm)->field.hv, _pg, HASH_LOCK_NODE_WRITE,        \
+      HASH_UNLOCK_NODE_WRITE);                                                 \
+  _HASH_EXT_INSERT_PAGE(_pg, type, field, elm);                                \
+  _split = _pg->items > _pg->split_items;                                      \
+  HASH_UNLOCK_NODE_WRITE(head, _pg);                                           \
+  _HASH_ITEMS_ADD(head, 1);                                                    \
+  HASH_UNLOCK_READ(head);                                                      \
+  if (_split) _hash_op_##type##_##field##_ext_split((head), (elm)->field.hv);  \
+} while(0)
+
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_FIND_OR_INSERT_EXT(head, type, field, elm, _hv, found, (void)0);       \
+} while(0)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_FIND_OR_INSERT_EXT(head, type, field, elm, h, found, (void)0)
+
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _hv;                                                               \
+  struct type *_uelt;                                                          \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  _HASH_FIND_OR_INSERT_EXT(head, type, field, elm, _hv, _uelt,                 \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_FIND_OR_INSERT_EXT(head, type, field, elm, h, _uelt,                   \
+      (merge_cb)(_telt, (elm)));                                               \
+  (void)_uelt;                                                                 \
+} while(0)
+
+/* `on_found` is executed with `_telt` pointing to the existing element */
+#define _HASH_FIND_OR_INSERT_EXT(head, type, field, elm, h, found, on_found) do { \
+  _hash_ext_page_t *_pg;                                                       \
+  struct type *_telt;                                                          \
+  HASH_TYPE _fhv = (h);                                                        \
+  int _split = 0;                                                              \
+  if ((head)->dir == NULL) HASH_MAKE_TABLE(head);                              \
+  HASH_LOCK_READ(head);                                                        \
+  _HASH_EXT_LOCK_PAGE(head, _fhv, _pg, HASH_LOCK_NODE_WRITE,                   \
+      HASH_UNLOCK_NODE_WRITE);                                                 \
+  _HASH_EXT_FIND_PAGE(head, _pg, type, field, elm, _fhv, _telt, (void)0);      \
+  if (_telt != NULL) {                                                         \
+    on_found;                                                                  \
+  }                                                                            \
+  else {                                                                       \
+    (elm)->field.hv = _fhv;                                                    \
+    _HASH_EXT_INSERT_PAGE(_pg, type, field, elm);                              \
+    _split = _pg->items > _pg->split_items;                                    \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, _pg);                                           \
+  if (_telt == NULL) _HASH_ITEMS_ADD(head, 1);                                 \
+  HASH_UNLOCK_READ(head);                                                      \
+  (found) = _telt;                                                             \
+  if (_split) _hash_op_##type##_##field##_ext_split((head), _fhv);             \
+} while(0)
+
+#define HASH_FIND_ELT(head, type, field, elm, found) do {                      \
+  if ((head)->dir == NULL) (found) = NULL;                                     \
+  else {                                                                       \
+    HASH_TYPE _hv;                                                             \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_FIND_ELT_HV(head, type, field, elm, _hv, found);                      \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if ((head)->dir == NULL) (found) = NULL;                                     \
+  else {                                                                       \
+    _hash_ext_page_t *_pg;                                                     \
+    struct type *_telt;                                                        \
+    HASH_TYPE _fhv = (h);                                                      \
+    HASH_LOCK_READ(head);                                                      \
+    _HASH_EXT_LOCK_PAGE(head, _fhv, _pg, HASH_LOCK_NODE_READ,                  \
+        HASH_UNLOCK_NODE_READ);                                                \
+    _HASH_EXT_FIND_PAGE(head, _pg, type, field, elm, _fhv, _telt, (void)0);    \
+    HASH_UNLOCK_NODE_READ(head, _pg);                                          \
+    HASH_UNLOCK_READ(head);                                                    \
+    (found) = _telt;                                                           \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT(head, type, field, elm) do {                           \
+  if ((head)->dir != NULL) {                                                   \
+    HASH_TYPE _hv;                                                             \
+    _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+    HASH_DELETE_ELT_HV(head, type, field, elm, _hv);                           \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if ((head)->dir != NULL) {                                                   \
+    _hash_ext_page_t *_pg;                                                     \
+    struct type *_telt, *_prev = NULL;                                         \
+    HASH_TYPE _fhv = (h);                                                      \
+    HASH_LOCK_READ(head);                                                      \
+    _HASH_EXT_LOCK_PAGE(head, _fhv, _pg, HASH_LOCK_NODE_WRITE,                 \
+        HASH_UNLOCK_NODE_WRITE);                                               \
+    _HASH_EXT_FIND_PAGE(head, _pg, type, field, elm, _fhv, _telt,              \
+        _prev = _telt);                                                        \
+    if (_telt != NULL) {                                                       \
+      if (_prev != NULL) _prev->field.next = _telt->field.next;                \
+      else _pg->first[_HASH_EXT_BKT_IDX(_fhv)] = (void *)_telt->field.next;    \
+      _telt->field.next = NULL;                                                \
+      _pg->items --;                                                           \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, _pg);                                         \
+    if (_telt != NULL) _HASH_ITEMS_SUB(head, 1);                               \
+    HASH_UNLOCK_READ(head);                                                    \
+  }                                                                            \
+} while(0)
+
+#define HASH_CLEANUP_NODES(head, type, field, free_func) do {                  \
+  if ((head)->dir != NULL) {                                                   \
+    struct type *_telt, *_tmp;                                                 \
+    _hash_ext_page_t *_pg;                                                     \
+    HASH_LOCK_READ(head);                                                      \
+    for (unsigned _i = 0; _i < (1U << (head)->depth); _i ++) {                 \
+      _pg = (head)->dir[_i];                                                   \
+      if (!_HASH_EXT_PAGE_FIRST(_pg, _i)) continue;                            \
+      HASH_LOCK_NODE_WRITE(head, _pg);                                         \
+      for (unsigned _b = 0; _b < HASH_EXTENDIBLE_PAGE_BUCKETS; _b ++) {        \
+        _telt = (struct type *)_pg->first[_b];                                 \
+        while (_telt != NULL) {                                                \
+          _tmp = _telt;                                                        \
+          _telt = _telt->field.next;                                           \
+          _tmp->field.next = NULL;                                             \
+          if ((free_func) != NULL) _hash_op_##type##_##field##_delete_node((free_func), _tmp); \
+        }                                                                      \
+        _pg->first[_b] = NULL;                                                 \
+      }                                                                        \
+      _pg->items = 0;                                                          \
+      HASH_UNLOCK_NODE_WRITE(head, _pg);                                       \
+    }                                                                          \
+    (head)->num_items = 0;                                                     \
+    HASH_UNLOCK_READ(head);                                                    \
+  }                                                                            \
+} while(0)
+
+#define HASH_DESTROY(head, type, field, free_func) do {                        \
+  HASH_CLEANUP_NODES(head, type, field, free_func);                            \
+  if ((head)->dir != NULL) {                                                   \
+    HASH_LOCK_WRITE(head);                                                     \
+    /* Later slots of a page are passed before it is freed at its first one */ \
+    for (unsigned _i = 1U << (head)->depth; _i -- > 0; ) {                     \
+      _hash_ext_page_t *_pg = (head)->dir[_i];                                 \
+      if (!_HASH_EXT_PAGE_FIRST(_pg, _i)) continue;                            \
+      _HASH_EXT_FREE_PAGE(head, _pg);                                          \
+    }                                                                          \
+    HASH_FREE_NODES((head), (head)->dir, 1U << (head)->depth);                 \
+    (head)->dir = NULL;                                                        \
+    (head)->depth = 0;                                                         \
+    (head)->num_pages = 0;                                                     \
+    (head)->generation = 0;                                                    \
+    (head)->num_items = 0;                                                     \
+    HASH_UNLOCK_WRITE(head);                                                   \
+  }                                                                            \
+  if ((head)->resize_lock && (head)->ops->lock_destroy)                        \
+    (head)->ops->lock_destroy((head)->resize_lock, (head)->ops->lockd);        \
+  (head)->resize_lock = NULL;                                                  \
+} while(0)
+
+#define _HASH_EXT_INSERT_PAGE(pg, type, field, elm) do {                       \
+  void **_first = &(pg)->first[_HASH_EXT_BKT_IDX((elm)->field.hv)];            \
+  (elm)->field.next = (struct type *)*_first;                                  \
+  *_first = (void *)(elm);                                                     \
+  (pg)->items ++;                                                              \
+} while(0)
+
+/*
+ * Sets `found` to the element of a locked page with the same key or to NULL,
+ * `on_skip` is executed for every element passed by
+ */
+#define _HASH_EXT_FIND_PAGE(head, pg, type, field, elm, h, found, on_skip) do { \
+  unsigned _probes = 0;                                                        \
+  (found) = (struct type *)(pg)->first[_HASH_EXT_BKT_IDX(h)];                  \
+  while ((found) != NULL && ((found)->field.hv != (h) ||                       \
+      (head)->ops->hash_cmp((elm), (found), (head)->ops->hashd) != 0)) {       \
+    on_skip;                                                                   \
+    (found) = (found)->field.next;                                             \
+    _probes ++;                                                                \
+  }                                                                            \
+  _HASH_PROBE_SAMPLE(head, _probes + ((found) != NULL));                       \
+} while(0)
+
+#define HASH_ALLOC_NODES(head, nodes, size) do {                               \
+  if ((head)->ops->alloc) (nodes) = (head)->ops->alloc(sizeof(*(nodes)) * (size), \
+      (head)->ops->allocd);                                                    \
+  else (nodes) = malloc(sizeof(*(nodes)) * (size));                            \
+  if ((nodes) != NULL) memset(nodes, 0, sizeof(*(nodes)) * (size));            \
+} while(0)
+
+#define HASH_FREE_NODES(head, nodes, size) do {                                \
+  if ((head)->ops->free) (head)->ops->free(sizeof(*(nodes)) * (size), (nodes), (head)->ops->allocd); \
+  else free(nodes);                                                            \
+} while(0)
+
+#define _HASH_EXT_ALLOC_PAGE(head, pg, d) do {                                 \
+  HASH_ALLOC_NODES(head, pg, 1);                                               \
+  if ((pg) != NULL) {                                                          \
+    (pg)->depth = (d);                                                         \
+    (pg)->split_items = HASH_EXTENDIBLE_PAGE_MAX;                              \
+    if ((head)->ops->lockn_init)                                               \
+      (pg)->lock = (head)->ops->lockn_init((head)->ops->locknd);               \
+  }                                                                            \
+} while(0)
+
+#define _HASH_EXT_FREE_PAGE(head, pg) do {                                     \
+  if ((pg)->lock && (head)->ops->lockn_destroy)                                \
+    (head)->ops->lockn_destroy((pg)->lock, (head)->ops->locknd);               \
+  HASH_FREE_NODES(head, pg, 1);                                                \
+} while(0)
+
+/*
+ * Splits every page once under the table write lock, so the capacity of a
+ * table is doubled
+ */
+#define HASH_EXPAND_BUCKETS(head, type, field) do {                            \
+  if ((head)->dir == NULL) HASH_MAKE_TABLE(head);                              \
+  HASH_LOCK_WRITE(head);                                                       \
+  _hash_op_##type##_##field##_ext_expand(head);                                \
+  HASH_UNLOCK_WRITE(head);                                                     \
+} while(0)
+
+/* The first insertion must not race with other operations */
+#define HASH_MAKE_TABLE(head) do {                                             \
+  _hash_ext_page_t *_pg;                                                       \
+  (head)->depth = 0;                                                           \
+  (head)->num_pages = 1;                                                       \
+  (head)->generation = 0;                                                      \
+  (head)->expands = 0;                                                         \
+  (head)->expand_ns = 0;                                                       \
+  HASH_ALLOC_NODES((head), (head)->dir, 1);                                    \
+  _HASH_EXT_ALLOC_PAGE(head, _pg, 0);                                          \
+  (head)->dir[0] = _pg;                                                        \
+  if ((head)->ops->lock_init) (head)->resize_lock = (head)->ops->lock_init((head)->ops->lockd); \
+} while(0)
+
+/*
+ * Fill hash_stats_t `st` under the table read lock locking a page at a time.
+ * Buckets of all pages are counted and `expands` is the number of splits
+ */
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->dir != NULL) {                                                   \
+    for (unsigned _i = 0; _i < (1U << (head)->depth); _i ++) {                 \
+      _hash_ext_page_t *_pg = (head)->dir[_i];                                 \
+      if (!_HASH_EXT_PAGE_FIRST(_pg, _i)) continue;                            \
+      HASH_LOCK_NODE_READ(head, _pg);                                          \
+      for (unsigned _b = 0; _b < HASH_EXTENDIBLE_PAGE_BUCKETS; _b ++) {        \
+        struct type *_telt;                                                    \
+        unsigned _len = 0;                                                     \
+        for (_telt = _pg->first[_b]; _telt != NULL; _telt = _telt->field.next) { \
+          _len ++;                                                             \
+          _HASH_STATS_HIST_ADD((st)->probe_hist, _len);                        \
+        }                                                                      \
+        _HASH_STATS_HIST_ADD((st)->chain_hist, _len);                          \
+        if (_len == 0) (st)->empty_buckets ++;                                 \
+        if (_len > (st)->max_chain) (st)->max_chain = _len;                    \
+        (st)->num_items += _len;                                               \
+      }                                                                        \
+      (st)->num_buckets += HASH_EXTENDIBLE_PAGE_BUCKETS;                       \
+      HASH_UNLOCK_NODE_READ(head, _pg);                                        \
+    }                                                                          \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+    (st)->expands = __atomic_load_n(&(head)->expands, __ATOMIC_RELAXED);       \
+    (st)->expand_ns = __atomic_load_n(&(head)->expand_ns, __ATOMIC_RELAXED);   \
+    _HASH_PROBE_COLLECT(head, st);                                             \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+
+/*
+ * Per type functions: directory doubling, split of a page and splitting
+ * of an overflowing page after an insertion.
+ */
+#define _HASH_GENERATE_ENGINE(type, field)                                     \
+    /* Doubles the directory, the table must be write locked */                \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_ext_grow)(void *_head) \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      _hash_ext_page_t **dir;                                                  \
+      unsigned n;                                                              \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      n = 1U << head->depth;                                                   \
+      if (head->depth >= HASH_EXTENDIBLE_MAX_DEPTH) return 0;                  \
+      HASH_ALLOC_NODES(head, dir, n * 2);                                      \
+      if (dir == NULL) return 0;                                               \
+      memcpy(dir, head->dir, sizeof(*dir) * n);                                \
+      memcpy(dir + n, head->dir, sizeof(*dir) * n);                            \
+      HASH_FREE_NODES(head, head->dir, n);                                     \
+      head->dir = dir;                                                         \
+      head->depth ++;                                                          \
+      head->generation ++;                                                     \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Moves elements of a locked page with the next bit of a hash value set   \
+     * to a new page and points the half of its directory slots to it. Local   \
+     * depth of the page must be less than the directory depth                 \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_ext_split_page)(       \
+        void *_head, _hash_ext_page_t *pg, unsigned idx)                       \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      _hash_ext_page_t *sib;                                                   \
+      struct type *elt, *next;                                                 \
+      unsigned bit = 1U << pg->depth, items = pg->items, pages, i;             \
+      uint64_t t0 = HASH_CLOCK_NS();                                           \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      _HASH_EXT_ALLOC_PAGE(head, sib, pg->depth + 1);                          \
+      if (sib == NULL) return 0;                                               \
+      pg->depth ++;                                                            \
+      for (unsigned b = 0; b < HASH_EXTENDIBLE_PAGE_BUCKETS; b ++) {           \
+        elt = (struct type *)pg->first[b];                                     \
+        pg->first[b] = NULL;                                                   \
+        while (elt != NULL) {                                                  \
+          next = elt->field.next;                                              \
+          if (elt->field.hv & bit) {                                           \
+            elt->field.next = (struct type *)sib->first[b];                    \
+            sib->first[b] = (void *)elt;                                       \
+            sib->items ++;                                                     \
+          }                                                                    \
+          else {                                                               \
+            elt->field.next = (struct type *)pg->first[b];                     \
+            pg->first[b] = (void *)elt;                                        \
+          }                                                                    \
+          elt = next;                                                          \
+        }                                                                      \
+      }                                                                        \
+      pg->items -= sib->items;                                                 \
+      pg->split_items = HASH_EXTENDIBLE_PAGE_MAX;                              \
+      for (i = (idx & (bit - 1)) | bit; i < (1U << head->depth); i += bit * 2) \
+        __atomic_store_n(&head->dir[i], sib, __ATOMIC_RELEASE);                \
+      pages = __atomic_fetch_add(&head->num_pages, 1, __ATOMIC_RELAXED);       \
+      __atomic_fetch_add(&head->expands, 1, __ATOMIC_RELAXED);                 \
+      t0 = HASH_CLOCK_NS() - t0;                                               \
+      __atomic_fetch_add(&head->expand_ns, t0, __ATOMIC_RELAXED);              \
+      if (head->ops->on_expand)                                                \
+        head->ops->on_expand(pages * HASH_EXTENDIBLE_PAGE_BUCKETS,             \
+            (pages + 1) * HASH_EXTENDIBLE_PAGE_BUCKETS, items, t0,             \
+            head->ops->expandd);                                               \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Whether hash values of elements of a locked page differ in a directory  \
+     * bit above its local depth, so that splits could ever separate them      \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_ext_separable)(        \
+        _hash_ext_page_t *pg)                                                  \
+    {                                                                          \
+      struct type *elt;                                                        \
+      HASH_TYPE any = 0, all = ~(HASH_TYPE)0, mask;                            \
+      if (pg->depth >= HASH_EXTENDIBLE_MAX_DEPTH) return 0;                    \
+      mask = (((HASH_TYPE)1 << HASH_EXTENDIBLE_MAX_DEPTH) - 1) &               \
+          ~(((HASH_TYPE)1 << pg->depth) - 1);                                  \
+      for (unsigned b = 0; b < HASH_EXTENDIBLE_PAGE_BUCKETS; b ++) {           \
+        for (elt = (struct type *)pg->first[b]; elt != NULL;                   \
+            elt = elt->field.next) {                                           \
+          any |= elt->field.hv;                                                \
+          all &= elt->field.hv;                                                \
+        }                                                                      \
+      }                                                                        \
+      return ((any ^ all) & mask) != 0;                                        \
+    }                                                                          \
+    /*                                                                         \
+     * Splits the page of `h` whilst it overflows. When its local depth has    \
+     * reached the directory depth, the directory is doubled first. A page     \
+     * that splits cannot separate is left overfull                            \
+     */                                                                        \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_ext_split)(           \
+        void *_head, HASH_TYPE h)                                              \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      _hash_ext_page_t *pg;                                                    \
+      unsigned depth;                                                          \
+      int again;                                                               \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      do {                                                                     \
+        HASH_LOCK_READ(head);                                                  \
+        _HASH_EXT_LOCK_PAGE(head, h, pg, HASH_LOCK_NODE_WRITE,                 \
+            HASH_UNLOCK_NODE_WRITE);                                           \
+        depth = head->depth;                                                   \
+        again = 0;                                                             \
+        if (pg->items > pg->split_items) {                                     \
+          if (!_hash_op_##type##_##field##_ext_separable(pg))                  \
+            pg->split_items = pg->items * 2;                                   \
+          else if (pg->depth == depth) again = 2;                              \
+          else again = _hash_op_##type##_##field##_ext_split_page(head, pg,    \
+              _HASH_EXT_DIR_IDX(head, h));                                     \
+        }                                                                      \
+        HASH_UNLOCK_NODE_WRITE(head, pg);                                      \
+        HASH_UNLOCK_READ(head);                                                \
+        if (again == 2) {                                                      \
+          HASH_LOCK_WRITE(head);                                               \
+          if (head->depth == depth &&                                          \
+              !_hash_op_##type##_##field##_ext_grow(head)) again = 0;          \
+          HASH_UNLOCK_WRITE(head);                                             \
+        }                                                                      \
+      } while (again);                                                         \
+    }                                                                          \
+    /* Doubles the directory and splits each page, the table is write locked */ \
+    static void _HU_FUNCTION(_hash_op_##type##_##field##_ext_expand)(          \
+        void *_head)                                                           \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      unsigned n;                                                              \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      n = 1U << head->depth;                                                   \
+      if (!_hash_op_##type##_##field##_ext_grow(head)) return;                 \
+      /* Siblings take slots above their pages, so they are not split again */ \
+      for (unsigned i = n; i -- > 0; ) {                                       \
+        _hash_ext_page_t *pg = head->dir[i];                                   \
+        if (!_HASH_EXT_PAGE_FIRST(pg, i)) continue;                            \
+        if (!_hash_op_##type##_##field##_ext_split_page(head, pg, i)) return;  \
+      }                                                                        \
+    }
+
+#endif /* HASH_EXTENDIBLE_H_ */
@@ -0,0 +1,532 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_HOPSCOTCH_H_
+#define HASH_HOPSCOTCH_H_
+
+#include <stdint.h>
+
+#define _HASH_USE_HOPSCOTCH 1
+
+/*
+ * Hopscotch table. Every element is stored within HASH_HOPSCOTCH_H slots of
+ * its home slot (selected by the low bits of a hash value) and the home slot
+ * keeps a bitmap of its neighborhood telling which of these slots hold its
+ * elements. A lookup therefore compares merely elements of its home slot in
+ * one contiguous scan, a miss costs at most HASH_HOPSCOTCH_H comparisons of
+ * stored hash values.
+ *
+ * An insertion takes the closest free slot and, whilst it is out of the
+ * neighborhood, hops it back by moving an element that could be stored
+ * there without leaving its own neighborhood. If that fails the shard is
+ * doubled. Elements sharing a hash value cannot be separated by doubling,
+ * so an element is refused when its neighborhood is full of such elements,
+ * or when it still has no slot after HASH_HOPSCOTCH_MAX_GROW doublings.
+ * HASH_FIND_OR_INSERT then sets `found` to the element itself, as when
+ * memory is exhausted. Elements are stored inside of a table like in
+ * hash_closed.h, so shards (segments locked by `lockn_*` ops) and the
+ * validity of found elements follow the same rules.
+ */
+#define HASH_HOPSCOTCH_H 32
+#ifndef HASH_HOPSCOTCH_ADD_RANGE
+#define HASH_HOPSCOTCH_ADD_RANGE 512
+#endif
+#ifndef HASH_HOPSCOTCH_MAX_GROW
+#define HASH_HOPSCOTCH_MAX_GROW 3
+#endif
+#ifndef HASH_HOPSCOTCH_MAX_LOAD
+#define HASH_HOPSCOTCH_MAX_LOAD 0.9
+#endif
+
+#ifndef HASH_HOPSCOTCH_SHARDS_LOG2
+#define HASH_HOPSCOTCH_SHARDS_LOG2 0
+#endif
+#define HASH_HOPSCOTCH_SHARDS (1U << HASH_HOPSCOTCH_SHARDS_LOG2)
+
+#if HASH_HOPSCOTCH_SHARDS_LOG2 > 0
+#define _HASH_HOPSCOTCH_SHARD_IDX(h)                                           \
+  ((unsigned)((h) >> (sizeof(HASH_TYPE) * 8 - HASH_HOPSCOTCH_SHARDS_LOG2)))
+# ifdef __GNUC__
+#   define _HASH_HOPSCOTCH_SHARD_ALIGN __attribute__((aligned(64)))
+# endif
+#else
+#define _HASH_HOPSCOTCH_SHARD_IDX(h) 0U
+#endif
+
+#ifndef _HASH_HOPSCOTCH_SHARD_ALIGN
+#define _HASH_HOPSCOTCH_SHARD_ALIGN
+#endif
+
+/* `hop` belongs to the slot rather than to the element stored in it */
+#define HASH_ENTRY(type)                                                       \
+struct {                                                                       \
+  HASH_TYPE hv;                                                                \
+  uint32_t flags;                                                              \
+  uint32_t hop;                                                                \
+}
+
+#define HASH_HEAD(name, type, field)                                           \
+struct name {                                                                  \
+   struct _hash_ops_##type##_##field *ops;                                     \
+   struct {                                                                    \
+     struct type *nodes;                                                       \
+     unsigned n_buckets, n_items, upper_bound;                                 \
+     unsigned need_expand;                                                     \
+     unsigned generation;                                                      \
+     uint64_t expand_ns;                                                       \
+     _HASH_PROBE_FIELDS                                                        \
+     void *lock;                                                               \
+   } _HASH_HOPSCOTCH_SHARD_ALIGN shards[HASH_HOPSCOTCH_SHARDS];                \
+}
+
+#define _HASH_NODE_FILLED 0x1
+#define _HASH_NODE_EMPTY(node, field) ((node)->field.flags == 0)
+#define _HASH_NODE_FILL(node, field) ((node)->field.flags = _HASH_NODE_FILLED)
+#define _HASH_NODE_ERASE(node, field) ((node)->field.flags = 0)
+
+/*
+ * Whether a table has been made. Checked without locks, so shard arrays are
+ * published atomically and never reset to NULL whilst a table is in use
+ */
+#define _HASH_HOPSCOTCH_MADE(head)                                             \
+  (__atomic_load_n(&(head)->shards[0].nodes, __ATOMIC_RELAXED) != NULL)
+#define HASH_SHARD(head, hv) (&(head)->shards[_HASH_HOPSCOTCH_SHARD_IDX(hv)])
+#define _HASH_HOP_HOME(sh, h) ((unsigned)(h) & ((sh)->n_buckets - 1))
+#define _HASH_HOP_SLOT(sh, idx) (&(sh)->nodes[(idx) & ((sh)->n_buckets - 1)])
+
+/* Copies an element to a slot keeping the neighborhood of the slot */
+#define _HASH_HOP_COPY(dst, src, field) do {                                   \
+  uint32_t _hop = (dst)->field.hop;                                            \
+  memcpy((dst), (src), sizeof(*(dst)));                                        \
+  (dst)->field.hop = _hop;                                                     \
+  _HASH_NODE_FILL(dst, field);                                                 \
+} while(0)
+
+#define HASH_INSERT(head, type, field, elm) do {                               \
+  HASH_TYPE _hv;                                                               \
+  _hv = (head)->ops->hash_func((elm), (head)->ops->hashd);                     \
+  HASH_INSERT_HV(head, type, field, elm, _hv);                                 \
+} while(0)
+
+/*
+ * An existing element with the same key is replaced. An element that could
+ * not be placed is dropped, HASH_FIND_OR_INSERT reports that
+ */
+#define HASH_INSERT_HV(head, type, field, elm, h) do {                         \
+  HASH_TYPE _ihv = (h);                                                        \
+  struct type *_islot;                                                         \
+  if (!_HASH_HOPSCOTCH_MADE(head)) HASH_MAKE_TABLE(head);                      \
+  (elm)->field.hv = _ihv;                                                      \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                          \
+  HASH_FIND_BKT(head, HASH_SHARD(head, _ihv), type, field, _ihv, elm, _islot); \
+  if (_islot != NULL) _HASH_HOP_COPY(_islot, (elm), field);                    \
+  else _hash_op_##type##_##field##_hopscotch_add((head),                       \
+      HASH_SHARD(head, _ihv), (elm));                                          \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _ihv));                        \
+} while(0)
+
+/*
+ * Insert `elm` unless an element with the same key exists, `found` is set to
+ * the existing element (valid as HASH_FIND_ELT result) or to NULL if `elm` has
+ * been inserted. If `elm` could not be placed, `found` is set to `elm` itself
+ */
+#define HASH_FIND_OR_INSERT(head, type, field, elm, found) do {                \
+  HASH_TYPE _fohv;                                                             \
+  _fohv = (head)->ops->hash_func((elm), (head)->ops->hashd);                   \
+  _HASH_FIND_OR_INSERT_HOPSCOTCH(head, type, field, elm, _fohv, found, (void)0); \
+} while(0)
+
+#define HASH_FIND_OR_INSERT_HV(head, type, field, elm, h, found)               \
+  _HASH_FIND_OR_INSERT_HOPSCOTCH(head, type, field, elm, h, found, (void)0)
+
+/* Existing element is merged in place whilst its shard is locked */
+#define HASH_UPSERT(head, type, field, elm, merge_cb) do {                     \
+  HASH_TYPE _uhv;                                                              \
+  _uhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                    \
+  HASH_UPSERT_HV(head, type, field, elm, _uhv, merge_cb);                      \
+} while(0)
+
+#define HASH_UPSERT_HV(head, type, field, elm, h, merge_cb) do {               \
+  struct type *_uelt;                                                          \
+  _HASH_FIND_OR_INSERT_HOPSCOTCH(head, type, field, elm, h, _uelt,             \
+      (merge_cb)(_hslot, (elm)));                                              \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define _HASH_FIND_OR_INSERT_HOPSCOTCH(head, type, field, elm, h, found, on_found) do { \
+  HASH_TYPE _hv = (h);                                                         \
+  struct type *_hslot;                                                         \
+  if (!_HASH_HOPSCOTCH_MADE(head)) HASH_MAKE_TABLE(head);                      \
+  HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                           \
+  HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot);   \
+  if (_hslot != NULL) {                                                        \
+    on_found;                                                                  \
+    (found) = _hslot;                                                          \
+  }                                                                            \
+  else {                                                                       \
+    (elm)->field.hv = _hv;                                                     \
+    if (_hash_op_##type##_##field##_hopscotch_add((head),                      \
+        HASH_SHARD(head, _hv), (elm))) (found) = NULL;                         \
+    else (found) = (elm);                                                      \
+  }                                                                            \
+  HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+} while(0)
+
+/*
+ * Found element points to the storage of a shard, so it is valid merely until
+ * the next insertion to the same shard (that could hop it). Concurrent
+ * readers should use HASH_FIND_ELT_COPY instead.
+ */
+#define HASH_FIND_ELT(head, type, field, elm, found) do {                      \
+  if (!_HASH_HOPSCOTCH_MADE(head)) (found) = NULL;                             \
+  else {                                                                       \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_HV(head, type, field, elm, _fhv, found);                     \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_HV(head, type, field, elm, h, found) do {                \
+  if (!_HASH_HOPSCOTCH_MADE(head)) (found) = NULL;                             \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, found);  \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/*
+ * Copy the found element to `dst` whilst the shard is still locked, `found` is
+ * set to `dst` or to NULL if nothing has been found
+ */
+#define HASH_FIND_ELT_COPY(head, type, field, elm, dst, found) do {            \
+  if (!_HASH_HOPSCOTCH_MADE(head)) (found) = NULL;                             \
+  else {                                                                       \
+    HASH_TYPE _fhv;                                                            \
+    _fhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_FIND_ELT_COPY_HV(head, type, field, elm, _fhv, dst, found);           \
+  }                                                                            \
+} while(0)
+
+#define HASH_FIND_ELT_COPY_HV(head, type, field, elm, h, dst, found) do {      \
+  if (!_HASH_HOPSCOTCH_MADE(head)) (found) = NULL;                             \
+  else {                                                                       \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot;                                                       \
+    HASH_LOCK_NODE_READ(head, HASH_SHARD(head, _hv));                          \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (_hslot == NULL) (found) = NULL;                                        \
+    else {                                                                     \
+      memcpy((dst), _hslot, sizeof(*_hslot));                                  \
+      (found) = (dst);                                                         \
+    }                                                                          \
+    HASH_UNLOCK_NODE_READ(head, HASH_SHARD(head, _hv));                        \
+  }                                                                            \
+} while(0)
+
+/* The slot is freed and dropped from the neighborhood of its home slot */
+#define HASH_DELETE_ELT(head, type, field, elm) do {                           \
+  if (_HASH_HOPSCOTCH_MADE(head)) {                                            \
+    HASH_TYPE _dhv;                                                            \
+    _dhv = (head)->ops->hash_func((elm), (head)->ops->hashd);                  \
+    HASH_DELETE_ELT_HV(head, type, field, elm, _dhv);                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_DELETE_ELT_HV(head, type, field, elm, h) do {                     \
+  if (_HASH_HOPSCOTCH_MADE(head)) {                                            \
+    HASH_TYPE _hv = (h);                                                       \
+    struct type *_hslot, *_home;                                               \
+    HASH_LOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                         \
+    HASH_FIND_BKT(head, HASH_SHARD(head, _hv), type, field, _hv, elm, _hslot); \
+    if (_hslot != NULL) {                                                      \
+      _home = _HASH_HOP_SLOT(HASH_SHARD(head, _hv),                            \
+          _HASH_HOP_HOME(HASH_SHARD(head, _hv), _hv));                         \
+      _home->field.hop &= ~(1U << ((_hslot - _home) &                          \
+          (HASH_SHARD(head, _hv)->n_buckets - 1)));                            \
+      _HASH_NODE_ERASE(_hslot, field);                                         \
+      HASH_SHARD(head, _hv)->n_items --;                                       \
+    }                                                                          \
+    HASH_UNLOCK_NODE_WRITE(head, HASH_SHARD(head, _hv));                       \
+  }                                                                            \
+} while(0)
+
+#define HASH_CLEANUP_NODES(head, type, field, free_func) do {                  \
+  if (_HASH_HOPSCOTCH_MADE(head)) {                                            \
+    struct type *_bkt;                                                         \
+    for (unsigned _s = 0; _s < HASH_HOPSCOTCH_SHARDS; _s ++) {                 \
+      HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
+      for (unsigned _i = 0; _i < (head)->shards[_s].n_buckets; _i ++) {        \
+        _bkt = &(head)->shards[_s].nodes[_i];                                  \
+        if(!_HASH_NODE_EMPTY(_bkt, field) && (free_func) != NULL)              \
+          _hash_op_##type##_##field##_delete_node((free_func), _bkt);          \
+        _bkt->field.flags = 0;                                                 \
+        _bkt->field.hop = 0;                                                   \
+      }                                                                        \
+      (head)->shards[_s].n_items = 0;                                          \
+      HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                       \
+    }                                                                          \
+  }                                                                            \
+} while(0)
+
+#define HASH_DESTROY(head, type, field, free_func) do {                        \
+  HASH_CLEANUP_NODES(head, type, field, free_func);                            \
+  for (unsigned _s = 0; _s < HASH_HOPSCOTCH_SHARDS; _s ++) {                   \
+    if ((head)->shards[_s].nodes != NULL)                                      \
+      HASH_FREE_NODES((head), (head)->shards[_s].nodes,                        \
+          (head)->shards[_s].n_buckets);                                       \
+    if ((head)->shards[_s].lock && (head)->ops->lockn_destroy)                 \
+      (head)->ops->lockn_destroy((head)->shards[_s].lock, (head)->ops->locknd); \
+    memset(&(head)->shards[_s], 0, sizeof((head)->shards[_s]));                \
+  }                                                                            \
+} while(0)
+
+/*
+ * Sets `found` to the element with the same key or to NULL scanning the
+ * neighborhood bitmap of the home slot. The number of slots compared (plus
+ * the home slot itself) is sampled as the probe length.
+ */
+#define HASH_FIND_BKT(head, sh, type, field, h, elm, found) do {               \
+  unsigned _home = _HASH_HOP_HOME(sh, h), _probes = 1;                         \
+  uint32_t _hop = (sh)->nodes[_home].field.hop;                                \
+  struct type *_cur;                                                           \
+  (found) = NULL;                                                              \
+  for (; _hop != 0; _hop &= _hop - 1) {                                        \
+    _cur = _HASH_HOP_SLOT(sh, _home + __builtin_ctz(_hop));                    \
+    _probes ++;                                                                \
+    if (_cur->field.hv == (h) &&                                               \
+        (head)->ops->hash_cmp((elm), _cur, (head)->ops->hashd) == 0) {         \
+      (found) = _cur;                                                          \
+      break;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  _HASH_PROBE_SAMPLE(sh, _probes);                                             \
+} while(0)
+
+#define HASH_ALLOC_NODES(head, nodes, size) do {                               \
+  if ((head)->ops->alloc) (nodes) = (head)->ops->alloc(sizeof(*(nodes)) * (size), \
+      (head)->ops->allocd);                                                    \
+  else (nodes) = malloc(sizeof(*(nodes)) * (size));                            \
+  if ((nodes) != NULL) memset(nodes, 0, sizeof(*(nodes)) * (size));            \
+} while(0)
+
+#define HASH_FREE_NODES(head, nodes, size) do {                                \
+  if ((head)->ops->free) (head)->ops->free(sizeof(*(nodes)) * (size), (nodes), (head)->ops->allocd); \
+  else free(nodes);                                                            \
+} while(0)
+
+/* Doubles every shard, must not race with other operations on a shard */
+#define HASH_EXPAND_BUCKETS(head, type, field)                                 \
+do {                                                                           \
+  for (unsigned _s = 0; _s < HASH_HOPSCOTCH_SHARDS; _s ++) {                   \
+    HASH_LOCK_NODE_WRITE(head, &(head)->shards[_s]);                           \
+    _hash_op_##type##_##field##_hopscotch_expand((head), &(head)->shards[_s]); \
+    HASH_UNLOCK_NODE_WRITE(head, &(head)->shards[_s]);                         \
+  }                                                                            \
+} while(0)
+
+/*
+ * All shards are allocated at once, so the first insertion must not race with
+ * other operations. Call this macro explicitly before sharing a table between
+ * threads.
+ */
+#define HASH_MAKE_TABLE(head) do {                                             \
+  for (unsigned _s = 0; _s < HASH_HOPSCOTCH_SHARDS; _s ++) {                   \
+    (head)->shards[_s].n_buckets = HASH_INITIAL_NUM_BUCKETS;                   \
+    (head)->shards[_s].n_items = 0;                                            \
+    (head)->shards[_s].generation = 0;                                         \
+    (head)->shards[_s].expand_ns = 0;                                          \
+    HASH_UPPER_BOUND(&(head)->shards[_s]);                                     \
+    HASH_ALLOC_NODES((head), (head)->shards[_s].nodes,                         \
+        (head)->shards[_s].n_buckets);                                         \
+    if ((head)->ops->lockn_init)                                               \
+      (head)->shards[_s].lock = (head)->ops->lockn_init((head)->ops->locknd);  \
+  }                                                                            \
+} while(0)
+
+/*
+ * Fill hash_stats_t `st` locking one shard at a time. Probe length of an
+ * element is its distance from its home slot plus one and `chain_hist` counts
+ * home slots by the number of elements in their neighborhoods.
+ */
+#define HASH_STATS(head, type, field, st) do {                                 \
+  memset((st), 0, sizeof(*(st)));                                              \
+  if (_HASH_HOPSCOTCH_MADE(head)) {                                            \
+    for (unsigned _s = 0; _s < HASH_HOPSCOTCH_SHARDS; _s ++) {                 \
+      __typeof(&(head)->shards[0]) _sh = &(head)->shards[_s];                  \
+      HASH_LOCK_NODE_READ(head, _sh);                                          \
+      for (unsigned _i = 0; _i < _sh->n_buckets; _i ++) {                      \
+        struct type *_cur = &_sh->nodes[_i];                                   \
+        unsigned _dist;                                                        \
+        _HASH_STATS_HIST_ADD((st)->chain_hist,                                 \
+            __builtin_popcount(_cur->field.hop));                              \
+        if (_HASH_NODE_EMPTY(_cur, field)) {                                   \
+          (st)->empty_buckets ++;                                              \
+          continue;                                                            \
+        }                                                                      \
+        _dist = (_i - _HASH_HOP_HOME(_sh, _cur->field.hv)) &                   \
+            (_sh->n_buckets - 1);                                              \
+        _HASH_STATS_HIST_ADD((st)->probe_hist, _dist + 1);                     \
+        if (_dist + 1 > (st)->max_chain) (st)->max_chain = _dist + 1;          \
+        (st)->num_items ++;                                                    \
+      }                                                                        \
+      (st)->num_buckets += _sh->n_buckets;                                     \
+      (st)->expands += _sh->generation;                                        \
+      (st)->expand_ns += _sh->expand_ns;                                       \
+      _HASH_PROBE_COLLECT(_sh, st);                                            \
+      HASH_UNLOCK_NODE_READ(head, _sh);                                        \
+    }                                                                          \
+    (st)->load_factor = (double)(st)->num_items / (st)->num_buckets;           \
+  }                                                                            \
+} while(0)
+
+#define HASH_UPPER_BOUND(sh)                                                   \
+  ((sh)->upper_bound = ((sh)->n_buckets * HASH_HOPSCOTCH_MAX_LOAD + 0.5))
+
+/*
+ * Per type functions: placement of an element with hopping, shard expansion
+ * and insertion of a new element. Shards are passed as void pointers as every
+ * HASH_HEAD declares its own anonymous shard type.
+ */
+#define _HASH_GENERATE_ENGINE(type, field)                                     \
+    typedef __typeof(((HASH_HEAD(, type, field) *)0)->shards[0])               \
+        _hash_hopscotch_shard_##type##_##field;                                \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_hopscotch_place)(      \
+        void *_sh, struct type *elm)                                           \
+    {                                                                          \
+      _hash_hopscotch_shard_##type##_##field *sh = _sh;                        \
+      unsigned home = _HASH_HOP_HOME(sh, elm->field.hv), dist, range;          \
+      range = sh->n_buckets < HASH_HOPSCOTCH_ADD_RANGE ?                       \
+          sh->n_buckets : HASH_HOPSCOTCH_ADD_RANGE;                            \
+      for (dist = 0; dist < range; dist ++) {                                  \
+        if (_HASH_NODE_EMPTY(_HASH_HOP_SLOT(sh, home + dist), field)) break;   \
+      }                                                                        \
+      if (dist == range) return 0;                                             \
+      while (dist >= HASH_HOPSCOTCH_H) {                                       \
+        unsigned to = home + dist, back;                                       \
+        /* Move the closest element of the farthest home to the free slot */   \
+        for (back = HASH_HOPSCOTCH_H - 1; back > 0; back --) {                 \
+          struct type *b = _HASH_HOP_SLOT(sh, to - back);                      \
+          uint32_t hop = b->field.hop & ((1U << back) - 1);                    \
+          if (hop != 0) {                                                      \
+            unsigned i = __builtin_ctz(hop);                                   \
+            struct type *from = _HASH_HOP_SLOT(sh, to - back + i);             \
+            _HASH_HOP_COPY(_HASH_HOP_SLOT(sh, to), from, field);               \
+            b->field.hop = (b->field.hop & ~(1U << i)) | (1U << back);         \
+            _HASH_NODE_ERASE(from, field);                                     \
+            dist -= back - i;                                                  \
+            break;                                                             \
+          }                                                                    \
+        }                                                                      \
+        if (back == 0) return 0;                                               \
+      }                                                                        \
+      _HASH_HOP_COPY(_HASH_HOP_SLOT(sh, home + dist), elm, field);             \
+      _HASH_HOP_SLOT(sh, home)->field.hop |= 1U << dist;                       \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Doubles a shard until all its elements are placed, at most              \
+     * HASH_HOPSCOTCH_MAX_GROW times. 0 if they could not be placed            \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_hopscotch_expand)(     \
+        void *_head, void *_sh)                                                \
+    {                                                                          \
+      HASH_HEAD(, type, field) *head;                                          \
+      _hash_hopscotch_shard_##type##_##field *sh = _sh;                        \
+      struct type *old_nodes = sh->nodes, *nodes;                              \
+      unsigned old_num = sh->n_buckets, new_num = old_num, i, grow = 0;        \
+      uint64_t t0 = HASH_CLOCK_NS();                                           \
+      DECLTYPE_ASSIGN(head, _head);                                            \
+      for (;;) {                                                               \
+        new_num *= 2;                                                          \
+        if (grow ++ < HASH_HOPSCOTCH_MAX_GROW)                                 \
+          HASH_ALLOC_NODES(head, nodes, new_num);                              \
+        else nodes = NULL;              /* Give up as if out of memory */      \
+        if (nodes == NULL) {                                                   \
+          __atomic_store_n(&sh->nodes, old_nodes, __ATOMIC_RELAXED);           \
+          sh->n_buckets = old_num;                                             \
+          sh->need_expand = 0;                                                 \
+          return 0;                                                            \
+        }                                                                      \
+        __atomic_store_n(&sh->nodes, nodes, __ATOMIC_RELAXED);                 \
+        sh->n_buckets = new_num;                                               \
+        for (i = 0; i < old_num; i ++) {                                       \
+          if (_HASH_NODE_EMPTY(&old_nodes[i], field)) continue;                \
+          if (!_hash_op_##type##_##field##_hopscotch_place(sh, &old_nodes[i])) \
+            break;                                                             \
+        }                                                                      \
+        if (i == old_num) break;                                               \
+        HASH_FREE_NODES(head, nodes, new_num);                                 \
+      }                                                                        \
+      HASH_FREE_NODES(head, old_nodes, old_num);                               \
+      sh->generation ++;                                                       \
+      t0 = HASH_CLOCK_NS() - t0;                                               \
+      sh->expand_ns += t0;                                                     \
+      if (head->ops->on_expand) head->ops->on_expand(old_num, new_num,         \
+          sh->n_items, t0, head->ops->expandd);                                \
+      HASH_UPPER_BOUND(sh);                                                    \
+      sh->need_expand = 0;                                                     \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Whether the neighborhood of the home slot of `h` holds merely elements  \
+     * with hash value `h`, which stay there however many times a shard is     \
+     * doubled                                                                 \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_hopscotch_full)(       \
+        void *_sh, HASH_TYPE h)                                                \
+    {                                                                          \
+      _hash_hopscotch_shard_##type##_##field *sh = _sh;                        \
+      unsigned home = _HASH_HOP_HOME(sh, h);                                   \
+      if (sh->n_buckets < HASH_HOPSCOTCH_H ||                                  \
+          _HASH_HOP_SLOT(sh, home)->field.hop != 0xffffffffU) return 0;        \
+      for (unsigned d = 0; d < HASH_HOPSCOTCH_H; d ++) {                       \
+        if (_HASH_HOP_SLOT(sh, home + d)->field.hv != h) return 0;             \
+      }                                                                        \
+      return 1;                                                                \
+    }                                                                          \
+    /*                                                                         \
+     * Adds a new element to a locked shard, 0 if it could not be placed after \
+     * HASH_HOPSCOTCH_MAX_GROW doublings (or at once if doubling could not     \
+     * help) or if out of memory                                               \
+     */                                                                        \
+    static int _HU_FUNCTION(_hash_op_##type##_##field##_hopscotch_add)(        \
+        void *_head, void *_sh, struct type *elm)                              \
+    {                                                                          \
+      _hash_hopscotch_shard_##type##_##field *sh = _sh;                        \
+      unsigned grow = 0;                                                       \
+      while (!_hash_op_##type##_##field##_hopscotch_place(sh, elm)) {          \
+        if (grow ++ == HASH_HOPSCOTCH_MAX_GROW ||                              \
+            _hash_op_##type##_##field##_hopscotch_full(sh, elm->field.hv))     \
+          return 0;                                                            \
+        sh->need_expand = 1;                                                   \
+        if (!_hash_op_##type##_##field##_hopscotch_expand(_head, sh)) return 0; \
+      }                                                                        \
+      if (++ sh->n_items >= sh->upper_bound) {                                 \
+        sh->need_expand = 1;                                                   \
+        _hash_op_##type##_##field##_hopscotch_expand(_head, sh);               \
+      }                                                                        \
+      return 1;                                                                \
+    }
+
+#endif /* HASH_HOPSCOTCH_H_ */
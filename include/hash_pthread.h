@@ -26,6 +26,11 @@
 #define HASH_PTHREAD_H_
 
 #include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 #ifndef _HU
 # ifdef __GNUC__
@@ -61,6 +66,7 @@
     (head)->ops->lock_destroy = &_hash_pthread_rwlock_dtor_##type##_##field;   \
     (head)->ops->lockn_init = &_hash_pthread_rwlock_init_##type##_##field;     \
     (head)->ops->lockn_write_lock = &_hash_pthread_rwlock_wlock_##type##_##field; \
+    (head)->ops->lockn_write_trylock = &_hash_pthread_rwlock_trywlock_##type##_##field; \
     (head)->ops->lockn_read_lock = &_hash_pthread_rwlock_rlock_##type##_##field; \
     (head)->ops->lockn_read_unlock = &_hash_pthread_rwlock_unlock_##type##_##field; \
     (head)->ops->lockn_write_unlock = &_hash_pthread_rwlock_unlock_##type##_##field; \
@@ -85,6 +91,7 @@
     (head)->ops->lock_destroy = &_hash_pthread_rwlock_dtor_##type##_##field;   \
     (head)->ops->lockn_init = &_hash_pthread_rwlock_init_##type##_##field;     \
     (head)->ops->lockn_write_lock = &_hash_pthread_mtx_lock_##type##_##field;  \
+    (head)->ops->lockn_write_trylock = &_hash_pthread_mtx_trylock_##type##_##field; \
     (head)->ops->lockn_read_lock = &_hash_pthread_mtx_lock_##type##_##field;   \
     (head)->ops->lockn_read_unlock = &_hash_pthread_mtx_unlock_##type##_##field; \
     (head)->ops->lockn_write_unlock = &_hash_pthread_mtx_unlock_##type##_##field; \
@@ -94,6 +101,434 @@
 } while(0)
 
 
+/*
+ * Profiling variants of the locks above. Each lock is tried first, and only
+ * if it is busy the time spent waiting for it is measured and added to the
+ * counters of its class: `global` for the resize lock and `bucket` for node
+ * (or closed table shard) locks. Uncontended locking costs one try-lock, the
+ * same as a plain lock. Per-lock counters are kept as well, so
+ * HASH_PTHREAD_PROF_COLLECT could find the most contended buckets. Node locks
+ * are recreated by expansion, so their counters start over on each resize.
+ */
+#ifndef HASH_PTHREAD_PROF_TOPK
+#define HASH_PTHREAD_PROF_TOPK 8
+#endif
+
+typedef struct hash_pthread_prof_class_s {
+  uint64_t waits;
+  uint64_t wait_ns;
+  uint64_t max_wait_ns;
+} hash_pthread_prof_class_t;
+
+typedef struct hash_pthread_prof_s {
+  hash_pthread_prof_class_t global;
+  hash_pthread_prof_class_t bucket;
+  struct {
+    unsigned bucket;
+    unsigned waits;
+    uint64_t wait_ns;
+  } top[HASH_PTHREAD_PROF_TOPK];
+  unsigned ntop;
+} hash_pthread_prof_t;
+
+typedef struct _hash_pthread_prof_lock_s {
+  union {
+    pthread_rwlock_t rw;
+    pthread_mutex_t mtx;
+  } l;
+  unsigned waits;
+  uint64_t wait_ns;
+} _hash_pthread_prof_lock_t;
+
+#define HASH_INIT_PTHREAD_PROF_RWLOCK(head, prof) do {                         \
+    (head)->ops->lock_init = &_hash_pthread_prof_rwlock_init;                  \
+    (head)->ops->lock_read_lock = &_hash_pthread_prof_rwlock_rlock;            \
+    (head)->ops->lock_write_lock = &_hash_pthread_prof_rwlock_wlock;           \
+    (head)->ops->lock_read_unlock = &_hash_pthread_prof_rwlock_unlock;         \
+    (head)->ops->lock_write_unlock = &_hash_pthread_prof_rwlock_unlock;        \
+    (head)->ops->lock_destroy = &_hash_pthread_prof_rwlock_dtor;               \
+    (head)->ops->lockn_init = &_hash_pthread_prof_rwlock_init;                 \
+    (head)->ops->lockn_write_lock = &_hash_pthread_prof_rwlock_wlock;          \
+    (head)->ops->lockn_write_trylock = &_hash_pthread_prof_rwlock_trywlock;    \
+    (head)->ops->lockn_read_lock = &_hash_pthread_prof_rwlock_rlock;           \
+    (head)->ops->lockn_read_unlock = &_hash_pthread_prof_rwlock_unlock;        \
+    (head)->ops->lockn_write_unlock = &_hash_pthread_prof_rwlock_unlock;       \
+    (head)->ops->lockn_destroy = &_hash_pthread_prof_rwlock_dtor;              \
+    (head)->ops->lockd = &(prof)->global;                                      \
+    (head)->ops->locknd = &(prof)->bucket;                                     \
+} while(0)
+
+#define HASH_INIT_PTHREAD_PROF_MUTEX(head, prof) do {                          \
+    (head)->ops->lock_init = &_hash_pthread_prof_rwlock_init;                  \
+    (head)->ops->lock_read_lock = &_hash_pthread_prof_rwlock_rlock;            \
+    (head)->ops->lock_write_lock = &_hash_pthread_prof_rwlock_wlock;           \
+    (head)->ops->lock_read_unlock = &_hash_pthread_prof_rwlock_unlock;         \
+    (head)->ops->lock_write_unlock = &_hash_pthread_prof_rwlock_unlock;        \
+    (head)->ops->lock_destroy = &_hash_pthread_prof_rwlock_dtor;               \
+    (head)->ops->lockn_init = &_hash_pthread_prof_mtx_init;                    \
+    (head)->ops->lockn_write_lock = &_hash_pthread_prof_mtx_lock;              \
+    (head)->ops->lockn_write_trylock = &_hash_pthread_prof_mtx_trylock;        \
+    (head)->ops->lockn_read_lock = &_hash_pthread_prof_mtx_lock;               \
+    (head)->ops->lockn_read_unlock = &_hash_pthread_prof_mtx_unlock;           \
+    (head)->ops->lockn_write_unlock = &_hash_pthread_prof_mtx_unlock;          \
+    (head)->ops->lockn_destroy = &_hash_pthread_prof_mtx_dtor;                 \
+    (head)->ops->lockd = &(prof)->global;                                      \
+    (head)->ops->locknd = &(prof)->bucket;                                     \
+} while(0)
+
+static uint64_t _HU_FUNCTION(_hash_pthread_clock_ns)(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Called with the lock acquired after waiting since `start` */
+static void _HU_FUNCTION(_hash_pthread_prof_wait)(_hash_pthread_prof_lock_t *pl,
+    hash_pthread_prof_class_t *cls, uint64_t start)
+{
+  uint64_t ns = _hash_pthread_clock_ns() - start, max;
+
+  __atomic_fetch_add(&pl->waits, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pl->wait_ns, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&cls->waits, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&cls->wait_ns, ns, __ATOMIC_RELAXED);
+  max = __atomic_load_n(&cls->max_wait_ns, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&cls->max_wait_ns, &max, ns,
+      1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void* _HU_FUNCTION(_hash_pthread_prof_rwlock_init)(void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl;
+
+  pl = calloc(1, sizeof(*pl));
+  if (pl != NULL) pthread_rwlock_init(&pl->l.rw, NULL);
+  return (void *)pl;
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_rwlock_rlock)(void *m, void *d)
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  if (pthread_rwlock_tryrdlock(&pl->l.rw) != 0) {
+    uint64_t start = _hash_pthread_clock_ns();
+    pthread_rwlock_rdlock(&pl->l.rw);
+    _hash_pthread_prof_wait(pl, d, start);
+  }
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_rwlock_wlock)(void *m, void *d)
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  if (pthread_rwlock_trywrlock(&pl->l.rw) != 0) {
+    uint64_t start = _hash_pthread_clock_ns();
+    pthread_rwlock_wrlock(&pl->l.rw);
+    _hash_pthread_prof_wait(pl, d, start);
+  }
+}
+
+/* A failed try is not a wait, so it is not counted */
+static int _HU_FUNCTION(_hash_pthread_prof_rwlock_trywlock)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  return pthread_rwlock_trywrlock(&pl->l.rw);
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_rwlock_unlock)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  pthread_rwlock_unlock(&pl->l.rw);
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_rwlock_dtor)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  pthread_rwlock_destroy(&pl->l.rw);
+  free(pl);
+}
+
+static void* _HU_FUNCTION(_hash_pthread_prof_mtx_init)(void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl;
+
+  pl = calloc(1, sizeof(*pl));
+  if (pl != NULL) pthread_mutex_init(&pl->l.mtx, NULL);
+  return (void *)pl;
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_mtx_lock)(void *m, void *d)
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  if (pthread_mutex_trylock(&pl->l.mtx) != 0) {
+    uint64_t start = _hash_pthread_clock_ns();
+    pthread_mutex_lock(&pl->l.mtx);
+    _hash_pthread_prof_wait(pl, d, start);
+  }
+}
+
+static int _HU_FUNCTION(_hash_pthread_prof_mtx_trylock)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  return pthread_mutex_trylock(&pl->l.mtx);
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_mtx_unlock)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  pthread_mutex_unlock(&pl->l.mtx);
+}
+
+static void _HU_FUNCTION(_hash_pthread_prof_mtx_dtor)(void *m, void* _HU(d))
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+
+  pthread_mutex_destroy(&pl->l.mtx);
+  free(pl);
+}
+
+/* Keeps `prof->top` sorted by the number of waits */
+static void _HU_FUNCTION(_hash_pthread_prof_top_add)(hash_pthread_prof_t *prof,
+    unsigned idx, void *m)
+{
+  _hash_pthread_prof_lock_t *pl = (_hash_pthread_prof_lock_t *)m;
+  unsigned waits, pos;
+
+  if (pl == NULL) return;
+  waits = __atomic_load_n(&pl->waits, __ATOMIC_RELAXED);
+  if (waits == 0) return;
+  pos = prof->ntop;
+  while (pos > 0 && prof->top[pos - 1].waits < waits) pos --;
+  if (pos >= HASH_PTHREAD_PROF_TOPK) return;
+  if (prof->ntop < HASH_PTHREAD_PROF_TOPK) prof->ntop ++;
+  memmove(&prof->top[pos + 1], &prof->top[pos],
+      sizeof(prof->top[0]) * (prof->ntop - pos - 1));
+  prof->top[pos].bucket = idx;
+  prof->top[pos].waits = waits;
+  prof->top[pos].wait_ns = __atomic_load_n(&pl->wait_ns, __ATOMIC_RELAXED);
+}
+
+/*
+ * Fill `prof->top` with the most contended buckets of a table (shards for
+ * closed, cuckoo and hopscotch tables, pages for extendible ones). The table
+ * is not modified, so this could be called at any time, e.g. right before
+ * hash_pthread_prof_dump
+ */
+#if defined(_HASH_USE_CLOSED) || defined(_HASH_USE_CUCKOO) ||                \
+    defined(_HASH_USE_HOPSCOTCH)
+#define HASH_PTHREAD_PROF_COLLECT(head, prof) do {                             \
+  (prof)->ntop = 0;                                                            \
+  for (unsigned _s = 0; _s < sizeof((head)->shards) /                          \
+      sizeof((head)->shards[0]); _s ++)                                        \
+    _hash_pthread_prof_top_add((prof), _s, (head)->shards[_s].lock);           \
+} while(0)
+#elif defined(_HASH_USE_EXTENDIBLE)
+/* Pages are reported by their first directory slot */
+#define HASH_PTHREAD_PROF_COLLECT(head, prof) do {                             \
+  (prof)->ntop = 0;                                                            \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->dir != NULL) {                                                   \
+    for (unsigned _i = 0; _i < (1U << (head)->depth); _i ++) {                 \
+      if (_HASH_EXT_PAGE_FIRST((head)->dir[_i], _i))                           \
+        _hash_pthread_prof_top_add((prof), _i, (head)->dir[_i]->lock);         \
+    }                                                                          \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+#else
+#define HASH_PTHREAD_PROF_COLLECT(head, prof) do {                             \
+  (prof)->ntop = 0;                                                            \
+  HASH_LOCK_READ(head);                                                        \
+  if ((head)->buckets != NULL) {                                               \
+    for (unsigned _i = 0; _i < (head)->num_buckets; _i ++)                     \
+      _hash_pthread_prof_top_add((prof), _i, (head)->buckets[_i].lock);        \
+  }                                                                            \
+  HASH_UNLOCK_READ(head);                                                      \
+} while(0)
+#endif
+
+/* Print counters as `key=value` lines, one line per lock class or bucket */
+static void _HU_FUNCTION(hash_pthread_prof_dump)(hash_pthread_prof_t *prof,
+    FILE *out)
+{
+  hash_pthread_prof_class_t *cls[] = { &prof->global, &prof->bucket };
+  const char *names[] = { "global", "bucket" };
+
+  for (unsigned i = 0; i < 2; i ++) {
+    fprintf(out, "class=%s waits=%llu wait_ns=%llu max_wait_ns=%llu\n",
+        names[i],
+        (unsigned long long)__atomic_load_n(&cls[i]->waits, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&cls[i]->wait_ns, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&cls[i]->max_wait_ns,
+            __ATOMIC_RELAXED));
+  }
+  for (unsigned i = 0; i < prof->ntop; i ++) {
+    fprintf(out, "bucket=%u waits=%u wait_ns=%llu\n", prof->top[i].bucket,
+        prof->top[i].waits, (unsigned long long)prof->top[i].wait_ns);
+  }
+}
+
+/*
+ * Worker pool used by `ops->parallel_for`. A pool runs a single job at a time:
+ * `[0, n)` is split to chunks that are picked by workers and by the calling
+ * thread. A job must not start another job on the same pool.
+ */
+#ifndef HASH_PTHREAD_POOL_MIN_CHUNK
+#define HASH_PTHREAD_POOL_MIN_CHUNK 1024
+#endif
+
+typedef struct _hash_pthread_pool_s {
+  pthread_mutex_t mtx;
+  pthread_mutex_t run_mtx;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  pthread_t *threads;
+  unsigned nthreads;
+  unsigned generation;
+  int stop;
+  void (*fn)(void *arg, size_t start, size_t end);
+  void *arg;
+  size_t n, chunk, next, done;
+} hash_pthread_pool_t;
+
+/* Claims the next chunk of job `gen`, called with pool mutex held */
+static int _HU_FUNCTION(_hash_pthread_pool_claim)(hash_pthread_pool_t *pool,
+    unsigned gen, size_t *start, size_t *end)
+{
+  if (pool->generation != gen || pool->next >= pool->n) return 0;
+  *start = pool->next;
+  *end = *start + pool->chunk < pool->n ? *start + pool->chunk : pool->n;
+  pool->next = *end;
+  return 1;
+}
+
+static void _HU_FUNCTION(_hash_pthread_pool_run)(hash_pthread_pool_t *pool,
+    unsigned gen)
+{
+  size_t start, end;
+  void (*fn)(void *arg, size_t start, size_t end) = pool->fn;
+  void *arg = pool->arg;
+
+  while (_hash_pthread_pool_claim(pool, gen, &start, &end)) {
+    pthread_mutex_unlock(&pool->mtx);
+    fn(arg, start, end);
+    pthread_mutex_lock(&pool->mtx);
+    pool->done += end - start;
+    if (pool->done == pool->n) pthread_cond_signal(&pool->done_cond);
+  }
+}
+
+static void * _HU_FUNCTION(_hash_pthread_pool_worker)(void *p)
+{
+  hash_pthread_pool_t *pool = (hash_pthread_pool_t *)p;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&pool->mtx);
+  for (;;) {
+    while (pool->generation == seen && !pool->stop) {
+      pthread_cond_wait(&pool->work_cond, &pool->mtx);
+    }
+    if (pool->stop) break;
+    seen = pool->generation;
+    _hash_pthread_pool_run(pool, seen);
+  }
+  pthread_mutex_unlock(&pool->mtx);
+
+  return NULL;
+}
+
+/* Creates a pool of `nthreads` workers, the calling thread is not counted */
+static hash_pthread_pool_t * _HU_FUNCTION(hash_pthread_pool_create)(unsigned nthreads)
+{
+  hash_pthread_pool_t *pool;
+
+  pool = calloc(1, sizeof(*pool));
+  if (pool == NULL) return NULL;
+  pool->threads = calloc(nthreads ? nthreads : 1, sizeof(pthread_t));
+  if (pool->threads == NULL) {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->mtx, NULL);
+  pthread_mutex_init(&pool->run_mtx, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  for (unsigned i = 0; i < nthreads; i ++) {
+    if (pthread_create(&pool->threads[i], NULL, _hash_pthread_pool_worker,
+        pool) != 0) break;
+    pool->nthreads ++;
+  }
+
+  return pool;
+}
+
+static void _HU_FUNCTION(hash_pthread_pool_destroy)(hash_pthread_pool_t *pool)
+{
+  if (pool == NULL) return;
+  pthread_mutex_lock(&pool->mtx);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mtx);
+  for (unsigned i = 0; i < pool->nthreads; i ++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_mutex_destroy(&pool->mtx);
+  pthread_mutex_destroy(&pool->run_mtx);
+  free(pool->threads);
+  free(pool);
+}
+
+static void _HU_FUNCTION(_hash_pthread_parallel_for)(size_t n,
+    void (*fn)(void *arg, size_t start, size_t end), void *arg, void *d)
+{
+  hash_pthread_pool_t *pool = (hash_pthread_pool_t *)d;
+  size_t chunk;
+
+  if (n == 0) return;
+  if (pool == NULL || pool->nthreads == 0 || n <= HASH_PTHREAD_POOL_MIN_CHUNK) {
+    fn(arg, 0, n);
+    return;
+  }
+  /* Several chunks per thread to balance uneven chains */
+  chunk = n / ((pool->nthreads + 1) * 4);
+  if (chunk < HASH_PTHREAD_POOL_MIN_CHUNK) chunk = HASH_PTHREAD_POOL_MIN_CHUNK;
+
+  pthread_mutex_lock(&pool->run_mtx);
+  pthread_mutex_lock(&pool->mtx);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->n = n;
+  pool->chunk = chunk;
+  pool->next = 0;
+  pool->done = 0;
+  pool->generation ++;
+  if (pool->generation == 0) pool->generation ++;
+  pthread_cond_broadcast(&pool->work_cond);
+  _hash_pthread_pool_run(pool, pool->generation);
+  while (pool->done < pool->n) {
+    pthread_cond_wait(&pool->done_cond, &pool->mtx);
+  }
+  pthread_mutex_unlock(&pool->mtx);
+  pthread_mutex_unlock(&pool->run_mtx);
+}
+
+/*
+ * Use a worker pool for the bulk operations of a table, e.g. expansion
+ */
+#define HASH_INIT_PTHREAD_POOL(head, pool) do {                                \
+    (head)->ops->parallel_for = &_hash_pthread_parallel_for;                   \
+    (head)->ops->paralleld = (pool);                                           \
+} while(0)
+
 /*
  * Generate all pthread helpers for the specified hash type
  */
@@ -108,6 +543,10 @@
     pthread_mutex_t *mtx = (pthread_mutex_t *)m;                               \
     pthread_mutex_lock(mtx);                                                   \
   }                                                                            \
+  static int _HU_FUNCTION(_hash_pthread_mtx_trylock_##type##_##field)(void *m, void* _HU(d)) {    \
+    pthread_mutex_t *mtx = (pthread_mutex_t *)m;                               \
+    return pthread_mutex_trylock(mtx);                                         \
+  }                                                                            \
   static void _HU_FUNCTION(_hash_pthread_mtx_unlock_##type##_##field)(void *m, void* _HU(d)) {    \
     pthread_mutex_t *mtx = (pthread_mutex_t *)m;                               \
     pthread_mutex_unlock(mtx);                                                 \
@@ -131,6 +570,10 @@
     pthread_rwlock_t *rwlck = (pthread_rwlock_t *)m;                           \
     pthread_rwlock_wrlock(rwlck);                                              \
   }                                                                            \
+  static int _HU_FUNCTION(_hash_pthread_rwlock_trywlock_##type##_##field)(void *m, void* _HU(d)) { \
+    pthread_rwlock_t *rwlck = (pthread_rwlock_t *)m;                           \
+    return pthread_rwlock_trywrlock(rwlck);                                    \
+  }                                                                            \
   static void _HU_FUNCTION(_hash_pthread_rwlock_unlock_##type##_##field)(void *m, void* _HU(d)) { \
     pthread_rwlock_t *rwlck = (pthread_rwlock_t *)m;                           \
     pthread_rwlock_unlock(rwlck);                                              \
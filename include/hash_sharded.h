@@ -0,0 +1,194 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_SHARDED_H_
+#define HASH_SHARDED_H_
+
+#include "hash.h"
+
+#ifndef _HASH_USE_CHAINED
+#error "hash_sharded.h works with the chained table only"
+#endif
+
+/*
+ * Sharded front-end for the chained table. Elements are routed to one of
+ * `nshards` independent tables by the top bits of a hash value, whilst the low
+ * bits still select a bucket inside of a shard. Each shard has its own resize
+ * lock and expands on its own, so a resize stalls 1/nshards of the keyspace.
+ * `nshards` must be a power of two.
+ *
+ * All shards share the ops structure of a type, so locking is set up once via
+ * the first shard:
+ *
+ *   HASH_SHARDED_INIT(&head, node, hh);
+ *   HASH_INIT_PTHREAD_RWLOCK(HASH_SHARDED_SUB(&head, 0), node, hh);
+ *   HASH_SHARDED_MAKE_TABLE(&head);
+ */
+
+#ifndef HASH_SHARD_CACHELINE
+#define HASH_SHARD_CACHELINE 64
+#endif
+
+#ifdef __GNUC__
+#define _HASH_SHARD_ALIGN __attribute__((aligned(HASH_SHARD_CACHELINE)))
+#else
+#define _HASH_SHARD_ALIGN
+#endif
+
+#define HASH_SHARDED_HEAD(name, type, field, nshards)                          \
+  struct name {                                                                \
+    HASH_HEAD(, type, field) _HASH_SHARD_ALIGN shards[nshards];                \
+    unsigned shard_bits;                                                       \
+  }
+
+#define HASH_SHARDED_NSHARDS(head)                                             \
+  (sizeof((head)->shards) / sizeof((head)->shards[0]))
+
+#define HASH_SHARDED_SUB(head, i) (&(head)->shards[(i)])
+
+#define HASH_SHARDED_IDX(head, hv)                                             \
+  ((head)->shard_bits == 0 ? 0 :                                               \
+    (unsigned)((hv) >> (sizeof(HASH_TYPE) * 8 - (head)->shard_bits)))
+
+#define HASH_SHARDED_INIT(head, type, field) do {                              \
+  unsigned _nsh = HASH_SHARDED_NSHARDS(head);                                  \
+  for (unsigned _s = 0; _s < _nsh; _s ++) {                                    \
+    HASH_INIT(HASH_SHARDED_SUB(head, _s), type, field);                        \
+  }                                                                            \
+  (head)->shard_bits = 0;                                                      \
+  while ((1U << (head)->shard_bits) < _nsh) (head)->shard_bits ++;             \
+} while(0)
+
+/*
+ * Allocates all shards. Should be called prior to sharing of the table between
+ * threads
+ */
+#define HASH_SHARDED_MAKE_TABLE(head) do {                                     \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    HASH_MAKE_TABLE(HASH_SHARDED_SUB(head, _s));                               \
+  }                                                                            \
+} while(0)
+
+#define HASH_SHARDED_INSERT(head, type, field, elm) do {                       \
+  HASH_TYPE _shv;                                                              \
+  if ((head)->shards[0].buckets == NULL) HASH_SHARDED_MAKE_TABLE(head);        \
+  _shv = (head)->shards[0].ops->hash_func((elm), (head)->shards[0].ops->hashd); \
+  HASH_INSERT_HV(HASH_SHARDED_SUB(head, HASH_SHARDED_IDX(head, _shv)),         \
+      type, field, elm, _shv);                                                 \
+} while(0)
+
+#define HASH_SHARDED_FIND_OR_INSERT(head, type, field, elm, found) do {        \
+  HASH_TYPE _shv;                                                              \
+  if ((head)->shards[0].buckets == NULL) HASH_SHARDED_MAKE_TABLE(head);        \
+  _shv = (head)->shards[0].ops->hash_func((elm), (head)->shards[0].ops->hashd); \
+  _HASH_FIND_OR_INSERT_HV(HASH_SHARDED_SUB(head, HASH_SHARDED_IDX(head, _shv)), \
+      type, field, elm, _shv, found, (void)0);                                 \
+} while(0)
+
+#define HASH_SHARDED_UPSERT(head, type, field, elm, merge_cb) do {             \
+  HASH_TYPE _shv;                                                              \
+  struct type *_uelt;                                                          \
+  if ((head)->shards[0].buckets == NULL) HASH_SHARDED_MAKE_TABLE(head);        \
+  _shv = (head)->shards[0].ops->hash_func((elm), (head)->shards[0].ops->hashd); \
+  _HASH_FIND_OR_INSERT_HV(HASH_SHARDED_SUB(head, HASH_SHARDED_IDX(head, _shv)), \
+      type, field, elm, _shv, _uelt, (merge_cb)(_telt, (elm)));                \
+  (void)_uelt;                                                                 \
+} while(0)
+
+#define HASH_SHARDED_FIND_ELT(head, type, field, elm, found) do {              \
+  HASH_TYPE _shv;                                                              \
+  _shv = (head)->shards[0].ops->hash_func((elm), (head)->shards[0].ops->hashd); \
+  HASH_FIND_ELT_HV(HASH_SHARDED_SUB(head, HASH_SHARDED_IDX(head, _shv)),       \
+      type, field, elm, _shv, found);                                          \
+} while(0)
+
+#define HASH_SHARDED_DELETE_ELT(head, type, field, elm) do {                   \
+  HASH_TYPE _shv;                                                              \
+  _shv = (head)->shards[0].ops->hash_func((elm), (head)->shards[0].ops->hashd); \
+  HASH_DELETE_ELT_HV(HASH_SHARDED_SUB(head, HASH_SHARDED_IDX(head, _shv)),     \
+      type, field, elm, _shv);                                                 \
+} while(0)
+
+/* Shards are visited one by one, `func` returning 0 stops the whole walk */
+#define HASH_SHARDED_ITERATE_FUNC(head, type, field, func, data) do {          \
+  int _sfinished = 0;                                                          \
+  for (unsigned _s = 0; !_sfinished && _s < HASH_SHARDED_NSHARDS(head); _s ++) { \
+    __typeof__(&(head)->shards[0]) _sub = HASH_SHARDED_SUB(head, _s);          \
+    if (_sub->buckets == NULL) continue;                                       \
+    HASH_LOCK_READ(_sub);                                                      \
+    for (unsigned _i = 0; !_sfinished && _i < _sub->num_buckets; _i ++) {      \
+      _hash_node_t *_node = &_sub->buckets[_i];                                \
+      if (_node->first) {                                                      \
+        HASH_LOCK_NODE_READ(_sub, _node);                                      \
+        struct type *_cur = (struct type *)_node->first;                       \
+        while (_cur != NULL && !_sfinished) {                                  \
+          if (!(func)(_cur, data)) _sfinished = 1;                             \
+          _cur = _cur->field.next;                                             \
+        }                                                                      \
+        HASH_UNLOCK_NODE_READ(_sub, _node);                                    \
+      }                                                                        \
+    }                                                                          \
+    HASH_UNLOCK_READ(_sub);                                                    \
+  }                                                                            \
+} while(0)
+
+#define HASH_SHARDED_FILTER_FUNC(head, type, field, func, free_func, data) do { \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    if ((head)->shards[_s].buckets == NULL) continue;                          \
+    HASH_FILTER_FUNC(HASH_SHARDED_SUB(head, _s), type, field, func,            \
+        free_func, data);                                                      \
+  }                                                                            \
+} while(0)
+
+/* `cnt` is set to the number of elements of all shards */
+#define HASH_SHARDED_COUNT(head, cnt) do {                                     \
+  unsigned _cnt = 0;                                                           \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    _cnt += __atomic_load_n(&(head)->shards[_s].num_items, __ATOMIC_RELAXED);  \
+  }                                                                            \
+  (cnt) = _cnt;                                                                \
+} while(0)
+
+/* Statistics of all shards are merged, each shard is walked separately */
+#define HASH_SHARDED_STATS(head, type, field, st) do {                         \
+  hash_stats_t _sst;                                                           \
+  memset((st), 0, sizeof(*(st)));                                              \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    HASH_STATS(HASH_SHARDED_SUB(head, _s), type, field, &_sst);                \
+    hash_stats_merge((st), &_sst);                                             \
+  }                                                                            \
+} while(0)
+
+#define HASH_SHARDED_CLEANUP_NODES(head, type, field, free_func) do {          \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    HASH_CLEANUP_NODES(HASH_SHARDED_SUB(head, _s), type, field, free_func);    \
+  }                                                                            \
+} while(0)
+
+#define HASH_SHARDED_DESTROY(head, type, field, free_func) do {                \
+  for (unsigned _s = 0; _s < HASH_SHARDED_NSHARDS(head); _s ++) {              \
+    if ((head)->shards[_s].buckets == NULL) continue;                          \
+    HASH_DESTROY(HASH_SHARDED_SUB(head, _s), type, field, free_func);          \
+  }                                                                            \
+} while(0)
+
+#endif /* HASH_SHARDED_H_ */
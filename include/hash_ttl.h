@@ -0,0 +1,363 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef HASH_TTL_H_
+#define HASH_TTL_H_
+
+#include "hash.h"
+
+#if !defined(_HASH_USE_CHAINED) || defined(_HASH_USE_CHAINED_LOCKFREE)
+#error "hash_ttl.h works with the locked chained table only"
+#endif
+
+/*
+ * Per-element expiration for the chained table. Every element has a deadline
+ * in ticks of a caller's clock (e.g. milliseconds) and is linked to one of
+ * hierarchical timer wheels: level `l` has HASH_TTL_SLOTS slots of
+ * `HASH_TTL_SLOTS^l` ticks, and slots of upper levels are cascaded to lower
+ * ones as time goes. HASH_TTL_EXPIRE visits only slots whose time has come,
+ * so it costs the expired elements plus a step per HASH_TTL_SLOTS ticks, and
+ * expired elements are unlinked from the table under their bucket locks.
+ *
+ * Wheels are sharded by the top bits of hash values and locked by node locks
+ * of the table. Every removal of an element happens under the lock of its
+ * wheel, so elements must be inserted and deleted by HASH_TTL_* only:
+ *
+ *   HASH_TTL_GENERATE(node, hh, ttl);
+ *   HASH_TTL_HEAD(, node, hh) head;
+ *   ...
+ *   HASH_TTL_INIT(&head, node, hh, node_free);
+ *   HASH_INIT_PTHREAD_RWLOCK(HASH_TTL_TABLE(&head), node, hh);
+ *   HASH_TTL_MAKE_TABLE(&head, now);
+ *   HASH_TTL_INSERT(&head, node, hh, ttl, elt, now + 5000, found);
+ *   HASH_TTL_EXPIRE(&head, node, hh, ttl, now, expired);
+ */
+
+#ifndef HASH_TTL_SLOTS_LOG2
+#define HASH_TTL_SLOTS_LOG2 6
+#endif
+#ifndef HASH_TTL_LEVELS
+#define HASH_TTL_LEVELS 4
+#endif
+#ifndef HASH_TTL_SHARDS_LOG2
+#define HASH_TTL_SHARDS_LOG2 3
+#endif
+
+#if HASH_TTL_SLOTS_LOG2 > 6
+#error "HASH_TTL_SLOTS_LOG2 should be at most 6"
+#endif
+
+#define HASH_TTL_SLOTS (1U << HASH_TTL_SLOTS_LOG2)
+#define HASH_TTL_SHARDS (1U << HASH_TTL_SHARDS_LOG2)
+/* Deadlines further than that are cascaded from the top level again */
+#define HASH_TTL_HORIZON (1ULL << (HASH_TTL_SLOTS_LOG2 * HASH_TTL_LEVELS))
+
+#define HASH_TTL_ENTRY(type)                                                   \
+struct {                                                                       \
+  struct type *next;                                                           \
+  struct type **prev;                                                          \
+  uint64_t deadline;                                                           \
+}
+
+#define HASH_TTL_HEAD(name, type, field)                                       \
+  struct name {                                                                \
+    HASH_HEAD(, type, field) table;                                            \
+    struct _hash_ttl_wheel_##type##_##field wheels[HASH_TTL_SHARDS];           \
+    void (*free_func)(struct type *);                                          \
+  }
+
+#define HASH_TTL_TABLE(head) (&(head)->table)
+
+#define _HASH_TTL_WHEEL(head, hv)                                              \
+  (&(head)->wheels[HASH_TTL_SHARDS_LOG2 == 0 ? 0 :                             \
+    (unsigned)((hv) >> (sizeof(HASH_TYPE) * 8 - HASH_TTL_SHARDS_LOG2))])
+
+#define _HASH_TTL_LOCK(head, w) do {                                           \
+  if ((w)->lock) {                                                             \
+    (head)->table.ops->lockn_write_lock((w)->lock, (head)->table.ops->locknd); \
+  }                                                                            \
+} while(0)
+#define _HASH_TTL_UNLOCK(head, w) do {                                         \
+  if ((w)->lock) {                                                             \
+    (head)->table.ops->lockn_write_unlock((w)->lock,                           \
+        (head)->table.ops->locknd);                                            \
+  }                                                                            \
+} while(0)
+
+#define HASH_TTL_INIT(head, type, field, ffunc) do {                           \
+  HASH_INIT(HASH_TTL_TABLE(head), type, field);                                \
+  memset((head)->wheels, 0, sizeof((head)->wheels));                           \
+  (head)->free_func = (ffunc);                                                 \
+} while(0)
+
+/*
+ * Allocates a table and locks of wheels, that start at tick `now`. Should be
+ * called prior to sharing of the table between threads
+ */
+#define HASH_TTL_MAKE_TABLE(head, now) do {                                    \
+  HASH_MAKE_TABLE(HASH_TTL_TABLE(head));                                       \
+  for (unsigned _s = 0; _s < HASH_TTL_SHARDS; _s ++) {                         \
+    if ((head)->table.ops->lockn_init) {                                       \
+      (head)->wheels[_s].lock =                                                \
+          (head)->table.ops->lockn_init((head)->table.ops->locknd);            \
+    }                                                                          \
+    (head)->wheels[_s].cur = (now);                                            \
+  }                                                                            \
+} while(0)
+
+/* Inserts `elm` expiring at tick `when` unless an equal element is stored */
+#define HASH_TTL_INSERT(head, type, field, tfield, elm, when, found) do {      \
+  HASH_TYPE _thv;                                                              \
+  struct _hash_ttl_wheel_##type##_##field *_w;                                 \
+  if ((head)->table.buckets == NULL) HASH_TTL_MAKE_TABLE(head, 0);             \
+  _thv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);        \
+  _w = _HASH_TTL_WHEEL(head, _thv);                                            \
+  (elm)->tfield.deadline = (when);                                             \
+  _HASH_TTL_LOCK(head, _w);                                                    \
+  _HASH_FIND_OR_INSERT_HV(HASH_TTL_TABLE(head), type, field, elm, _thv,        \
+      found, (void)0);                                                         \
+  if ((found) == NULL) {                                                       \
+    _hash_ttl_##type##_##field##_add(_w, (elm));                               \
+    _w->count ++;                                                              \
+  }                                                                            \
+  _HASH_TTL_UNLOCK(head, _w);                                                  \
+} while(0)
+
+/* Moves the deadline of an element equal to `elm` to tick `when` */
+#define HASH_TTL_SET_DEADLINE(head, type, field, tfield, elm, when, found) do { \
+  HASH_TYPE _thv;                                                              \
+  struct _hash_ttl_wheel_##type##_##field *_w;                                 \
+  (found) = NULL;                                                              \
+  if ((head)->table.buckets != NULL) {                                         \
+    _thv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);      \
+    _w = _HASH_TTL_WHEEL(head, _thv);                                          \
+    _HASH_TTL_LOCK(head, _w);                                                  \
+    HASH_FIND_ELT_HV(HASH_TTL_TABLE(head), type, field, elm, _thv, found);     \
+    if ((found) != NULL) {                                                     \
+      _hash_ttl_##type##_##field##_del(_w, (found));                           \
+      __atomic_store_n(&(found)->tfield.deadline, (when),                      \
+          __ATOMIC_RELAXED);                                                   \
+      _hash_ttl_##type##_##field##_add(_w, (found));                           \
+    }                                                                          \
+    _HASH_TTL_UNLOCK(head, _w);                                                \
+  }                                                                            \
+} while(0)
+
+/*
+ * Finds an element that has not expired by `now`. Elements could be expired
+ * and freed by other threads, so shared tables should make `free_func` drop
+ * a reference rather than free an element
+ */
+#define HASH_TTL_FIND_ELT(head, type, field, tfield, elm, now, found) do {     \
+  HASH_FIND_ELT(HASH_TTL_TABLE(head), type, field, elm, found);                \
+  if ((found) != NULL && __atomic_load_n(&(found)->tfield.deadline,            \
+      __ATOMIC_RELAXED) <= (now)) {                                            \
+    (found) = NULL;                                                            \
+  }                                                                            \
+} while(0)
+
+/* Removes an element equal to `elm`, if any, and passes it to `free_func` */
+#define HASH_TTL_DELETE_ELT(head, type, field, tfield, elm) do {               \
+  if ((head)->table.buckets != NULL) {                                         \
+    HASH_TYPE _thv;                                                            \
+    struct _hash_ttl_wheel_##type##_##field *_w;                               \
+    struct type *_tdel;                                                        \
+    _thv = (head)->table.ops->hash_func((elm), (head)->table.ops->hashd);      \
+    _w = _HASH_TTL_WHEEL(head, _thv);                                          \
+    _HASH_TTL_LOCK(head, _w);                                                  \
+    HASH_FIND_ELT_HV(HASH_TTL_TABLE(head), type, field, elm, _thv, _tdel);     \
+    if (_tdel != NULL) {                                                       \
+      HASH_DELETE_ELT_HV(HASH_TTL_TABLE(head), type, field, _tdel, _thv);      \
+      _hash_ttl_##type##_##field##_del(_w, _tdel);                             \
+      _w->count --;                                                            \
+    }                                                                          \
+    _HASH_TTL_UNLOCK(head, _w);                                                \
+    if (_tdel != NULL && (head)->free_func) (head)->free_func(_tdel);          \
+  }                                                                            \
+} while(0)
+
+/*
+ * Removes all elements with deadlines up to `now` and passes them to
+ * `free_func` after their wheel is unlocked. `expired` is set to the number
+ * of expired elements
+ */
+#define HASH_TTL_EXPIRE(head, type, field, tfield, now, expired) do {          \
+  unsigned _texpired = 0;                                                      \
+  if ((head)->table.buckets != NULL) {                                         \
+    for (unsigned _s = 0; _s < HASH_TTL_SHARDS; _s ++) {                       \
+      struct _hash_ttl_wheel_##type##_##field *_w = &(head)->wheels[_s];       \
+      struct type *_texp, *_tnext;                                             \
+      _HASH_TTL_LOCK(head, _w);                                                \
+      _texp = _hash_ttl_##type##_##field##_advance(_w, (now));                 \
+      for (_tnext = _texp; _tnext != NULL; _tnext = _tnext->tfield.next) {     \
+        HASH_DELETE_ELT_HV(HASH_TTL_TABLE(head), type, field, _tnext,          \
+            _tnext->field.hv);                                                 \
+      }                                                                        \
+      _HASH_TTL_UNLOCK(head, _w);                                              \
+      for (; _texp != NULL; _texp = _tnext) {                                  \
+        _tnext = _texp->tfield.next;                                           \
+        _texp->tfield.next = NULL;                                             \
+        _texpired ++;                                                          \
+        if ((head)->free_func) (head)->free_func(_texp);                       \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  (expired) = _texpired;                                                       \
+} while(0)
+
+#define HASH_TTL_COUNT(head)                                                   \
+  __atomic_load_n(&(head)->table.num_items, __ATOMIC_RELAXED)
+
+#define HASH_TTL_STATS(head, type, field, st)                                  \
+  HASH_STATS(HASH_TTL_TABLE(head), type, field, st)
+
+#define HASH_TTL_DESTROY(head, type, field) do {                               \
+  if ((head)->table.buckets != NULL) {                                         \
+    HASH_DESTROY(HASH_TTL_TABLE(head), type, field, (head)->free_func);        \
+    for (unsigned _s = 0; _s < HASH_TTL_SHARDS; _s ++) {                       \
+      if ((head)->wheels[_s].lock && (head)->table.ops->lockn_destroy) {       \
+        (head)->table.ops->lockn_destroy((head)->wheels[_s].lock,              \
+            (head)->table.ops->locknd);                                        \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  memset((head)->wheels, 0, sizeof((head)->wheels));                           \
+} while(0)
+
+/*
+ * Wheel of a type and its methods, called with the wheel locked. Lists of
+ * slots are doubly linked, so an element is unlinked without a search, and
+ * `used` bitmaps let a wheel skip empty slots of the lowest level
+ */
+#define HASH_TTL_GENERATE(type, field, tfield)                                 \
+  struct _hash_ttl_wheel_##type##_##field {                                    \
+    void *lock;                                                                \
+    uint64_t cur;                                                              \
+    unsigned count;                                                            \
+    uint64_t used[HASH_TTL_LEVELS];                                            \
+    struct type *slots[HASH_TTL_LEVELS][HASH_TTL_SLOTS];                       \
+  };                                                                           \
+  static void _HU_FUNCTION(_hash_ttl_##type##_##field##_add)(                  \
+      struct _hash_ttl_wheel_##type##_##field *w, struct type *elm) {          \
+    uint64_t when = elm->tfield.deadline, delta;                               \
+    unsigned lvl, idx;                                                         \
+    if (when < w->cur) when = w->cur;                                          \
+    delta = when - w->cur;                                                     \
+    for (lvl = 0; lvl < HASH_TTL_LEVELS - 1; lvl ++) {                         \
+      if (delta < (1ULL << (HASH_TTL_SLOTS_LOG2 * (lvl + 1)))) break;          \
+    }                                                                          \
+    if (delta >= HASH_TTL_HORIZON) when = w->cur + HASH_TTL_HORIZON - 1;       \
+    idx = (when >> (HASH_TTL_SLOTS_LOG2 * lvl)) & (HASH_TTL_SLOTS - 1);        \
+    elm->tfield.next = w->slots[lvl][idx];                                     \
+    if (elm->tfield.next) elm->tfield.next->tfield.prev = &elm->tfield.next;   \
+    w->slots[lvl][idx] = elm;                                                  \
+    elm->tfield.prev = &w->slots[lvl][idx];                                    \
+    w->used[lvl] |= 1ULL << idx;                                               \
+  }                                                                            \
+  static void _HU_FUNCTION(_hash_ttl_##type##_##field##_del)(                  \
+      struct _hash_ttl_wheel_##type##_##field *w, struct type *elm) {          \
+    struct type **prev = elm->tfield.prev;                                     \
+    *prev = elm->tfield.next;                                                  \
+    if (elm->tfield.next) elm->tfield.next->tfield.prev = prev;                \
+    else if (prev >= &w->slots[0][0] &&                                        \
+        prev < &w->slots[0][0] + HASH_TTL_LEVELS * HASH_TTL_SLOTS) {           \
+      unsigned pos = prev - &w->slots[0][0];                                   \
+      w->used[pos / HASH_TTL_SLOTS] &=                                         \
+          ~(1ULL << (pos & (HASH_TTL_SLOTS - 1)));                             \
+    }                                                                          \
+    elm->tfield.next = NULL;                                                   \
+    elm->tfield.prev = NULL;                                                   \
+  }                                                                            \
+  static struct type* _HU_FUNCTION(_hash_ttl_##type##_##field##_take)(         \
+      struct _hash_ttl_wheel_##type##_##field *w, unsigned lvl,                \
+      unsigned idx) {                                                          \
+    struct type *list = w->slots[lvl][idx];                                    \
+    w->slots[lvl][idx] = NULL;                                                 \
+    w->used[lvl] &= ~(1ULL << idx);                                            \
+    return list;                                                               \
+  }                                                                            \
+  /* Re-adds all elements relative to the current tick */                      \
+  static void _HU_FUNCTION(_hash_ttl_##type##_##field##_readd)(                \
+      struct _hash_ttl_wheel_##type##_##field *w, struct type *list) {         \
+    struct type *next;                                                         \
+    for (; list != NULL; list = next) {                                        \
+      next = list->tfield.next;                                                \
+      _hash_ttl_##type##_##field##_add(w, list);                               \
+    }                                                                          \
+  }                                                                            \
+  /* Returns elements due by `now` linked by their `next` fields */            \
+  static struct type* _HU_FUNCTION(_hash_ttl_##type##_##field##_advance)(      \
+      struct _hash_ttl_wheel_##type##_##field *w, uint64_t now) {              \
+    struct type *expired = NULL, *list, *next;                                 \
+    unsigned lvl, idx;                                                         \
+    uint64_t rest, step;                                                       \
+    if (w->cur <= now && now - w->cur >= HASH_TTL_HORIZON && w->count > 0) {   \
+      /* Too far to walk: the whole wheel is rebuilt around `now` */           \
+      w->cur = now;                                                            \
+      for (lvl = 0; lvl < HASH_TTL_LEVELS; lvl ++) {                           \
+        for (idx = 0; idx < HASH_TTL_SLOTS; idx ++) {                          \
+          _hash_ttl_##type##_##field##_readd(w,                                \
+              _hash_ttl_##type##_##field##_take(w, lvl, idx));                 \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    while (w->cur <= now) {                                                    \
+      if (w->count == 0) {                                                     \
+        w->cur = now + 1;                                                      \
+        break;                                                                 \
+      }                                                                        \
+      idx = w->cur & (HASH_TTL_SLOTS - 1);                                     \
+      if (idx == 0) {                                                          \
+        for (lvl = 1; lvl < HASH_TTL_LEVELS; lvl ++) {                         \
+          unsigned cidx = (w->cur >> (HASH_TTL_SLOTS_LOG2 * lvl)) &            \
+              (HASH_TTL_SLOTS - 1);                                            \
+          if (w->used[lvl] & (1ULL << cidx)) {                                 \
+            _hash_ttl_##type##_##field##_readd(w,                              \
+                _hash_ttl_##type##_##field##_take(w, lvl, cidx));              \
+          }                                                                    \
+          if (cidx != 0) break;                                                \
+        }                                                                      \
+      }                                                                        \
+      if (w->used[0] & (1ULL << idx)) {                                        \
+        list = _hash_ttl_##type##_##field##_take(w, 0, idx);                   \
+        for (; list != NULL; list = next) {                                    \
+          next = list->tfield.next;                                            \
+          list->tfield.prev = NULL;                                            \
+          list->tfield.next = expired;                                         \
+          expired = list;                                                      \
+          w->count --;                                                         \
+        }                                                                      \
+      }                                                                        \
+      /* Skip to the next used slot or to the next cascade */                  \
+      rest = w->used[0] & ~((2ULL << idx) - 1);                                \
+      step = rest ? (uint64_t)__builtin_ctzll(rest) - idx :                    \
+          HASH_TTL_SLOTS - idx;                                                \
+      if (step > now - w->cur) {                                               \
+        w->cur = now + 1;                                                      \
+        break;                                                                 \
+      }                                                                        \
+      w->cur += step;                                                          \
+    }                                                                          \
+    return expired;                                                            \
+  }
+
+#endif /* HASH_TTL_H_ */
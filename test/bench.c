@@ -0,0 +1,1081 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark harness for all engines, locking backends, hash functions and key
+ * types. The engine is selected at compile time: `bench-chained` is built as
+ * is, `bench-closed`, `bench-cuckoo`, `bench-hopscotch` and `bench-extendible`
+ * with BENCH_CLOSED, BENCH_CUCKOO, BENCH_HOPSCOTCH and BENCH_EXTENDIBLE
+ * defined. Everything else is selected by command line options, see usage().
+ *
+ * Keys are taken from a pool of 2 * size distinct keys, the first half is
+ * inserted before the measurement. Lookups hit the first half with the
+ * configured probability, other operations pick keys from the whole pool.
+ * Operation streams are generated before the measurement, so neither random
+ * numbers nor Zipfian sampling are timed. Each repetition prints one JSON
+ * line.
+ *
+ * With `-L` the latency of each operation is recorded to a log-linear (HDR
+ * style) histogram of its kind and percentiles are added to the output. With
+ * `-e` each expansion of the table is printed as a separate JSON line. Both
+ * are most useful with `-i` smaller than `-n`, so inserts keep growing the
+ * table during the measurement.
+ *
+ * With `-P` hardware counters of each thread are read around its measured
+ * loop and reported per operation. Counters that could not be opened in every
+ * thread are omitted.
+ *
+ * With `-x file` keys are replayed from a trace instead: the table is filled
+ * by keys of its load section and each thread looks up keys of its query
+ * section in their order, so the hit/miss pattern of the trace is preserved.
+ * A text trace has one key per line and its sections are separated by a
+ * `%%` line. A binary trace starts with TRACE_MAGIC, the number of load and
+ * query keys as native 32-bit integers, followed by keys, each prefixed by its
+ * 32-bit length. When a text trace has no separator, its keys are loaded and
+ * then queried. The file is mapped and keys are not copied.
+ *
+ * Scenarios (`-S`):
+ * - mix: each of `-t` threads runs `-o` operations of the `-m` mix;
+ * - churn: `-t` readers look up keys of the whole pool whilst `-W` writers
+ *   delete and insert keys for `-T` milliseconds. Each writer owns a
+ *   partition of the pool and deletes its oldest key before inserting a new
+ *   one, so the table size stays fixed;
+ * - growth: `-t` readers run until `-W` writers have inserted all keys from
+ *   `-i` up to the whole pool.
+ * Churn and growth report throughput of readers and writers separately. With
+ * `-c` the number of readers (or threads of the mix) is swept from 1 to `-t`,
+ * which defaults to all cores left after writers.
+ */
+#ifdef BENCH_CLOSED
+#ifndef HASH_CLOSED_SHARDS_LOG2
+#define HASH_CLOSED_SHARDS_LOG2 6
+#endif
+#include "hash_closed.h"
+#define BENCH_ENGINE "closed"
+#elif defined(BENCH_CUCKOO)
+#ifndef HASH_CUCKOO_SHARDS_LOG2
+#define HASH_CUCKOO_SHARDS_LOG2 6
+#endif
+#include "hash_cuckoo.h"
+#define BENCH_ENGINE "cuckoo"
+#elif defined(BENCH_HOPSCOTCH)
+#ifndef HASH_HOPSCOTCH_SHARDS_LOG2
+#define HASH_HOPSCOTCH_SHARDS_LOG2 6
+#endif
+#include "hash_hopscotch.h"
+#define BENCH_ENGINE "hopscotch"
+#elif defined(BENCH_EXTENDIBLE)
+#include "hash_extendible.h"
+#define BENCH_ENGINE "extendible"
+#else
+#define BENCH_ENGINE "chained"
+#endif
+#include "hash_xxhash.h"
+#include "hash.h"
+#include "hash_pthread.h"
+#include "bench_perf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct bnode {
+  const unsigned char *key;
+  unsigned len;
+  unsigned value;
+  uint64_t ikey;
+  HASH_ENTRY(bnode) hh;
+};
+
+enum bench_op_kind {
+  BENCH_OP_READ = 0,
+  BENCH_OP_INSERT,
+  BENCH_OP_DELETE,
+  BENCH_OP_UPSERT,
+  BENCH_OP_MAX
+};
+
+struct bench_op {
+  uint32_t idx;
+  uint32_t kind;
+};
+
+static const char *op_names[BENCH_OP_MAX] = {
+  "read", "insert", "delete", "upsert"
+};
+
+/*
+ * Values below 2^LAT_SUB_BITS nanoseconds are exact, larger values are
+ * rounded to LAT_SUB_BITS - 1 significant bits (about 3% precision)
+ */
+#define LAT_SUB_BITS 5
+#define LAT_SUB_HALF (1U << (LAT_SUB_BITS - 1))
+#define LAT_SLOTS (64 * LAT_SUB_HALF)
+
+struct lat_hist {
+  uint64_t counts[LAT_SLOTS];
+  uint64_t total;
+  uint64_t max;
+};
+
+enum bench_scenario {
+  BENCH_MIX = 0,
+  BENCH_CHURN,
+  BENCH_GROWTH
+};
+
+struct bench_thread {
+  pthread_t th;
+  unsigned id;
+  int writer;
+  struct bench_op *ops;
+  uint64_t nops;
+  uint64_t done;
+  uint64_t hits;
+  uint64_t end_ns;
+  struct lat_hist *lat;
+  struct bench_perf perf;
+};
+
+/* Operations run by readers between checks of the stop flag */
+#define READER_CHUNK 256
+
+#define RESIZE_LOG_MAX 4096
+
+struct resize_event {
+  uint64_t at_ns;
+  unsigned old_num, new_num, items;
+  uint64_t ns;
+};
+
+static struct {
+  const char *lock;
+  const char *hash;
+  const char *keys;
+  const char *dist;
+  double theta;
+  double hit;
+  unsigned mix[BENCH_OP_MAX];
+  unsigned size;
+  unsigned threads;
+  uint64_t ops;
+  uint64_t warmup;
+  unsigned reps;
+  uint64_t seed;
+  unsigned initial;
+  int latency;
+  int perf;
+  int resize_log;
+  const char *scenario;
+  enum bench_scenario scen;
+  unsigned writers;
+  unsigned duration_ms;
+  int sweep;
+  const char *trace;
+} conf = {
+  .lock = "rwlock",
+  .hash = "jenkins",
+  .keys = "int",
+  .dist = "uniform",
+  .theta = 0.99,
+  .hit = 0.5,
+  .mix = { 100, 0, 0, 0 },
+  .size = 1000000,
+  .threads = 1,
+  .ops = 1000000,
+  .warmup = 100000,
+  .reps = 3,
+  .seed = 42,
+  .scenario = "mix",
+  .writers = 1,
+  .duration_ms = 1000,
+};
+
+static _hash_filter_data_t bench_hashd;
+
+static HASH_TYPE
+bench_hash(const struct bnode *n, void *d)
+{
+  _hash_filter_data_t *dt = (_hash_filter_data_t *)d;
+  unsigned char space[HASH_SPACE_SIZE];
+  void *s;
+
+  s = dt->ht->hash_init(dt->ht->d, dt->ht->seed, space, sizeof(space));
+  dt->ht->hash_update(s, n->key, n->len, dt->ht->d);
+  return dt->ht->hash_final(s, dt->ht->d);
+}
+
+static int
+bench_cmp(const struct bnode *n1, const struct bnode *n2, void *d)
+{
+  if (n1->len != n2->len) return n1->len < n2->len ? -1 : 1;
+  return memcmp(n1->key, n2->key, n1->len);
+}
+
+HASH_INIT_JENKINS(bnode, hh);
+HASH_INIT_MURMUR(bnode, hh);
+HASH_INIT_XXHASH(bnode, hh);
+HASH_GENERATE_OPS(bnode, hh, ikey, bench_hash, bench_cmp, &bench_hashd);
+HASH_PTHREAD_GENERATE(bnode, hh);
+
+static HASH_HEAD(, bnode, hh) head;
+static hash_pthread_prof_t prof;
+static struct bnode *pool;
+static unsigned char *keybuf;
+static pthread_barrier_t barrier;
+static struct resize_event resize_log[RESIZE_LOG_MAX];
+static unsigned resize_count;
+static uint64_t rep_start_ns;
+
+#define TRACE_MAGIC "JHTR"
+
+static struct {
+  const unsigned char *map;
+  size_t len;
+  unsigned nload;
+  unsigned nquery;
+} trace;
+static int stop;
+static unsigned writers_done;
+
+#if defined(BENCH_CLOSED) || defined(BENCH_CUCKOO) || defined(BENCH_HOPSCOTCH)
+#define BENCH_FIND(elm, found) do {                                            \
+  struct bnode _copy;                                                          \
+  HASH_FIND_ELT_COPY(&head, bnode, hh, elm, &_copy, found);                    \
+} while(0)
+#else
+#define BENCH_FIND(elm, found) HASH_FIND_ELT(&head, bnode, hh, elm, found)
+#endif
+
+static void
+bench_merge(struct bnode *existing, struct bnode *elm)
+{
+  existing->value ++;
+}
+
+static uint64_t
+bench_clock_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned
+lat_slot(uint64_t v)
+{
+  unsigned e;
+
+  if (v < (1U << LAT_SUB_BITS)) return v;
+  e = 64 - __builtin_clzll(v) - LAT_SUB_BITS;
+  return (e + 1) * LAT_SUB_HALF + (unsigned)(v >> e) - LAT_SUB_HALF;
+}
+
+/* The largest value that is counted in `slot` */
+static uint64_t
+lat_slot_value(unsigned slot)
+{
+  unsigned e;
+
+  if (slot < (1U << LAT_SUB_BITS)) return slot;
+  e = slot / LAT_SUB_HALF - 1;
+  return ((uint64_t)(slot % LAT_SUB_HALF + LAT_SUB_HALF + 1) << e) - 1;
+}
+
+static void
+lat_add(struct lat_hist *h, uint64_t v)
+{
+  h->counts[lat_slot(v)] ++;
+  h->total ++;
+  if (v > h->max) h->max = v;
+}
+
+static void
+lat_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+  for (unsigned i = 0; i < LAT_SLOTS; i ++) dst->counts[i] += src->counts[i];
+  dst->total += src->total;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+static uint64_t
+lat_percentile(const struct lat_hist *h, double pct)
+{
+  uint64_t rank = (uint64_t)(h->total * pct / 100.0), seen = 0;
+
+  for (unsigned i = 0; i < LAT_SLOTS; i ++) {
+    seen += h->counts[i];
+    if (seen > rank) {
+      uint64_t v = lat_slot_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+/* Called with the table (or its shard) locked, so just append to the log */
+static void
+on_expand(unsigned old_num, unsigned new_num, unsigned items, uint64_t ns,
+    void *d)
+{
+  unsigned i = __atomic_fetch_add(&resize_count, 1, __ATOMIC_RELAXED);
+
+  if (i < RESIZE_LOG_MAX) {
+    resize_log[i].at_ns = bench_clock_ns() - rep_start_ns;
+    resize_log[i].old_num = old_num;
+    resize_log[i].new_num = new_num;
+    resize_log[i].items = items;
+    resize_log[i].ns = ns;
+  }
+}
+
+static uint64_t
+splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static double
+rand_double(uint64_t *x)
+{
+  return (splitmix64(x) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Zipfian generator by Gray et al., "Quickly generating billion-record
+ * synthetic databases" */
+struct zipf {
+  uint64_t n;
+  double theta, alpha, zetan, eta;
+};
+
+static void
+zipf_init(struct zipf *z, uint64_t n, double theta)
+{
+  double zeta2 = 1.0 + pow(0.5, theta);
+
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (uint64_t i = 1; i <= n; i ++) z->zetan += 1.0 / pow((double)i, theta);
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t
+zipf_next(struct zipf *z, uint64_t *x)
+{
+  double u = rand_double(x), uz = u * z->zetan;
+  uint64_t r;
+
+  if (uz < 1.0) return 0;
+  if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+  r = z->n * pow(z->eta * u - z->eta + 1.0, z->alpha);
+  return r < z->n ? r : z->n - 1;
+}
+
+/* Rank `r` of `n` is mapped to a key, so hot keys are spread over a table */
+static uint32_t
+pick(struct zipf *z, uint64_t *x, uint64_t n)
+{
+  uint64_t r = z ? zipf_next(z, x) : splitmix64(x) % n;
+
+  return (uint32_t)((r * 2654435761ULL) % n);
+}
+
+static void
+make_keys(unsigned npool)
+{
+  uint64_t x = conf.seed;
+  size_t slen = 0;
+
+  if (strcmp(conf.keys, "str") == 0) slen = 16;
+  else if (strcmp(conf.keys, "longstr") == 0) slen = 128;
+  keybuf = slen ? malloc(slen * npool) : NULL;
+
+  for (unsigned i = 0; i < npool; i ++) {
+    struct bnode *n = &pool[i];
+
+    memset(n, 0, sizeof(*n));
+    if (strcmp(conf.keys, "int") == 0) {
+      /* Multiplication by an odd number is a bijection, keys are distinct */
+      n->ikey = (uint32_t)(i * 2654435761U) ^ (uint32_t)conf.seed;
+      n->key = (const unsigned char *)&n->ikey;
+      n->len = sizeof(uint32_t);
+    }
+    else if (strcmp(conf.keys, "u64") == 0) {
+      uint64_t v = i;
+      n->ikey = splitmix64(&v);
+      n->key = (const unsigned char *)&n->ikey;
+      n->len = sizeof(uint64_t);
+    }
+    else {
+      /* The first 16 characters are unique */
+      unsigned char *p = keybuf + slen * i;
+      uint64_t v = i;
+      char hex[17];
+      for (size_t off = 0; off < slen; off += 16) {
+        snprintf(hex, sizeof(hex), "%016llx",
+            (unsigned long long)(off == 0 ? splitmix64(&v) : splitmix64(&x)));
+        memcpy(p + off, hex, 16);
+      }
+      n->key = p;
+      n->len = slen;
+    }
+  }
+}
+
+static void
+trace_key(struct bnode *out, unsigned i, const unsigned char *p, size_t len)
+{
+  if (out == NULL) return;
+  memset(&out[i], 0, sizeof(out[i]));
+  out[i].key = p;
+  out[i].len = len;
+}
+
+/*
+ * Counts keys of both sections when `out` is NULL, otherwise sets load keys
+ * to `out[0..nload)` and query keys to `out[nload..)`. Returns -1 if a binary
+ * trace is truncated.
+ */
+static int
+trace_parse(struct bnode *out, unsigned *nload, unsigned *nquery)
+{
+  const unsigned char *p = trace.map, *end = p + trace.len;
+  unsigned nl = 0, nq = 0, sep = 0;
+  uint32_t hdr[2], len;
+
+  if (trace.len >= 12 && memcmp(p, TRACE_MAGIC, 4) == 0) {
+    memcpy(hdr, p + 4, sizeof(hdr));
+    p += 12;
+    for (uint64_t i = 0; i < (uint64_t)hdr[0] + hdr[1]; i ++) {
+      if (end - p < 4) return -1;
+      memcpy(&len, p, sizeof(len));
+      if ((size_t)(end - p - 4) < len) return -1;
+      trace_key(out, i, p + 4, len);
+      p += 4 + len;
+    }
+    *nload = hdr[0];
+    *nquery = hdr[1];
+    return 0;
+  }
+
+  while (p < end) {
+    const unsigned char *eol = memchr(p, '\n', end - p);
+    size_t n = (eol ? eol : end) - p;
+
+    if (n > 0 && p[n - 1] == '\r') n --;
+    if (!sep && n == 2 && p[0] == '%' && p[1] == '%') sep = 1;
+    else if (n > 0 && !sep) trace_key(out, nl ++, p, n);
+    else if (n > 0) trace_key(out, trace.nload + nq ++, p, n);
+    p = eol ? eol + 1 : end;
+  }
+  if (!sep) {
+    /* Query all loaded keys in their order */
+    for (unsigned i = 0; out != NULL && i < nl; i ++) {
+      out[nl + i] = out[i];
+    }
+    nq = nl;
+  }
+  *nload = nl;
+  *nquery = nq;
+
+  return 0;
+}
+
+static void
+trace_load(const char *path)
+{
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  map = st.st_size > 0 ?
+      mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: cannot map an empty or special file\n", path);
+    exit(EXIT_FAILURE);
+  }
+  madvise(map, st.st_size, MADV_WILLNEED);
+  trace.map = map;
+  trace.len = st.st_size;
+  if (trace_parse(NULL, &trace.nload, &trace.nquery) == -1) {
+    fprintf(stderr, "%s: truncated binary trace\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if (trace.nload == 0 || trace.nquery == 0) {
+    fprintf(stderr, "%s: load and query sections must not be empty\n", path);
+    exit(EXIT_FAILURE);
+  }
+  pool = malloc(sizeof(*pool) * ((size_t)trace.nload + trace.nquery));
+  trace_parse(pool, &trace.nload, &trace.nquery);
+}
+
+static void
+make_ops(struct bench_thread *t)
+{
+  uint64_t x = conf.seed + 1 + t->id;
+  struct zipf zhit, zall, *ph = NULL, *pa = NULL;
+
+  if (strcmp(conf.dist, "zipf") == 0) {
+    zipf_init(&zhit, conf.size, conf.theta);
+    zipf_init(&zall, conf.size * 2ULL, conf.theta);
+    ph = &zhit;
+    pa = &zall;
+  }
+  t->nops = conf.warmup + conf.ops;
+  t->ops = malloc(sizeof(*t->ops) * t->nops);
+  if (conf.trace != NULL) {
+    /* Warmup replays the head of the trace */
+    for (uint64_t i = 0; i < t->nops; i ++) {
+      t->ops[i].kind = BENCH_OP_READ;
+      t->ops[i].idx = trace.nload +
+          (i < conf.warmup ? i % trace.nquery : i - conf.warmup);
+    }
+    return;
+  }
+  if (conf.scen != BENCH_MIX) {
+    /* Readers of scenarios look up the whole pool */
+    for (uint64_t i = 0; i < t->nops; i ++) {
+      t->ops[i].kind = BENCH_OP_READ;
+      t->ops[i].idx = pick(pa, &x, conf.size * 2ULL);
+    }
+    return;
+  }
+  for (uint64_t i = 0; i < t->nops; i ++) {
+    unsigned r = splitmix64(&x) % 100, kind = 0, acc = conf.mix[0];
+    while (r >= acc) acc += conf.mix[++kind];
+    t->ops[i].kind = kind;
+    if (kind == BENCH_OP_READ) {
+      t->ops[i].idx = pick(ph, &x, conf.size);
+      if (rand_double(&x) >= conf.hit) t->ops[i].idx += conf.size;
+    }
+    else {
+      t->ops[i].idx = pick(pa, &x, conf.size * 2ULL);
+    }
+  }
+}
+
+/* Returns 1 if an operation has found an existing key */
+static inline int
+run_op(const struct bench_op *op)
+{
+  struct bnode *elm = &pool[op->idx], *found = NULL;
+
+  switch (op->kind) {
+  case BENCH_OP_READ:
+    BENCH_FIND(elm, found);
+    break;
+  case BENCH_OP_INSERT:
+    HASH_FIND_OR_INSERT(&head, bnode, hh, elm, found);
+    break;
+  case BENCH_OP_DELETE:
+    HASH_DELETE_ELT(&head, bnode, hh, elm);
+    break;
+  case BENCH_OP_UPSERT:
+    HASH_UPSERT(&head, bnode, hh, elm, bench_merge);
+    break;
+  }
+
+  return found != NULL;
+}
+
+/* `lat` is an array of BENCH_OP_MAX histograms or NULL */
+static uint64_t
+run_ops(struct bench_op *ops, uint64_t n, struct lat_hist *lat)
+{
+  uint64_t hits = 0, t0, t1;
+
+  if (lat == NULL) {
+    for (uint64_t i = 0; i < n; i ++) hits += run_op(&ops[i]);
+  }
+  else {
+    t0 = bench_clock_ns();
+    for (uint64_t i = 0; i < n; i ++) {
+      hits += run_op(&ops[i]);
+      t1 = bench_clock_ns();
+      lat_add(&lat[ops[i].kind], t1 - t0);
+      t0 = t1;
+    }
+  }
+
+  return hits;
+}
+
+static void
+run_reader(struct bench_thread *t)
+{
+  uint64_t pos = 0, chunk = conf.ops < READER_CHUNK ? conf.ops : READER_CHUNK;
+
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    if (pos + chunk > conf.ops) pos = 0;
+    t->hits += run_ops(t->ops + conf.warmup + pos, chunk, t->lat);
+    t->done += chunk;
+    pos += chunk;
+  }
+}
+
+/* Key `j` of the queue of writer `w`: its present keys, then absent ones */
+static uint32_t
+churn_key(unsigned w, unsigned cnt, uint64_t j)
+{
+  j %= cnt * 2ULL;
+  if (j < cnt) return w + j * conf.writers;
+  return conf.size + w + (j - cnt) * conf.writers;
+}
+
+static void
+run_writer(struct bench_thread *t, unsigned w)
+{
+  struct bench_op op[2];
+
+  if (conf.scen == BENCH_CHURN) {
+    unsigned cnt = (conf.size - w + conf.writers - 1) / conf.writers;
+    op[0].kind = BENCH_OP_DELETE;
+    op[1].kind = BENCH_OP_INSERT;
+    for (uint64_t k = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); k ++) {
+      op[0].idx = churn_key(w, cnt, k);
+      op[1].idx = churn_key(w, cnt, k + cnt);
+      t->hits += run_ops(op, 2, t->lat);
+      t->done += 2;
+    }
+  }
+  else {
+    op[0].kind = BENCH_OP_INSERT;
+    for (uint64_t idx = conf.initial + w; idx < conf.size * 2ULL;
+        idx += conf.writers) {
+      op[0].idx = idx;
+      t->hits += run_ops(op, 1, t->lat);
+      t->done ++;
+    }
+    if (__atomic_add_fetch(&writers_done, 1, __ATOMIC_ACQ_REL) ==
+        conf.writers) {
+      __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static unsigned max_readers;
+
+static void *
+worker(void *arg)
+{
+  struct bench_thread *t = (struct bench_thread *)arg;
+
+  if (!t->writer) run_ops(t->ops, conf.warmup, NULL);
+  if (conf.perf) bench_perf_open(&t->perf);
+  pthread_barrier_wait(&barrier);
+  if (conf.perf) bench_perf_start(&t->perf);
+  if (t->writer) {
+    run_writer(t, t->id - max_readers);
+  }
+  else if (conf.scen == BENCH_MIX) {
+    t->hits = run_ops(t->ops + conf.warmup, conf.ops, t->lat);
+    t->done = conf.ops;
+  }
+  else {
+    run_reader(t);
+  }
+  t->end_ns = bench_clock_ns();
+  if (conf.perf) bench_perf_stop(&t->perf);
+
+  return NULL;
+}
+
+static void
+setup_table(void)
+{
+  HASH_INIT(&head, bnode, hh);
+  if (strcmp(conf.lock, "rwlock") == 0)
+    HASH_INIT_PTHREAD_RWLOCK(&head, bnode, hh);
+  else if (strcmp(conf.lock, "mutex") == 0)
+    HASH_INIT_PTHREAD_MUTEX(&head, bnode, hh);
+  else if (strcmp(conf.lock, "rwlock-prof") == 0)
+    HASH_INIT_PTHREAD_PROF_RWLOCK(&head, &prof);
+  else if (strcmp(conf.lock, "mutex-prof") == 0)
+    HASH_INIT_PTHREAD_PROF_MUTEX(&head, &prof);
+  memset(&prof, 0, sizeof(prof));
+  HASH_ON_EXPAND(&head, on_expand, NULL);
+  resize_count = 0;
+  HASH_MAKE_TABLE(&head);
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [options]\n"
+      "  -n size       half of the keys pool, lookups hit this half (%u)\n"
+      "  -i initial    keys inserted before measurement (size)\n"
+      "  -o ops        measured operations per thread (%llu)\n"
+      "  -w ops        warmup operations per thread (%llu)\n"
+      "  -S scenario   mix, churn or growth (%s)\n"
+      "  -t threads    threads of the mix or readers of scenarios (%u)\n"
+      "  -W writers    writers of churn and growth scenarios (%u)\n"
+      "  -T msec       duration of the churn scenario (%u)\n"
+      "  -c            sweep threads (readers) from 1 to -t\n"
+      "  -r reps       repetitions (%u)\n"
+      "  -k keys       int, u64, str or longstr (%s)\n"
+      "  -d dist       uniform or zipf (%s)\n"
+      "  -z theta      Zipfian skew (%.2f)\n"
+      "  -p hit        hit probability of lookups (%.2f)\n"
+      "  -m r:i:d:u    percents of lookups, inserts, deletes and upserts\n"
+      "  -l lock       none, rwlock, mutex, rwlock-prof or mutex-prof (%s)\n"
+      "  -f hash       jenkins, murmur or xxhash (%s)\n"
+      "  -s seed       seed of keys and operations (%llu)\n"
+      "  -x trace      replay lookups of a trace file\n"
+      "  -L            record latency histograms of operations\n"
+      "  -P            report hardware counters per operation\n"
+      "  -e            print expansions of the table\n",
+      prog, conf.size, (unsigned long long)conf.ops,
+      (unsigned long long)conf.warmup, conf.scenario, conf.threads,
+      conf.writers, conf.duration_ms, conf.reps, conf.keys,
+      conf.dist, conf.theta, conf.hit, conf.lock, conf.hash,
+      (unsigned long long)conf.seed);
+  exit(EXIT_FAILURE);
+}
+
+static int
+one_of(const char *s, const char **vals)
+{
+  for (; *vals != NULL; vals ++) {
+    if (strcmp(s, *vals) == 0) return 1;
+  }
+  return 0;
+}
+
+static void
+print_role(const char *name, struct bench_thread *threads, unsigned from,
+    unsigned to, uint64_t start)
+{
+  uint64_t ops = 0, hits = 0, end = start;
+
+  for (unsigned i = from; i < to; i ++) {
+    ops += threads[i].done;
+    hits += threads[i].hits;
+    if (threads[i].end_ns > end) end = threads[i].end_ns;
+  }
+  printf(",\"%s_ops\":%llu,\"%s_hits\":%llu,\"%s_mops\":%.3f", name,
+      (unsigned long long)ops, name, (unsigned long long)hits, name,
+      end > start ? ops / ((end - start) / 1e9) / 1e6 : 0.0);
+}
+
+/* Counters of all threads per operation, cycles and instructions give IPC */
+static void
+print_perf(struct bench_thread **run, unsigned nthreads, uint64_t ops)
+{
+  static int warned;
+  uint64_t sum[BENCH_PERF_MAX] = { 0 };
+  unsigned valid = (1U << BENCH_PERF_MAX) - 1, first = 1;
+
+  for (unsigned i = 0; i < nthreads; i ++) {
+    valid &= run[i]->perf.valid;
+    for (unsigned k = 0; k < BENCH_PERF_MAX; k ++)
+      sum[k] += run[i]->perf.val[k];
+  }
+  if (valid == 0 || ops == 0) {
+    if (!warned) {
+      fprintf(stderr, "hardware counters are unavailable, "
+          "check perf_event_paranoid\n");
+      warned = 1;
+    }
+    printf(",\"perf\":null");
+    return;
+  }
+  printf(",\"perf\":{");
+  for (unsigned k = 0; k < BENCH_PERF_MAX; k ++) {
+    if (!(valid & (1U << k))) continue;
+    printf("%s\"%s\":%.3f", first ? "" : ",", bench_perf_names[k],
+        (double)sum[k] / ops);
+    first = 0;
+  }
+  if ((valid & (1U << BENCH_PERF_CYCLES)) &&
+      (valid & (1U << BENCH_PERF_INSTRUCTIONS)) && sum[BENCH_PERF_CYCLES] > 0) {
+    printf(",\"ipc\":%.3f", (double)sum[BENCH_PERF_INSTRUCTIONS] /
+        sum[BENCH_PERF_CYCLES]);
+  }
+  printf("}");
+}
+
+static void
+run_rep(struct bench_thread *threads, unsigned nreaders, unsigned rep)
+{
+  uint64_t start, fill_ns, end = 0, hits = 0, ops = 0;
+  struct lat_hist *lat = NULL;
+  unsigned fill_resizes, nwriters = conf.scen == BENCH_MIX ? 0 : conf.writers;
+  unsigned nthreads = nreaders + nwriters;
+  struct bench_thread **run = calloc(nthreads, sizeof(*run));
+  double secs;
+
+  setup_table();
+  start = rep_start_ns = bench_clock_ns();
+  for (unsigned i = 0; i < conf.initial; i ++) {
+    pool[i].value = 0;
+    if (conf.trace != NULL) {
+      /* Keys could be repeated in a trace */
+      struct bnode *found;
+      HASH_FIND_OR_INSERT(&head, bnode, hh, &pool[i], found);
+      (void)found;
+    }
+    else {
+      HASH_INSERT(&head, bnode, hh, &pool[i]);
+    }
+  }
+  fill_ns = bench_clock_ns() - start;
+  fill_resizes = resize_count;
+  if (conf.latency) lat = calloc(BENCH_OP_MAX, sizeof(*lat));
+  /* Readers are the first `max_readers` threads and writers follow them */
+  for (unsigned i = 0; i < nthreads; i ++) {
+    struct bench_thread *t =
+        &threads[i < nreaders ? i : max_readers + i - nreaders];
+    t->done = t->hits = t->end_ns = 0;
+    if (t->lat) memset(t->lat, 0, sizeof(*lat) * BENCH_OP_MAX);
+    run[i] = t;
+  }
+  stop = 0;
+  writers_done = 0;
+
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  for (unsigned i = 0; i < nthreads; i ++) {
+    pthread_create(&run[i]->th, NULL, worker, run[i]);
+  }
+  pthread_barrier_wait(&barrier);
+  start = bench_clock_ns();
+  if (conf.scen == BENCH_CHURN) {
+    usleep(conf.duration_ms * 1000);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  }
+  for (unsigned i = 0; i < nthreads; i ++) {
+    pthread_join(run[i]->th, NULL);
+    if (run[i]->end_ns > end) end = run[i]->end_ns;
+    hits += run[i]->hits;
+    ops += run[i]->done;
+    for (unsigned k = 0; lat != NULL && k < BENCH_OP_MAX; k ++)
+      lat_merge(&lat[k], &run[i]->lat[k]);
+  }
+  pthread_barrier_destroy(&barrier);
+  secs = (end - start) / 1e9;
+
+  printf("{\"event\":\"result\",\"engine\":\"%s\",\"scenario\":\"%s\","
+      "\"lock\":\"%s\",\"hash\":\"%s\",\"keys\":\"%s\",\"dist\":\"%s\","
+      "\"theta\":%.2f,\"hit\":%.2f,\"mix\":\"%u:%u:%u:%u\",\"size\":%u,"
+      "\"initial\":%u,\"threads\":%u,\"writers\":%u,\"rep\":%u,"
+      "\"ops\":%llu,\"hits\":%llu,\"fill_seconds\":%.6f,"
+      "\"seconds\":%.6f,\"mops\":%.3f,\"resizes\":%u",
+      BENCH_ENGINE, conf.scenario, conf.lock, conf.hash, conf.keys, conf.dist,
+      conf.theta, conf.hit, conf.mix[0], conf.mix[1], conf.mix[2], conf.mix[3],
+      conf.size, conf.initial, nreaders, nwriters, rep,
+      (unsigned long long)ops, (unsigned long long)hits, fill_ns / 1e9, secs,
+      ops / secs / 1e6, resize_count - fill_resizes);
+  if (nwriters > 0) {
+    print_role("read", threads, 0, nreaders, start);
+    print_role("write", threads, max_readers, max_readers + nwriters, start);
+  }
+  if (strstr(conf.lock, "-prof") != NULL) {
+    printf(",\"global_waits\":%llu,\"global_wait_ns\":%llu,"
+        "\"bucket_waits\":%llu,\"bucket_wait_ns\":%llu",
+        (unsigned long long)prof.global.waits,
+        (unsigned long long)prof.global.wait_ns,
+        (unsigned long long)prof.bucket.waits,
+        (unsigned long long)prof.bucket.wait_ns);
+  }
+  if (conf.perf) print_perf(run, nthreads, ops);
+  if (lat != NULL) {
+    printf(",\"latency_ns\":{");
+    for (unsigned k = 0, first = 1; k < BENCH_OP_MAX; k ++) {
+      if (lat[k].total == 0) continue;
+      printf("%s\"%s\":{\"count\":%llu,\"p50\":%llu,\"p99\":%llu,"
+          "\"p999\":%llu,\"max\":%llu}", first ? "" : ",", op_names[k],
+          (unsigned long long)lat[k].total,
+          (unsigned long long)lat_percentile(&lat[k], 50.0),
+          (unsigned long long)lat_percentile(&lat[k], 99.0),
+          (unsigned long long)lat_percentile(&lat[k], 99.9),
+          (unsigned long long)lat[k].max);
+      first = 0;
+    }
+    printf("}");
+    free(lat);
+  }
+  printf("}\n");
+  if (conf.resize_log) {
+    /* The log is complete as all threads are joined */
+    for (unsigned i = 0; i < resize_count && i < RESIZE_LOG_MAX; i ++) {
+      printf("{\"event\":\"resize\",\"engine\":\"%s\",\"rep\":%u,"
+          "\"phase\":\"%s\",\"at_ns\":%llu,\"old_buckets\":%u,"
+          "\"new_buckets\":%u,\"items\":%u,\"ns\":%llu}\n",
+          BENCH_ENGINE, rep, i < fill_resizes ? "fill" : "run",
+          (unsigned long long)resize_log[i].at_ns, resize_log[i].old_num,
+          resize_log[i].new_num, resize_log[i].items,
+          (unsigned long long)resize_log[i].ns);
+    }
+  }
+  fflush(stdout);
+
+  HASH_DESTROY(&head, bnode, hh, NULL);
+  free(run);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const char *locks[] = { "none", "rwlock", "mutex", "rwlock-prof",
+      "mutex-prof", NULL };
+  static const char *hashes[] = { "jenkins", "murmur", "xxhash", NULL };
+  static const char *keys[] = { "int", "u64", "str", "longstr", NULL };
+  static const char *dists[] = { "uniform", "zipf", NULL };
+  static const char *scenarios[] = { "mix", "churn", "growth", NULL };
+  struct bench_thread *threads;
+  unsigned nthreads;
+  int c, threads_set = 0;
+
+  while ((c = getopt(argc, argv,
+      "n:i:o:w:t:r:k:d:z:p:m:l:f:s:x:S:W:T:cLPeh")) != -1) {
+    switch (c) {
+    case 'n': conf.size = strtoul(optarg, NULL, 10); break;
+    case 'i': conf.initial = strtoul(optarg, NULL, 10); break;
+    case 'L': conf.latency = 1; break;
+    case 'P': conf.perf = 1; break;
+    case 'e': conf.resize_log = 1; break;
+    case 'o': conf.ops = strtoull(optarg, NULL, 10); break;
+    case 'w': conf.warmup = strtoull(optarg, NULL, 10); break;
+    case 't':
+      conf.threads = strtoul(optarg, NULL, 10);
+      threads_set = 1;
+      break;
+    case 'r': conf.reps = strtoul(optarg, NULL, 10); break;
+    case 'k': conf.keys = optarg; break;
+    case 'd': conf.dist = optarg; break;
+    case 'z': conf.theta = strtod(optarg, NULL); break;
+    case 'p': conf.hit = strtod(optarg, NULL); break;
+    case 'm':
+      if (sscanf(optarg, "%u:%u:%u:%u", &conf.mix[0], &conf.mix[1],
+          &conf.mix[2], &conf.mix[3]) != 4) usage(argv[0]);
+      break;
+    case 'l': conf.lock = optarg; break;
+    case 'f': conf.hash = optarg; break;
+    case 's': conf.seed = strtoull(optarg, NULL, 10); break;
+    case 'S': conf.scenario = optarg; break;
+    case 'W': conf.writers = strtoul(optarg, NULL, 10); break;
+    case 'T': conf.duration_ms = strtoul(optarg, NULL, 10); break;
+    case 'c': conf.sweep = 1; break;
+    case 'x': conf.trace = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (!one_of(conf.lock, locks) || !one_of(conf.hash, hashes) ||
+      !one_of(conf.keys, keys) || !one_of(conf.dist, dists) ||
+      !one_of(conf.scenario, scenarios) ||
+      conf.mix[0] + conf.mix[1] + conf.mix[2] + conf.mix[3] != 100 ||
+      conf.size == 0 || conf.threads == 0 || conf.theta == 1.0 ||
+      conf.initial > conf.size || conf.ops == 0) {
+    usage(argv[0]);
+  }
+  if (conf.trace != NULL) {
+    if (strcmp(conf.scenario, "mix") != 0) {
+      fprintf(stderr, "traces are replayed by the mix scenario only\n");
+      exit(EXIT_FAILURE);
+    }
+    trace_load(conf.trace);
+    conf.size = conf.initial = trace.nload;
+    conf.ops = trace.nquery;
+    conf.keys = conf.dist = "trace";
+    conf.mix[0] = 100;
+    conf.mix[1] = conf.mix[2] = conf.mix[3] = 0;
+  }
+  if (conf.initial == 0) conf.initial = conf.size;
+  conf.scen = strcmp(conf.scenario, "churn") == 0 ? BENCH_CHURN :
+      strcmp(conf.scenario, "growth") == 0 ? BENCH_GROWTH : BENCH_MIX;
+  if (conf.scen != BENCH_MIX &&
+      (conf.writers == 0 || conf.writers > conf.size)) {
+    fprintf(stderr, "scenarios need from 1 to size writers\n");
+    exit(EXIT_FAILURE);
+  }
+  if (conf.scen == BENCH_CHURN && conf.initial != conf.size) {
+    fprintf(stderr, "churn scenario keeps the table full, -i is not used\n");
+    exit(EXIT_FAILURE);
+  }
+  if (conf.sweep && !threads_set) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nw = conf.scen == BENCH_MIX ? 0 : conf.writers;
+    conf.threads = ncpu > nw + 1 ? ncpu - nw : 1;
+  }
+  nthreads = conf.threads + (conf.scen == BENCH_MIX ? 0 : conf.writers);
+  if (strcmp(conf.lock, "none") == 0 && nthreads > 1 &&
+      (conf.scen != BENCH_MIX || conf.mix[BENCH_OP_READ] != 100)) {
+    fprintf(stderr, "writers need locking with more than one thread\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (strcmp(conf.hash, "jenkins") == 0) bench_hashd.ht = &_hash_jenkins_bnode_hh;
+  else if (strcmp(conf.hash, "murmur") == 0) bench_hashd.ht = &_hash_murmur_bnode_hh;
+  else bench_hashd.ht = &_hash_xxhash_bnode_hh;
+
+  threads = calloc(nthreads, sizeof(*threads));
+  max_readers = conf.threads;
+  if (conf.trace == NULL) {
+    pool = malloc(sizeof(*pool) * conf.size * 2);
+    make_keys(conf.size * 2);
+  }
+  for (unsigned i = 0; i < nthreads; i ++) {
+    threads[i].id = i;
+    threads[i].writer = i >= max_readers;
+    if (conf.latency)
+      threads[i].lat = malloc(sizeof(struct lat_hist) * BENCH_OP_MAX);
+    if (!threads[i].writer) make_ops(&threads[i]);
+  }
+
+  /* Powers of two up to -t and -t itself */
+  for (unsigned n = conf.sweep ? 1 : conf.threads; ; n *= 2) {
+    if (n > conf.threads) n = conf.threads;
+    for (unsigned rep = 0; rep < conf.reps; rep ++) {
+      run_rep(threads, n, rep);
+    }
+    if (n == conf.threads) break;
+  }
+
+  for (unsigned i = 0; i < nthreads; i ++) {
+    free(threads[i].ops);
+    free(threads[i].lat);
+  }
+  free(threads);
+  free(keybuf);
+  if (trace.map != NULL) munmap((void *)trace.map, trace.len);
+  free(pool);
+
+  return EXIT_SUCCESS;
+}
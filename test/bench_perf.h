@@ -0,0 +1,165 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Hardware counters of the benchmark. Each counter is opened separately for
+ * the calling thread, so counters that are not supported by the CPU, the
+ * kernel or perf_event_paranoid are skipped and the rest are still reported.
+ * Counters are read with their enabled and running times, so values are
+ * scaled when the kernel multiplexes them.
+ */
+#ifndef BENCH_PERF_H_
+#define BENCH_PERF_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+enum bench_perf_counter {
+  BENCH_PERF_CYCLES = 0,
+  BENCH_PERF_INSTRUCTIONS,
+  BENCH_PERF_L1D_MISSES,
+  BENCH_PERF_LLC_MISSES,
+  BENCH_PERF_DTLB_MISSES,
+  BENCH_PERF_BRANCH_MISSES,
+  BENCH_PERF_MAX
+};
+
+static const char *bench_perf_names[BENCH_PERF_MAX] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+  "branch_misses"
+};
+
+struct bench_perf {
+  int fd[BENCH_PERF_MAX];
+  uint64_t val[BENCH_PERF_MAX];
+  unsigned valid; /* Mask of counters with values */
+};
+
+#ifdef __linux__
+
+#define BENCH_PERF_CACHE(cache, op, res)                                       \
+  ((PERF_COUNT_HW_CACHE_##cache) | ((PERF_COUNT_HW_CACHE_OP_##op) << 8) |      \
+  ((PERF_COUNT_HW_CACHE_RESULT_##res) << 16))
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} bench_perf_events[BENCH_PERF_MAX] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, BENCH_PERF_CACHE(L1D, READ, MISS) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HW_CACHE, BENCH_PERF_CACHE(DTLB, READ, MISS) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* Returns the number of counters opened for the calling thread */
+static unsigned
+bench_perf_open(struct bench_perf *p)
+{
+  struct perf_event_attr attr;
+  unsigned opened = 0;
+
+  p->valid = 0;
+  for (unsigned i = 0; i < BENCH_PERF_MAX; i ++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = bench_perf_events[i].type;
+    attr.config = bench_perf_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+    p->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    p->val[i] = 0;
+    if (p->fd[i] != -1) opened ++;
+  }
+
+  return opened;
+}
+
+static void
+bench_perf_start(struct bench_perf *p)
+{
+  for (unsigned i = 0; i < BENCH_PERF_MAX; i ++) {
+    if (p->fd[i] == -1) continue;
+    ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+/* Stops and closes counters, values are scaled by enabled/running time */
+static void
+bench_perf_stop(struct bench_perf *p)
+{
+  uint64_t buf[3];
+
+  for (unsigned i = 0; i < BENCH_PERF_MAX; i ++) {
+    if (p->fd[i] == -1) continue;
+    ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    /* Counters that were never scheduled are unknown */
+    if (read(p->fd[i], buf, sizeof(buf)) == sizeof(buf) && buf[2] != 0) {
+      p->val[i] = buf[2] < buf[1] ?
+          (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+      p->valid |= 1U << i;
+    }
+    close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+}
+
+#else
+
+static unsigned
+bench_perf_open(struct bench_perf *p)
+{
+  for (unsigned i = 0; i < BENCH_PERF_MAX; i ++) {
+    p->fd[i] = -1;
+    p->val[i] = 0;
+  }
+  p->valid = 0;
+
+  return 0;
+}
+
+static void
+bench_perf_start(struct bench_perf *p)
+{
+}
+
+static void
+bench_perf_stop(struct bench_perf *p)
+{
+}
+
+#endif
+
+#endif /* BENCH_PERF_H_ */
@@ -0,0 +1,96 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_PTHREAD_POOL_MIN_CHUNK 256
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 300000
+#define NEXTRA 100
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NELTS], extra[NEXTRA];
+
+int
+main(int argc, char **argv)
+{
+  hash_pthread_pool_t *pool;
+  struct hnode n, *found;
+  unsigned total = 0;
+
+  pool = hash_pthread_pool_create(3);
+  assert(pool != NULL);
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_INIT_PTHREAD_POOL(&head, pool);
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    nodes[i].value = i;
+  }
+  HASH_BUILD_PARALLEL(&head, hnode, hh, nodes, NELTS);
+
+  assert(head.num_items == NELTS);
+  for (unsigned i = 0; i < head.num_buckets; i ++) {
+    total += head.buckets[i].entries;
+  }
+  assert(total == NELTS);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == &nodes[i]);
+  }
+
+  /* Not empty table: elements are inserted one by one */
+  for (int i = 0; i < NEXTRA; i ++) {
+    extra[i].key = NELTS + i;
+    extra[i].value = i;
+  }
+  HASH_BUILD_PARALLEL(&head, hnode, hh, extra, NEXTRA);
+  assert(head.num_items == NELTS + NEXTRA);
+  n.key = 0;
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &nodes[0]);
+  n.key = NELTS + NEXTRA - 1;
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &extra[NEXTRA - 1]);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  hash_pthread_pool_destroy(pool);
+
+  return 0;
+}
@@ -0,0 +1,216 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash_cache.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 20000
+#define MAX_ITEMS 1000
+#define NHOT 64
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_CACHE_HEAD(, hnode, hh) head;
+unsigned nallocs, nfrees;
+
+struct hnode *
+node_new(int key, int value)
+{
+  struct hnode *n = calloc(1, sizeof(*n));
+
+  assert(n != NULL);
+  n->key = key;
+  n->value = value;
+  __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+
+  return n;
+}
+
+void
+node_free(struct hnode *n)
+{
+  __atomic_fetch_add(&nfrees, 1, __ATOMIC_RELAXED);
+  free(n);
+}
+
+size_t
+cached_bytes(void)
+{
+  size_t sum = 0;
+
+  for (unsigned i = 0; i < head.table.num_buckets; i ++) {
+    struct hnode *cur = head.table.buckets[i].first;
+
+    for (; cur != NULL; cur = cur->hh.next) sum += HASH_CACHE_SIZE(cur, hh);
+  }
+
+  return sum;
+}
+
+void
+test_items(void)
+{
+  struct hnode n, *elt, *found;
+  int hits = 0;
+
+  nallocs = nfrees = 0;
+  HASH_CACHE_INIT(&head, hnode, hh, MAX_ITEMS, 0, node_free);
+  HASH_INIT_PTHREAD_RWLOCK(HASH_CACHE_TABLE(&head), hnode, hh);
+
+  for (int i = 0; i < NHOT; i ++) {
+    elt = node_new(i, i);
+    HASH_CACHE_INSERT(&head, hnode, hh, elt, 0, found);
+    assert(found == NULL);
+  }
+  /* Cold keys stream through a cache, whilst hot keys are read all the time */
+  for (int i = NHOT; i < NELTS; i ++) {
+    elt = node_new(i, i);
+    HASH_CACHE_INSERT(&head, hnode, hh, elt, 0, found);
+    assert(found == NULL);
+    assert(HASH_CACHE_COUNT(&head) <= MAX_ITEMS);
+    n.key = i % NHOT;
+    HASH_CACHE_FIND_ELT(&head, hnode, hh, &n, found);
+  }
+  for (int i = 0; i < NHOT; i ++) {
+    n.key = i;
+    HASH_CACHE_FIND_ELT(&head, hnode, hh, &n, found);
+    if (found != NULL) hits ++;
+  }
+  assert(hits == NHOT);
+  assert(HASH_CACHE_COUNT(&head) == MAX_ITEMS);
+  assert(head.evictions == NELTS - MAX_ITEMS);
+  assert(nfrees == head.evictions);
+
+  /* An equal element is not inserted */
+  elt = node_new(0, -1);
+  HASH_CACHE_INSERT(&head, hnode, hh, elt, 0, found);
+  assert(found != NULL && found->value == 0);
+  node_free(elt);
+
+  n.key = 0;
+  HASH_CACHE_DELETE_ELT(&head, hnode, hh, &n);
+  HASH_CACHE_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == NULL);
+  assert(HASH_CACHE_COUNT(&head) == MAX_ITEMS - 1);
+
+  HASH_CACHE_DESTROY(&head, hnode, hh);
+  assert(nfrees == nallocs);
+}
+
+void
+test_bytes(void)
+{
+  struct hnode *elt, *found;
+  const size_t max_bytes = 64 * 1024;
+
+  nallocs = nfrees = 0;
+  HASH_CACHE_INIT(&head, hnode, hh, 0, max_bytes, node_free);
+
+  for (int i = 0; i < NELTS; i ++) {
+    elt = node_new(i, i);
+    HASH_CACHE_INSERT(&head, hnode, hh, elt, 16 + i % 512, found);
+    assert(HASH_CACHE_BYTES(&head) <= max_bytes);
+  }
+  assert(HASH_CACHE_BYTES(&head) == cached_bytes());
+  assert(HASH_CACHE_BYTES(&head) > max_bytes - 512);
+  assert(nfrees + HASH_CACHE_COUNT(&head) == nallocs);
+
+  HASH_CACHE_DESTROY(&head, hnode, hh);
+  assert(HASH_CACHE_BYTES(&head) == 0);
+  assert(nfrees == nallocs);
+}
+
+void *
+worker(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode n, copy, *elt, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    elt = node_new(base + i, base + i);
+    HASH_CACHE_INSERT(&head, hnode, hh, elt, sizeof(*elt), found);
+    assert(found == NULL);
+    n.key = base + i / 2;
+    HASH_CACHE_FIND_ELT_COPY(&head, hnode, hh, &n, &copy, found);
+    if (found != NULL) assert(copy.value == n.key);
+    if (i % 7 == 0) {
+      n.key = base + i - 3;
+      HASH_CACHE_DELETE_ELT(&head, hnode, hh, &n);
+    }
+  }
+
+  return NULL;
+}
+
+void
+test_threads(void)
+{
+  pthread_t th[NTHREADS];
+  hash_stats_t st;
+
+  nallocs = nfrees = 0;
+  HASH_CACHE_INIT(&head, hnode, hh, MAX_ITEMS, 0, node_free);
+  HASH_CACHE_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  HASH_CACHE_EVICT(&head, hnode, hh);
+  assert(HASH_CACHE_COUNT(&head) <= MAX_ITEMS);
+  assert(nfrees + HASH_CACHE_COUNT(&head) == nallocs);
+  assert(HASH_CACHE_BYTES(&head) ==
+      HASH_CACHE_COUNT(&head) * sizeof(struct hnode));
+  HASH_CACHE_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == HASH_CACHE_COUNT(&head));
+
+  HASH_CACHE_DESTROY(&head, hnode, hh);
+  assert(nfrees == nallocs);
+}
+
+int
+main(int argc, char **argv)
+{
+  test_items();
+  test_bytes();
+  test_threads();
+
+  printf("PASS\n");
+
+  return 0;
+}
@@ -0,0 +1,230 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash_chained_lockfree.h"
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 50000
+/* Keys of the hot set, all threads insert and delete them */
+#define NHOT 8
+#define HOT_ROUNDS 20000
+
+/* Murmur string hash depends on the seed, unlike the integer one */
+struct snode {
+  const char *key;
+  HASH_ENTRY(snode) hh;
+};
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_GENERATE_STR(snode, hh, key);
+HASH_LOCKFREE_GENERATE(snode, hh);
+HASH_LOCKFREE_GENERATE(hnode, hh);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+HASH_HEAD(, snode, hh) shead;
+struct hnode *nodes;
+unsigned nallocs = 0, nfrees = 0;
+
+static void
+merge_value(struct hnode *existing, struct hnode *elm)
+{
+  __atomic_fetch_add(&existing->value, elm->value, __ATOMIC_RELAXED);
+}
+
+static void
+free_node(struct hnode *n)
+{
+  __atomic_fetch_add(&nfrees, 1, __ATOMIC_RELAXED);
+  free(n);
+}
+
+/* Threads insert, look up and delete the same few keys */
+void *
+hot_worker(void *arg)
+{
+  unsigned seed = (unsigned)(intptr_t)arg;
+  struct hnode n, *elt, *found;
+  unsigned epoch;
+
+  for (int i = 0; i < HOT_ROUNDS; i ++) {
+    n.key = rand_r(&seed) % NHOT;
+    switch (rand_r(&seed) % 3) {
+    case 0:
+      elt = malloc(sizeof(*elt));
+      elt->key = n.key;
+      elt->value = n.key;
+      HASH_FIND_OR_INSERT(&head, hnode, hh, elt, found);
+      if (found != NULL) free(elt);
+      else __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+      break;
+    case 1:
+      HASH_DELETE_ELT_FREE(&head, hnode, hh, &n, free_node);
+      break;
+    default:
+      epoch = HASH_LF_ENTER(&head);
+      HASH_FIND_ELT(&head, hnode, hh, &n, found);
+      /* Could be deleted meanwhile, but is not freed yet */
+      if (found != NULL) assert(found->key == n.key);
+      HASH_LF_EXIT(&head, epoch);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+void *
+worker(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode *elts = &nodes[base], n, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    elts[i].key = base + i;
+    elts[i].value = base + i;
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &elts[i], found);
+    assert(found == NULL);
+  }
+  /* Remove odd keys and add a value to even ones */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    n.value = 1;
+    if (i % 2) HASH_DELETE_ELT(&head, hnode, hh, &n);
+    else HASH_UPSERT(&head, hnode, hh, &n, merge_value);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    if (i % 2 == 0) assert(found == &elts[i] && found->value == n.key + 1);
+    else assert(found == NULL);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  struct hnode n, *found;
+  struct snode sn[3] = {{.key = "alpha"}, {.key = "beta"}, {.key = "gamma"}},
+      sk, *sfound;
+  hash_stats_t st;
+
+  nodes = calloc(NTHREADS * NELTS, sizeof(*nodes));
+  assert(nodes != NULL);
+
+  /* Single thread */
+  HASH_INIT(&head, hnode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == &nodes[i]);
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &n, found);
+    assert(found == &nodes[i]);
+  }
+  for (int i = 0; i < NELTS; i += 2) {
+    n.key = i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS / 2 && st.expands > 0);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert((found != NULL) == (i % 2 == 1));
+  }
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /* Hot keys: elements are freed once, all of them by the end */
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, hot_worker, (void *)(intptr_t)(i + 1));
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+  /* Keys are unique */
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items <= NHOT);
+  for (int i = 0; i < NHOT; i ++) {
+    n.key = i;
+    HASH_DELETE_ELT_FREE(&head, hnode, hh, &n, free_node);
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == NULL);
+  }
+  HASH_LF_SYNCHRONIZE(&head);
+  HASH_DESTROY(&head, hnode, hh, free_node);
+  assert(nfrees == nallocs);
+
+  /* Elements inserted before the table exists use the seeded hash */
+  HASH_INIT(&shead, snode, hh);
+  for (int i = 0; i < 3; i ++) {
+    HASH_INSERT(&shead, snode, hh, &sn[i]);
+  }
+  for (int i = 0; i < 3; i ++) {
+    sk.key = sn[i].key;
+    HASH_FIND_ELT(&shead, snode, hh, &sk, sfound);
+    assert(sfound == &sn[i]);
+  }
+  HASH_DESTROY(&shead, snode, hh, NULL);
+
+  /* Concurrent writers with expansions */
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NTHREADS * NELTS / 2);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  free(nodes);
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "hash_closed_lockfree.h"
+#include "hash.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 50000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_LOCKFREE_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+pthread_barrier_t barrier;
+unsigned ninserted = 0;
+
+void *
+fail_alloc(size_t len, void *d)
+{
+  return NULL;
+}
+
+void *
+worker(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+  struct hnode n, *found;
+
+  /* All threads insert the same keys, so duplicates must be rejected */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = (i * 7 + id) % NELTS;
+    n.value = n.key + 1;
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &n, found);
+    if (found == NULL) __atomic_fetch_add(&ninserted, 1, __ATOMIC_RELAXED);
+    else assert(found->key == n.key);
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found != NULL && found->value == n.key + 1);
+  }
+  pthread_barrier_wait(&barrier);
+  /* Every thread removes its own part of keys */
+  for (int i = id; i < NELTS; i += NTHREADS) {
+    n.key = i;
+    if (i % 3 == 0) HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  struct hnode n, *found;
+
+  HASH_INIT(&head, hnode, hh);
+  pthread_barrier_init(&barrier, NULL, NTHREADS);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  assert(ninserted == NELTS);
+
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    if (i % 3 == 0) assert(found == NULL);
+    else assert(found != NULL && found->value == i + 1);
+  }
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /* An element that could not be stored is returned as `found` */
+  HASH_INIT(&head, hnode, hh);
+  head.ops->alloc = fail_alloc;
+  n.key = 1;
+  HASH_FIND_OR_INSERT(&head, hnode, hh, &n, found);
+  assert(found == &n);
+  head.ops->alloc = NULL;
+  HASH_FIND_OR_INSERT(&head, hnode, hh, &n, found);
+  assert(found == NULL);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define HASH_CLOSED_SHARDS_LOG2 4
+#include "hash_closed.h"
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 20000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+
+void *
+writer(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode n, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    n.value = n.key * 2;
+    HASH_INSERT(&head, hnode, hh, &n);
+  }
+  /* Remove odd keys */
+  for (int i = 1; i < NELTS; i += 2) {
+    n.key = base + i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    struct hnode cp;
+    n.key = base + i;
+    HASH_FIND_ELT_COPY(&head, hnode, hh, &n, &cp, found);
+    if (i % 2 == 0) assert(found != NULL && found->value == n.key * 2);
+    else assert(found == NULL);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  unsigned total = 0;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_MUTEX(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, writer, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  for (unsigned s = 0; s < HASH_CLOSED_SHARDS; s ++) {
+    total += head.shards[s].n_occupied - head.shards[s].n_deleted;
+  }
+  assert(total == NTHREADS * NELTS / 2);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_CUCKOO_SHARDS_LOG2 2
+#include "hash_cuckoo.h"
+#include "test_stress.h"
+
+#define NSAME 64
+/* Top bits select the first shard */
+#define SAME_HV 0x1234U
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *found;
+  hash_stats_t st;
+  unsigned stored = 0;
+
+  stress_fill(&st);
+  /* Elements are in one of their two buckets or in the stash */
+  assert(st.max_chain <= 3);
+  assert(st.probe_hist[1] + st.probe_hist[2] + st.probe_hist[3] ==
+      st.num_items);
+  /* Shards grow at high load rather than on failed insertions */
+  assert(min_load > 900);
+  stress_delete();
+
+  /*
+   * Elements sharing a hash value fill their buckets and the stash, further
+   * ones are refused without growing the table
+   */
+  HASH_INIT(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  for (int i = 0; i < NSAME; i ++) {
+    n.key = i;
+    HASH_FIND_OR_INSERT_HV(&head, hnode, hh, &n, SAME_HV, found);
+    if (found == NULL) stored ++;
+    else assert(found == &n);
+  }
+  assert(stored >= HASH_CUCKOO_SLOTS + HASH_CUCKOO_STASH);
+  assert(stored <= HASH_CUCKOO_SLOTS * 2 + HASH_CUCKOO_STASH);
+  for (int i = 0; i < NSAME; i ++) {
+    n.key = i;
+    HASH_FIND_ELT_HV(&head, hnode, hh, &n, SAME_HV, found);
+    assert((found != NULL) == ((unsigned)i < stored));
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == stored && st.expands == 0);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  stress_threads();
+
+  return 0;
+}
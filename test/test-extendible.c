@@ -0,0 +1,256 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash_extendible.h"
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 50000
+#define HOT_BITS 8
+
+/* Murmur string hash depends on the seed, unlike the integer one */
+struct snode {
+  const char *key;
+  HASH_ENTRY(snode) hh;
+};
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_GENERATE_STR(snode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+HASH_HEAD(, snode, hh) shead;
+struct hnode *nodes;
+unsigned nsplits = 0;
+
+static void
+merge_value(struct hnode *existing, struct hnode *elm)
+{
+  existing->value += elm->value;
+}
+
+/* Each split adds a single page, splits of different pages run in parallel */
+static void
+on_expand(unsigned old_num, unsigned new_num, unsigned items, uint64_t ns,
+    void *d)
+{
+  assert(new_num == old_num + HASH_EXTENDIBLE_PAGE_BUCKETS);
+  __atomic_fetch_add(&nsplits, 1, __ATOMIC_RELAXED);
+}
+
+void *
+worker(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode *elts = &nodes[base], n, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    elts[i].key = base + i;
+    elts[i].value = base + i;
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &elts[i], found);
+    assert(found == NULL);
+    /* Pages are split by other threads meanwhile */
+    n.key = base + i / 2;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == &elts[i / 2]);
+  }
+  /* Remove odd keys and add a value to even ones */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    n.value = 1;
+    if (i % 2) HASH_DELETE_ELT(&head, hnode, hh, &n);
+    else HASH_UPSERT(&head, hnode, hh, &n, merge_value);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    if (i % 2 == 0) assert(found != NULL && found->value == n.key + 1);
+    else assert(found == NULL);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  struct hnode n, *found;
+  struct snode sn[3] = {{.key = "alpha"}, {.key = "beta"}, {.key = "gamma"}},
+      sk, *sfound;
+  hash_stats_t st;
+  unsigned pages;
+
+  nodes = calloc(NTHREADS * NELTS, sizeof(*nodes));
+  assert(nodes != NULL);
+
+  /* Single thread: lookups, deletions and growth by splits */
+  HASH_INIT(&head, hnode, hh);
+  HASH_ON_EXPAND(&head, on_expand, NULL);
+  for (int i = 0; i < NELTS * 4; i ++) {
+    nodes[i].key = i;
+    nodes[i].value = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  for (int i = 0; i < NELTS * 4; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == &nodes[i]);
+    n.key = -i - 1;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == NULL);
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS * 4);
+  assert(st.expands == nsplits && nsplits > 0);
+  assert(st.num_buckets == (nsplits + 1) * HASH_EXTENDIBLE_PAGE_BUCKETS);
+  /* Pages are split at HASH_EXTENDIBLE_PAGE_LOAD, so they are half full */
+  assert(st.load_factor > HASH_EXTENDIBLE_PAGE_LOAD / 2.0 * 0.6);
+  assert(st.load_factor <= HASH_EXTENDIBLE_PAGE_LOAD);
+
+  for (int i = 0; i < NELTS * 4; i += 2) {
+    n.key = i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+  for (int i = 0; i < NELTS * 4; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert((found != NULL) == (i % 2 == 1));
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS * 2);
+
+  /* Explicit expansion splits every page once */
+  pages = st.num_buckets / HASH_EXTENDIBLE_PAGE_BUCKETS;
+  HASH_EXPAND_BUCKETS(&head, hnode, hh);
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_buckets == pages * 2 * HASH_EXTENDIBLE_PAGE_BUCKETS);
+  assert(st.num_items == NELTS * 2);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /*
+   * Hot region: all hash values share their low HOT_BITS bits, so merely
+   * pages of that region are split and other slots of the directory share
+   * a few empty pages
+   */
+  HASH_INIT(&head, hnode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    HASH_TYPE hv = ((HASH_TYPE)i * 2654435761U) << HOT_BITS;
+    nodes[i].key = i;
+    HASH_INSERT_HV(&head, hnode, hh, &nodes[i], hv);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    HASH_TYPE hv = ((HASH_TYPE)i * 2654435761U) << HOT_BITS;
+    n.key = i;
+    HASH_FIND_ELT_HV(&head, hnode, hh, &n, hv, found);
+    assert(found == &nodes[i]);
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(head.depth > HOT_BITS);
+  assert(st.num_buckets / HASH_EXTENDIBLE_PAGE_BUCKETS <
+      2 * NELTS / HASH_EXTENDIBLE_PAGE_MAX + 2 * HOT_BITS);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /*
+   * Duplicate keys and colliding hash values cannot be separated by a split,
+   * so their page stays overfull rather than doubling the directory
+   */
+  HASH_INIT(&head, hnode, hh);
+  for (unsigned i = 0; i < HASH_EXTENDIBLE_PAGE_MAX * 4; i ++) {
+    nodes[i].key = 7;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  assert(head.depth == 0 && head.num_pages == 1);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  HASH_INIT(&head, hnode, hh);
+  for (unsigned i = HASH_EXTENDIBLE_PAGE_MAX * 4;
+      i < HASH_EXTENDIBLE_PAGE_MAX * 8; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT_HV(&head, hnode, hh, &nodes[i], 0x5bd1e995);
+  }
+  assert(head.depth == 0 && head.num_pages == 1);
+  for (unsigned i = HASH_EXTENDIBLE_PAGE_MAX * 4;
+      i < HASH_EXTENDIBLE_PAGE_MAX * 8; i ++) {
+    n.key = i;
+    HASH_FIND_ELT_HV(&head, hnode, hh, &n, 0x5bd1e995, found);
+    assert(found == &nodes[i]);
+  }
+  /*
+   * Other elements are still split off the overfull page, which takes about
+   * log2 of their number directory bits
+   */
+  for (int i = HASH_EXTENDIBLE_PAGE_MAX * 8; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS - HASH_EXTENDIBLE_PAGE_MAX * 4);
+  assert(head.depth < 20);
+  assert(st.num_buckets / HASH_EXTENDIBLE_PAGE_BUCKETS >
+      NELTS / HASH_EXTENDIBLE_PAGE_MAX / 2);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /* Elements inserted before the table exists use the seeded hash */
+  HASH_INIT(&shead, snode, hh);
+  for (int i = 0; i < 3; i ++) {
+    HASH_INSERT(&shead, snode, hh, &sn[i]);
+  }
+  for (int i = 0; i < 3; i ++) {
+    sk.key = sn[i].key;
+    HASH_FIND_ELT(&shead, snode, hh, &sk, sfound);
+    assert(sfound == &sn[i]);
+  }
+  HASH_DESTROY(&shead, snode, hh, NULL);
+
+  /* Concurrent writers and readers */
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NTHREADS * NELTS / 2);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  free(nodes);
+
+  return 0;
+}
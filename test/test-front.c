@@ -0,0 +1,303 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_FRONT_CACHE
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+
+#define NTHREADS 3
+#define NELTS 10000
+#define NHOT 64
+#define NROUNDS 20000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head, other;
+struct hnode nodes[NELTS], dup, redup, hot[NHOT];
+/* Odd while a key is being changed, the key is present if it is 2 mod 4 */
+unsigned versions[NHOT];
+int done;
+/* Lookups completed by each reader, deleted elements are freed once all move */
+unsigned long quiescent[NTHREADS];
+struct hnode *elts[NHOT];
+
+/* Whether a lookup of `n` would be served by the front cache */
+int
+front_cached(void *h, struct hnode *n)
+{
+  HASH_TYPE hv = HASH_HASH_ELT((HASH_HEAD(, hnode, hh) *)h, n);
+
+  return _HASH_FRONT_ENTRY(hnode, hh, hv)->id ==
+      ((HASH_HEAD(, hnode, hh) *)h)->front_id &&
+      _HASH_FRONT_ENTRY(hnode, hh, hv)->hval == hv;
+}
+
+int
+test_odd(struct hnode *node, void *d)
+{
+  return node->key % 2 == 0;
+}
+
+void
+test_keep(struct hnode *node, void *d)
+{
+}
+
+void *
+reader(void *arg)
+{
+  struct hnode n, *found;
+  unsigned v1, v2;
+
+  while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+    for (int i = 0; i < NHOT; i ++) {
+      n.key = NELTS + i;
+      v1 = __atomic_load_n(&versions[i], __ATOMIC_ACQUIRE);
+      HASH_FIND_ELT(&head, hnode, hh, &n, found);
+      v2 = __atomic_load_n(&versions[i], __ATOMIC_ACQUIRE);
+      if (v1 == v2 && v1 % 2 == 0) {
+        assert((found != NULL) == (v1 % 4 == 2));
+        if (found != NULL) assert(found == &hot[i]);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void *
+writer(void *arg)
+{
+  struct hnode n;
+
+  for (int r = 0; r < NROUNDS; r ++) {
+    int i = r % NHOT;
+    __atomic_fetch_add(&versions[i], 1, __ATOMIC_ACQ_REL);
+    if (versions[i] % 4 == 1) {
+      HASH_INSERT(&head, hnode, hh, &hot[i]);
+    }
+    else {
+      n.key = NELTS + i;
+      HASH_DELETE_ELT(&head, hnode, hh, &n);
+    }
+    __atomic_fetch_add(&versions[i], 1, __ATOMIC_ACQ_REL);
+  }
+
+  return NULL;
+}
+
+/* Looks up keys whose elements are freed by `freeing_writer` */
+void *
+freeing_reader(void *arg)
+{
+  unsigned long *q = &quiescent[(intptr_t)arg];
+  struct hnode n, *found;
+
+  while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+    for (int i = 0; i < NHOT; i ++) {
+      n.key = NELTS + i;
+      HASH_FIND_ELT(&head, hnode, hh, &n, found);
+      if (found != NULL) assert(found->key == n.key);
+      __atomic_store_n(q, *q + 1, __ATOMIC_RELEASE);
+    }
+    sched_yield();
+  }
+
+  return NULL;
+}
+
+/*
+ * Deletes and frees elements, waiting for every reader to finish a lookup
+ * first: removed elements could still be compared by lookups in progress
+ */
+void *
+freeing_writer(void *arg)
+{
+  struct hnode n;
+  unsigned long snap[NTHREADS];
+
+  for (int r = 0; r < NROUNDS / 10; r ++) {
+    int i = r % NHOT;
+    n.key = NELTS + i;
+    if (elts[i] == NULL) {
+      elts[i] = malloc(sizeof(*elts[i]));
+      assert(elts[i] != NULL);
+      elts[i]->key = n.key;
+      HASH_INSERT(&head, hnode, hh, elts[i]);
+      continue;
+    }
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+    for (int t = 0; t < NTHREADS; t ++) {
+      snap[t] = __atomic_load_n(&quiescent[t], __ATOMIC_ACQUIRE);
+    }
+    for (int t = 0; t < NTHREADS; t ++) {
+      while (__atomic_load_n(&quiescent[t], __ATOMIC_ACQUIRE) == snap[t]) {
+        sched_yield();
+      }
+    }
+    memset(elts[i], 0xa5, sizeof(*elts[i]));
+    free(elts[i]);
+    elts[i] = NULL;
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *found;
+  pthread_t th[NTHREADS + 1];
+  unsigned nbuckets;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT(&other, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  HASH_MAKE_TABLE(&other);
+
+  for (int i = 0; i < NELTS / 10; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  n.key = 1;
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &nodes[1] && front_cached(&head, &n));
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &nodes[1]);
+  /* Other tables of the same type are not served from entries of `head` */
+  HASH_FIND_ELT(&other, hnode, hh, &n, found);
+  assert(found == NULL);
+
+  /* A newer element with the same key hides the cached one */
+  n.key = 1;
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  dup.key = 1;
+  HASH_INSERT(&head, hnode, hh, &dup);
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &dup);
+  HASH_DELETE_ELT(&head, hnode, hh, &n);
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &nodes[1]);
+  HASH_DELETE_ELT(&head, hnode, hh, &n);
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == NULL);
+
+  /* Cached elements stay valid through expansions */
+  nbuckets = head.num_buckets;
+  for (int i = NELTS / 10; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+    n.key = i / 2;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(n.key == 1 ? found == NULL : found == &nodes[n.key]);
+  }
+  assert(head.num_buckets > nbuckets);
+
+  /* Filtered elements are not returned */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  }
+  HASH_FILTER_FUNC(&head, hnode, hh, test_odd, test_keep, NULL);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(i % 2 == 0 ? found == &nodes[i] : found == NULL);
+  }
+
+  /* Neither are elements of a destroyed and remade table */
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  HASH_MAKE_TABLE(&head);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == NULL);
+  }
+
+  /* A head destroyed and initialized again at the same address as well */
+  dup.key = 7;
+  HASH_INSERT(&other, hnode, hh, &dup);
+  n.key = 7;
+  HASH_FIND_ELT(&other, hnode, hh, &n, found);
+  assert(found == &dup && front_cached(&other, &n));
+  HASH_DESTROY(&other, hnode, hh, NULL);
+  HASH_INIT(&other, hnode, hh);
+  redup.key = 7;
+  HASH_INSERT(&other, hnode, hh, &redup);
+  HASH_FIND_ELT(&other, hnode, hh, &n, found);
+  assert(found == &redup);
+
+  /* Readers never see keys that were deleted before their lookups */
+  for (int i = 0; i < NHOT; i ++) {
+    hot[i].key = NELTS + i;
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, reader, NULL);
+  }
+  pthread_create(&th[NTHREADS], NULL, writer, NULL);
+  pthread_join(th[NTHREADS], NULL);
+  __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  /* Writers free deleted elements once lookups in progress have finished */
+  for (int i = 0; i < NHOT; i ++) {
+    HASH_DELETE_ELT(&head, hnode, hh, &hot[i]);
+  }
+  __atomic_store_n(&done, 0, __ATOMIC_RELAXED);
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, freeing_reader, (void *)(intptr_t)i);
+  }
+  pthread_create(&th[NTHREADS], NULL, freeing_writer, NULL);
+  pthread_join(th[NTHREADS], NULL);
+  __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+  for (int i = 0; i < NHOT; i ++) {
+    if (elts[i] != NULL) {
+      HASH_DELETE_ELT(&head, hnode, hh, elts[i]);
+      free(elts[i]);
+    }
+  }
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  HASH_DESTROY(&other, hnode, hh, NULL);
+  printf("PASS\n");
+
+  return 0;
+}
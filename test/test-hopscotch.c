@@ -0,0 +1,109 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_HOPSCOTCH_SHARDS_LOG2 2
+#include "hash_hopscotch.h"
+#include "test_stress.h"
+
+/* Hash values with zero top bits are stored in the first shard */
+#define HOME 16U
+#define H HASH_HOPSCOTCH_H
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *found, elts[H + 1];
+  hash_stats_t st;
+  __typeof(&head.shards[0]) sh = &head.shards[0];
+  unsigned nbuckets;
+
+  stress_fill(&st);
+  /* Elements are in neighborhoods of their home slots */
+  assert(st.max_chain <= H);
+  /* Shards grow at high load rather than on failed insertions */
+  assert(min_load > 850);
+  stress_delete();
+
+  /*
+   * Every slot of the neighborhood of HOME holds an element of its own home,
+   * so the closest free slot is H slots away and the element of HOME + 1
+   * hops there to make room for a new element of HOME
+   */
+  HASH_INIT(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  for (int i = 0; i < 3; i ++) {
+    HASH_EXPAND_BUCKETS(&head, hnode, hh);
+  }
+  nbuckets = sh->n_buckets;
+  for (unsigned d = 0; d < H; d ++) {
+    elts[d].key = d;
+    HASH_INSERT_HV(&head, hnode, hh, &elts[d], HOME + d);
+  }
+  n.key = H;
+  HASH_FIND_OR_INSERT_HV(&head, hnode, hh, &n, HOME, found);
+  assert(found == NULL && sh->n_buckets == nbuckets);
+  assert(sh->nodes[HOME + 1].key == H && sh->nodes[HOME + H].key == 1);
+  assert(sh->nodes[HOME].hh.hop == 0x3);
+  assert(sh->nodes[HOME + 1].hh.hop == 1U << (H - 1));
+  for (unsigned d = 0; d <= H; d ++) {
+    n.key = d;
+    HASH_FIND_ELT_HV(&head, hnode, hh, &n, d == H ? HOME : HOME + d, found);
+    assert(found != NULL && found->key == (int)d);
+  }
+
+  /* Deletions clear the bits of their slots in bitmaps of home slots */
+  n.key = H;
+  HASH_DELETE_ELT_HV(&head, hnode, hh, &n, HOME);
+  assert(sh->nodes[HOME].hh.hop == 0x1);
+  n.key = 1;
+  HASH_DELETE_ELT_HV(&head, hnode, hh, &n, HOME + 1);
+  assert(sh->nodes[HOME + 1].hh.hop == 0);
+  for (unsigned d = 0; d <= H; d ++) {
+    n.key = d;
+    HASH_FIND_ELT_HV(&head, hnode, hh, &n, d == H ? HOME : HOME + d, found);
+    assert((found != NULL) == (d != 1 && d != H));
+  }
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /* Elements sharing a hash value are refused once they fill a neighborhood */
+  HASH_INIT(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  for (unsigned i = 0; i <= H; i ++) {
+    n.key = i;
+    HASH_FIND_OR_INSERT_HV(&head, hnode, hh, &n, HOME, found);
+    assert(i < H ? found == NULL : found == &n);
+  }
+  nbuckets = sh->n_buckets;
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == H);
+  /* Ones sharing merely low bits are refused after a few doublings */
+  n.key = H + 1;
+  HASH_FIND_OR_INSERT_HV(&head, hnode, hh, &n, HOME | (1U << 20), found);
+  assert(found == &n);
+  assert(sh->n_buckets == nbuckets << HASH_HOPSCOTCH_MAX_GROW);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  stress_threads();
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 10000
+#define KEYLEN 16
+
+/* Murmur string hash depends on the seed, unlike the integer one */
+struct hnode {
+  char key[KEYLEN];
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_STR(hnode, hh, key);
+
+HASH_HEAD(, hnode, hh) primary, secondary;
+struct hnode pnodes[NELTS], snodes[NELTS];
+
+void
+make_key(char *key, int i)
+{
+  memset(key, 0, KEYLEN);
+  snprintf(key, KEYLEN, "key-%d", i);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *found;
+  char key[KEYLEN];
+  HASH_TYPE hv;
+
+  /* Hash values computed before the table exists are those of the table */
+  HASH_INIT(&primary, hnode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    make_key(pnodes[i].key, i);
+    hv = HASH_HASH(&primary, hnode, hh, pnodes[i].key);
+    HASH_INSERT_HV(&primary, hnode, hh, &pnodes[i], hv);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    make_key(n.key, i);
+    HASH_FIND_ELT(&primary, hnode, hh, &n, found);
+    assert(found == &pnodes[i]);
+  }
+
+  /* Making another table of the same type must not reseed the hash */
+  HASH_INIT(&secondary, hnode, hh);
+  HASH_MAKE_TABLE(&secondary);
+  for (int i = 0; i < NELTS; i ++) {
+    make_key(n.key, i);
+    HASH_FIND_ELT(&primary, hnode, hh, &n, found);
+    assert(found == &pnodes[i]);
+  }
+
+  /* A key hashed once is routed to both tables */
+  for (int i = 0; i < NELTS; i ++) {
+    make_key(key, i);
+    hv = HASH_HASH(&primary, hnode, hh, key);
+    make_key(n.key, i);
+    assert(hv == HASH_HASH_ELT(&secondary, &n));
+    make_key(snodes[i].key, i);
+    HASH_INSERT_HV(&secondary, hnode, hh, &snodes[i], hv);
+    HASH_FIND_ELT_HV(&primary, hnode, hh, &n, hv, found);
+    assert(found == &pnodes[i]);
+    HASH_FIND_ELT_HV(&secondary, hnode, hh, &n, hv, found);
+    assert(found == &snodes[i]);
+  }
+  assert(secondary.num_items == NELTS);
+
+  for (int i = 0; i < NELTS; i += 2) {
+    make_key(n.key, i);
+    hv = HASH_HASH_ELT(&primary, &n);
+    HASH_DELETE_ELT_HV(&primary, hnode, hh, &n, hv);
+    HASH_FIND_OR_INSERT_HV(&secondary, hnode, hh, &n, hv, found);
+    assert(found == &snodes[i]);
+  }
+  assert(primary.num_items == NELTS / 2);
+  for (int i = 0; i < NELTS; i ++) {
+    make_key(n.key, i);
+    HASH_FIND_ELT(&primary, hnode, hh, &n, found);
+    assert((found == NULL) == (i % 2 == 0));
+  }
+
+  HASH_DESTROY(&primary, hnode, hh, NULL);
+  HASH_DESTROY(&secondary, hnode, hh, NULL);
+
+  return 0;
+}
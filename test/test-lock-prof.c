@@ -0,0 +1,127 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define NELTS 1000
+#define HOLD_US 20000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+
+HASH_HEAD(, hnode, hh) head;
+hash_pthread_prof_t prof;
+struct hnode nodes[NELTS];
+
+void *
+reader(void *arg)
+{
+  struct hnode n, *found;
+
+  n.key = (int)(intptr_t)arg;
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &nodes[n.key]);
+
+  return NULL;
+}
+
+/* Run a lookup of `key` whilst the caller holds some lock for HOLD_US */
+static void
+contend(int key, void (*unlock)(void *), void *arg)
+{
+  pthread_t th;
+
+  pthread_create(&th, NULL, reader, (void *)(intptr_t)key);
+  usleep(HOLD_US);
+  unlock(arg);
+  pthread_join(th, NULL);
+}
+
+static void
+unlock_table(void *arg)
+{
+  HASH_UNLOCK_WRITE(&head);
+}
+
+static void
+unlock_bucket(void *arg)
+{
+  HASH_UNLOCK_NODE_WRITE(&head, (_hash_node_t *)arg);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n;
+  _hash_node_t *bkt;
+  HASH_TYPE hv;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_PROF_MUTEX(&head, &prof);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  /* Nothing is contended by a single thread */
+  HASH_PTHREAD_PROF_COLLECT(&head, &prof);
+  assert(prof.global.waits == 0 && prof.bucket.waits == 0);
+  assert(prof.ntop == 0);
+
+  HASH_LOCK_WRITE(&head);
+  contend(1, unlock_table, NULL);
+  assert(prof.global.waits == 1 && prof.bucket.waits == 0);
+  assert(prof.global.max_wait_ns >= HOLD_US * 1000ULL / 2);
+
+  n.key = 2;
+  hv = HASH_HASH_ELT(&head, &n);
+  bkt = HASH_FIND_BKT(head.buckets, head.num_buckets, hv);
+  for (int i = 0; i < 3; i ++) {
+    HASH_LOCK_NODE_WRITE(&head, bkt);
+    contend(2, unlock_bucket, bkt);
+  }
+  assert(prof.global.waits == 1 && prof.bucket.waits == 3);
+  assert(prof.bucket.wait_ns >= prof.bucket.max_wait_ns);
+
+  HASH_PTHREAD_PROF_COLLECT(&head, &prof);
+  assert(prof.ntop == 1);
+  assert(prof.top[0].bucket == bkt - head.buckets);
+  assert(prof.top[0].waits == 3);
+  hash_pthread_prof_dump(&prof, stdout);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
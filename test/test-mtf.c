@@ -0,0 +1,217 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_MOVE_TO_FRONT
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 3
+#define NELTS 20000
+#define NHOT 64
+#define NDUPS 3
+#define NROUNDS 200
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) plain, head;
+struct hnode nodes[NELTS], locked[NELTS], dups[NHOT][NDUPS], cold[NELTS];
+int hot[NHOT];
+
+/* Position of `key` in its chain */
+int
+chain_pos(void *h, int key)
+{
+  HASH_HEAD(, hnode, hh) *t = h;
+  struct hnode n, *cur;
+  int pos = 0;
+
+  n.key = key;
+  cur = HASH_FIND_BKT(t->buckets, t->num_buckets,
+      t->ops->hash_func(&n, t->ops->hashd))->first;
+  for (; cur != NULL && cur->key != key; cur = cur->hh.next) pos ++;
+  assert(cur != NULL);
+
+  return pos;
+}
+
+int
+is_hot(int key)
+{
+  for (int i = 0; i < NHOT; i ++) {
+    if (hot[i] == key) return 1;
+  }
+
+  return 0;
+}
+
+/* Hot keys could only be behind other hot keys of their bucket */
+void
+check_hot(void *h)
+{
+  HASH_HEAD(, hnode, hh) *t = h;
+  struct hnode n, *cur;
+
+  for (int i = 0; i < NHOT; i ++) {
+    n.key = hot[i];
+    cur = HASH_FIND_BKT(t->buckets, t->num_buckets,
+        t->ops->hash_func(&n, t->ops->hashd))->first;
+    for (; cur->key != hot[i]; cur = cur->hh.next) assert(is_hot(cur->key));
+  }
+}
+
+void
+lookup_hot(void *h, int rounds)
+{
+  HASH_HEAD(, hnode, hh) *t = h;
+  struct hnode n, *found;
+
+  for (int r = 0; r < rounds; r ++) {
+    for (int i = 0; i < NHOT; i ++) {
+      n.key = hot[i];
+      HASH_FIND_ELT(t, hnode, hh, &n, found);
+      assert(found != NULL && found->key == hot[i]);
+    }
+  }
+}
+
+void *
+reader(void *arg)
+{
+  struct hnode n, *found;
+
+  lookup_hot(&head, NROUNDS * 10);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found != NULL && found->key == i);
+  }
+
+  return NULL;
+}
+
+void *
+writer(void *arg)
+{
+  for (int r = 0; r < 5; r ++) {
+    for (int i = 0; i < NELTS; i ++) {
+      cold[i].key = NELTS + i;
+      HASH_INSERT(&head, hnode, hh, &cold[i]);
+    }
+    for (int i = 0; i < NELTS; i ++) {
+      HASH_DELETE_ELT(&head, hnode, hh, &cold[i]);
+    }
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *cur;
+  pthread_t th[NTHREADS + 1];
+  int nhot = 0, deep = 0;
+  unsigned cnt;
+
+  HASH_INIT(&plain, hnode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&plain, hnode, hh, &nodes[i]);
+  }
+
+  /* Hot keys are taken deep in their chains */
+  for (int i = 0; i < NELTS && nhot < NHOT; i ++) {
+    if (chain_pos(&plain, i) >= 2) {
+      hot[nhot ++] = i;
+      deep += chain_pos(&plain, i);
+    }
+  }
+  assert(nhot == NHOT && deep >= 2 * NHOT);
+
+  lookup_hot(&plain, NROUNDS);
+  check_hot(&plain);
+  assert(plain.num_items == NELTS);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&plain, hnode, hh, &n, cur);
+    assert(cur == &nodes[i]);
+  }
+
+  /* Runs of equal keys are moved as a whole */
+  for (int i = 0; i < NHOT; i ++) {
+    for (int d = 0; d < NDUPS; d ++) {
+      dups[i][d].key = hot[i];
+      dups[i][d].value = d;
+      HASH_INSERT_MULTI(&plain, hnode, hh, &dups[i][d]);
+    }
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&plain, hnode, hh, &n, cur);
+  }
+  lookup_hot(&plain, NROUNDS);
+  for (int i = 0; i < NHOT; i ++) {
+    n.key = hot[i];
+    HASH_COUNT_KEY(&plain, hnode, hh, &n, cnt);
+    assert(cnt == NDUPS + 1);
+  }
+  check_hot(&plain);
+
+  /* Locks set below are in ops shared by the type, so `plain` goes first */
+  HASH_DESTROY(&plain, hnode, hh, NULL);
+
+  /* Lookups move elements concurrently with writers of the same buckets */
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+  for (int i = 0; i < NELTS; i ++) {
+    locked[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &locked[i]);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, reader, NULL);
+  }
+  pthread_create(&th[NTHREADS], NULL, writer, NULL);
+  for (int i = 0; i <= NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+  assert(head.num_items == NELTS);
+  lookup_hot(&head, NROUNDS);
+  check_hot(&head);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  printf("PASS\n");
+
+  return 0;
+}
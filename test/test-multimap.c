@@ -0,0 +1,190 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NKEYS 2000
+#define MAXDUPS 8
+#define NELTS (NKEYS * MAXDUPS)
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NELTS], shared[NTHREADS][NKEYS];
+unsigned nfrees;
+
+unsigned
+ndups(int key)
+{
+  return key % MAXDUPS + 1;
+}
+
+int
+test_sum(struct hnode *node, long *sum)
+{
+  *sum += node->value;
+
+  return 1;
+}
+
+int
+test_first(struct hnode *node, int *calls)
+{
+  (*calls) ++;
+
+  return 0;
+}
+
+void
+node_free(struct hnode *node)
+{
+  nfrees ++;
+}
+
+/* Elements of every key form one run of their chain */
+void
+check_runs(void)
+{
+  for (unsigned b = 0; b < head.num_buckets; b ++) {
+    struct hnode *cur = head.buckets[b].first, *prev = NULL, *it;
+
+    for (; cur != NULL; prev = cur, cur = cur->hh.next) {
+      if (prev != NULL && prev->key == cur->key) continue;
+      for (it = cur->hh.next; it != NULL; it = it->hh.next) {
+        if (it->key == cur->key) {
+          for (struct hnode *r = cur; r != it; r = r->hh.next) {
+            assert(r->key == cur->key);
+          }
+        }
+      }
+    }
+  }
+}
+
+void *
+writer(void *arg)
+{
+  int t = (int)(intptr_t)arg;
+
+  for (int k = 0; k < NKEYS; k ++) {
+    shared[t][k].key = NKEYS + k;
+    shared[t][k].value = 1;
+    HASH_INSERT_MULTI(&head, hnode, hh, &shared[t][k]);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n;
+  unsigned cnt, nitems = 0, expected = 0;
+  long sum;
+  int calls = 0;
+  pthread_t th[NTHREADS];
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  /* Postings of different keys are inserted interleaved */
+  for (unsigned d = 0; d < MAXDUPS; d ++) {
+    for (int k = 0; k < NKEYS; k ++) {
+      if (d >= ndups(k)) continue;
+      nodes[nitems].key = k;
+      nodes[nitems].value = d + 1;
+      HASH_INSERT_MULTI(&head, hnode, hh, &nodes[nitems]);
+      nitems ++;
+    }
+  }
+  assert(head.num_items == nitems);
+  assert(head.expands > 0);
+  check_runs();
+
+  for (int k = 0; k < NKEYS; k ++) {
+    n.key = k;
+    HASH_COUNT_KEY(&head, hnode, hh, &n, cnt);
+    assert(cnt == ndups(k));
+    sum = 0;
+    HASH_FIND_ALL(&head, hnode, hh, &n, test_sum, &sum);
+    assert(sum == ndups(k) * (ndups(k) + 1) / 2);
+  }
+  n.key = NKEYS * 10;
+  HASH_COUNT_KEY(&head, hnode, hh, &n, cnt);
+  assert(cnt == 0);
+
+  n.key = MAXDUPS - 1;
+  HASH_FIND_ALL(&head, hnode, hh, &n, test_first, &calls);
+  assert(calls == 1);
+
+  /* Runs of even keys are removed, odd keys are kept */
+  for (int k = 0; k < NKEYS; k += 2) {
+    n.key = k;
+    HASH_DELETE_ALL(&head, hnode, hh, &n, node_free);
+    HASH_COUNT_KEY(&head, hnode, hh, &n, cnt);
+    assert(cnt == 0);
+    nitems -= ndups(k);
+    expected += ndups(k);
+  }
+  assert(head.num_items == nitems);
+  assert(nfrees == expected);
+  for (int k = 1; k < NKEYS; k += 2) {
+    n.key = k;
+    HASH_COUNT_KEY(&head, hnode, hh, &n, cnt);
+    assert(cnt == ndups(k));
+  }
+  check_runs();
+
+  /* Concurrent writers add postings to the same keys */
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, writer, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+  check_runs();
+  for (int k = 0; k < NKEYS; k ++) {
+    n.key = NKEYS + k;
+    HASH_COUNT_KEY(&head, hnode, hh, &n, cnt);
+    assert(cnt == NTHREADS);
+  }
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  printf("PASS\n");
+
+  return 0;
+}
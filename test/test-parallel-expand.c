@@ -0,0 +1,102 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_PARALLEL_EXPAND_THRESH 1024
+#define HASH_PTHREAD_POOL_MIN_CHUNK 64
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 2
+#define NELTS 200000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NTHREADS * NELTS];
+
+void *
+writer(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[base + i].key = base + i;
+    nodes[base + i].value = base + i;
+    HASH_INSERT(&head, hnode, hh, &nodes[base + i]);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  hash_pthread_pool_t *pool;
+  struct hnode n, *found;
+  unsigned total = 0;
+
+  pool = hash_pthread_pool_create(3);
+  assert(pool != NULL);
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_INIT_PTHREAD_POOL(&head, pool);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, writer, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  assert(head.num_items == NTHREADS * NELTS);
+  assert(head.num_buckets > HASH_PARALLEL_EXPAND_THRESH);
+  for (unsigned i = 0; i < head.num_buckets; i ++) {
+    total += head.buckets[i].entries;
+  }
+  assert(total == NTHREADS * NELTS);
+
+  for (int i = 0; i < NTHREADS * NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == &nodes[i]);
+  }
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  hash_pthread_pool_destroy(pool);
+
+  return 0;
+}
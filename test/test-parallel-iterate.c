@@ -0,0 +1,145 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_PTHREAD_POOL_MIN_CHUNK 64
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 100000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+struct stat_acc {
+  long sum;
+  unsigned count;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NELTS];
+
+int
+test_count(struct hnode *node, unsigned *cnt)
+{
+  __atomic_fetch_add(cnt, 1, __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+int
+test_stop(struct hnode *node, unsigned *cnt)
+{
+  return __atomic_add_fetch(cnt, 1, __ATOMIC_RELAXED) < 10;
+}
+
+int
+test_reduce(struct hnode *node, struct stat_acc *local, void *unused)
+{
+  local->sum += node->value;
+  local->count ++;
+
+  return 1;
+}
+
+void
+test_merge(struct stat_acc *acc, struct stat_acc *local, void *unused)
+{
+  acc->sum += local->sum;
+  acc->count += local->count;
+}
+
+int
+test_filter(struct hnode *node, void *unused)
+{
+  return node->value % 2 == 0;
+}
+
+void
+test_free(struct hnode *node, unsigned *freed)
+{
+  assert(node->value % 2 == 1);
+  node->value = -1;
+  __atomic_fetch_add(freed, 1, __ATOMIC_RELAXED);
+}
+
+int
+main(int argc, char **argv)
+{
+  hash_pthread_pool_t *pool;
+  struct stat_acc acc;
+  struct hnode n, *found;
+  unsigned cnt = 0, freed = 0;
+
+  pool = hash_pthread_pool_create(3);
+  assert(pool != NULL);
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_MUTEX(&head, hnode, hh);
+  HASH_INIT_PTHREAD_POOL(&head, pool);
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    nodes[i].value = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+
+  HASH_ITERATE_PARALLEL(&head, hnode, hh, test_count, &cnt);
+  assert(cnt == NELTS);
+
+  cnt = 0;
+  HASH_ITERATE_PARALLEL(&head, hnode, hh, test_stop, &cnt);
+  assert(cnt >= 10 && cnt < NELTS);
+
+  memset(&acc, 0, sizeof(acc));
+  HASH_REDUCE_PARALLEL(&head, hnode, hh, test_reduce, test_merge, &acc,
+      sizeof(acc), NULL);
+  assert(acc.count == NELTS);
+  assert(acc.sum == (long)NELTS * (NELTS - 1) / 2);
+
+  /* Now filter odd elements */
+  HASH_FILTER_PARALLEL(&head, hnode, hh, test_filter, test_free, &freed);
+  assert(freed == NELTS / 2);
+  assert(head.num_items == NELTS / 2);
+
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    if (i % 2 == 0) assert(found == &nodes[i]);
+    else assert(found == NULL && nodes[i].value == -1);
+  }
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  hash_pthread_pool_destroy(pool);
+
+  return 0;
+}
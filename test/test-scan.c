@@ -0,0 +1,169 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 10000
+#define NGROW 100000
+#define SCAN_COUNT 16
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NELTS], grow[NGROW];
+unsigned seen[NELTS];
+volatile int done;
+
+int
+test_seen(struct hnode *node, void *d)
+{
+  if (node->key < NELTS) {
+    __atomic_fetch_add(&seen[node->key], 1, __ATOMIC_RELAXED);
+  }
+
+  return 1;
+}
+
+int
+test_stop(struct hnode *node, unsigned *calls)
+{
+  (*calls) ++;
+
+  return 0;
+}
+
+unsigned
+scan_all(int (*between)(unsigned step))
+{
+  unsigned cursor = 0, steps = 0;
+
+  memset(seen, 0, sizeof(seen));
+  do {
+    HASH_SCAN(&head, hnode, hh, cursor, SCAN_COUNT, test_seen, NULL);
+    steps ++;
+    if (between != NULL) between(steps);
+  } while (cursor != 0);
+  for (int i = 0; i < NELTS; i ++) {
+    assert(seen[i] >= 1);
+  }
+
+  return steps;
+}
+
+/* Grows the table whilst a scan is in progress */
+int
+grow_step(unsigned step)
+{
+  for (unsigned i = (step - 1) * 1000; i < step * 1000 && i < NGROW; i ++) {
+    grow[i].key = NELTS + i;
+    HASH_INSERT(&head, hnode, hh, &grow[i]);
+  }
+
+  return 1;
+}
+
+void *
+writer(void *arg)
+{
+  struct hnode n;
+
+  while (!done) {
+    for (int i = 0; i < NGROW && !done; i ++) {
+      grow[i].key = NELTS + i;
+      HASH_INSERT(&head, hnode, hh, &grow[i]);
+    }
+    for (int i = 0; i < NGROW && !done; i ++) {
+      n.key = NELTS + i;
+      HASH_DELETE_ELT(&head, hnode, hh, &n);
+    }
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n;
+  unsigned cursor, steps, nbuckets;
+  unsigned calls = 0;
+  pthread_t th;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+
+  cursor = 1;
+  HASH_SCAN(&head, hnode, hh, cursor, SCAN_COUNT, test_seen, NULL);
+  assert(cursor == 0);
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+
+  /* A stable table is visited once per bucket */
+  steps = scan_all(NULL);
+  assert(steps == (head.num_buckets + SCAN_COUNT - 1) / SCAN_COUNT);
+  for (int i = 0; i < NELTS; i ++) {
+    assert(seen[i] == 1);
+  }
+
+  /* Callbacks returning 0 end a call after the current bucket */
+  cursor = 0;
+  HASH_SCAN(&head, hnode, hh, cursor, SCAN_COUNT, test_stop, &calls);
+  assert(cursor != 0 && calls > 0 && calls == head.buckets[0].entries);
+
+  /* Expansions between calls do not hide elements */
+  nbuckets = head.num_buckets;
+  scan_all(grow_step);
+  assert(head.num_buckets > nbuckets * 4);
+  for (int i = 0; i < NGROW; i ++) {
+    n.key = NELTS + i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+
+  /* A writer inserts, deletes and expands concurrently */
+  pthread_create(&th, NULL, writer, NULL);
+  for (int i = 0; i < 10; i ++) {
+    scan_all(NULL);
+  }
+  done = 1;
+  pthread_join(th, NULL);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+  printf("PASS\n");
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_sharded.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 1000
+#define NSHARDS 4
+
+/* Murmur string hash depends on the seed, unlike the integer one */
+struct snode {
+  char key[16];
+  HASH_ENTRY(snode) hh;
+};
+
+HASH_GENERATE_STR(snode, hh, key);
+
+HASH_HEAD(, snode, hh) head;
+HASH_SHARDED_HEAD(, snode, hh, NSHARDS) sharded;
+struct snode nodes[NELTS];
+
+int
+main(int argc, char **argv)
+{
+  struct snode n, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    snprintf(nodes[i].key, sizeof(nodes[i].key), "key-%d", i);
+  }
+
+  /* The first insertion creates the table, its element must be found */
+  HASH_INIT(&head, snode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    HASH_INSERT(&head, snode, hh, &nodes[i]);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    strcpy(n.key, nodes[i].key);
+    HASH_FIND_ELT(&head, snode, hh, &n, found);
+    assert(found == &nodes[i]);
+  }
+  HASH_DESTROY(&head, snode, hh, NULL);
+
+  HASH_SHARDED_INIT(&sharded, snode, hh);
+  for (int i = 0; i < NELTS; i ++) {
+    HASH_SHARDED_INSERT(&sharded, snode, hh, &nodes[i]);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    strcpy(n.key, nodes[i].key);
+    HASH_SHARDED_FIND_ELT(&sharded, snode, hh, &n, found);
+    assert(found == &nodes[i]);
+  }
+  HASH_SHARDED_DESTROY(&sharded, snode, hh, NULL);
+  printf("PASS\n");
+
+  return 0;
+}
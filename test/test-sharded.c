@@ -0,0 +1,134 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_sharded.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 20000
+#define NSHARDS 16
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_SHARDED_HEAD(, hnode, hh, NSHARDS) head;
+struct hnode nodes[NTHREADS * NELTS];
+
+int
+test_sum(struct hnode *node, long *sum)
+{
+  *sum += node->value;
+
+  return 1;
+}
+
+int
+test_stop(struct hnode *node, int *cnt)
+{
+  return ++(*cnt) < 10;
+}
+
+void *
+writer(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode n, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[base + i].key = base + i;
+    nodes[base + i].value = 1;
+    HASH_SHARDED_INSERT(&head, hnode, hh, &nodes[base + i]);
+  }
+  /* Remove odd keys */
+  for (int i = 1; i < NELTS; i += 2) {
+    n.key = base + i;
+    HASH_SHARDED_DELETE_ELT(&head, hnode, hh, &n);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    HASH_SHARDED_FIND_ELT(&head, hnode, hh, &n, found);
+    if (i % 2 == 0) assert(found == &nodes[base + i]);
+    else assert(found == NULL);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  long sum = 0;
+  int cnt = 0, used = 0;
+  unsigned nitems;
+  hash_stats_t st;
+
+  assert(sizeof(head.shards[0]) % HASH_SHARD_CACHELINE == 0);
+
+  HASH_SHARDED_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(HASH_SHARDED_SUB(&head, 0), hnode, hh);
+  HASH_SHARDED_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, writer, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  HASH_SHARDED_COUNT(&head, nitems);
+  assert(nitems == NTHREADS * NELTS / 2);
+  for (int s = 0; s < NSHARDS; s ++) {
+    if (head.shards[s].num_items > 0) used ++;
+  }
+  assert(used == NSHARDS);
+
+  HASH_SHARDED_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NTHREADS * NELTS / 2);
+  assert(st.num_buckets >= NSHARDS * HASH_INITIAL_NUM_BUCKETS);
+
+  HASH_SHARDED_ITERATE_FUNC(&head, hnode, hh, test_sum, &sum);
+  assert(sum == NTHREADS * NELTS / 2);
+
+  HASH_SHARDED_ITERATE_FUNC(&head, hnode, hh, test_stop, &cnt);
+  assert(cnt == 10);
+
+  HASH_SHARDED_CLEANUP_NODES(&head, hnode, hh, NULL);
+  HASH_SHARDED_COUNT(&head, nitems);
+  assert(nitems == 0);
+
+  HASH_SHARDED_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
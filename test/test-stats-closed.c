@@ -0,0 +1,95 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_PROBE_STATS 1
+#define HASH_CLOSED_SHARDS_LOG2 2
+#include "hash_closed.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 100000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+
+HASH_HEAD(, hnode, hh) head;
+
+static void
+check_hist(const unsigned *hist, unsigned total)
+{
+  unsigned sum = 0;
+
+  for (unsigned i = 0; i < HASH_STATS_HIST_SIZE; i ++) sum += hist[i];
+  assert(sum == total);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n;
+  hash_stats_t st;
+  unsigned slots = 0;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_INSERT(&head, hnode, hh, &n);
+  }
+  for (int i = 0; i < NELTS; i += 4) {
+    n.key = i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  for (unsigned s = 0; s < HASH_CLOSED_SHARDS; s ++)
+    slots += head.shards[s].n_buckets;
+  assert(st.num_items == NELTS - NELTS / 4);
+  assert(st.num_buckets == slots);
+  assert(st.deleted_buckets == NELTS / 4);
+  assert(st.num_items + st.empty_buckets + st.deleted_buckets == slots);
+  assert(st.expands > 0 && st.expand_ns > 0);
+  check_hist(st.chain_hist, 0);
+  check_hist(st.probe_hist, st.num_items);
+  assert(st.max_chain >= 1);
+  /* Inserts and deletes probe too, every probe sequence could be sampled */
+  check_hist(st.sampled_hist, (NELTS + NELTS / 4) >> HASH_PROBE_SAMPLE_LOG2);
+
+  printf("items: %u, slots: %u, load: %.2f, deleted: %u, longest probe: %u, "
+      "expands: %u (%llu ns)\n", st.num_items, st.num_buckets,
+      st.load_factor, st.deleted_buckets, st.max_chain, st.expands,
+      (unsigned long long)st.expand_ns);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HASH_PROBE_STATS 1
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NELTS 100000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+
+HASH_HEAD(, hnode, hh) head;
+struct hnode nodes[NELTS];
+
+static unsigned nexpands;
+static uint64_t expand_ns;
+
+static void
+count_expand(unsigned old_num, unsigned new_num, unsigned items, uint64_t ns,
+    void *d)
+{
+  assert(new_num == old_num * 2);
+  assert(items > old_num);
+  nexpands ++;
+  expand_ns += ns;
+}
+
+static void
+check_hist(const unsigned *hist, unsigned total)
+{
+  unsigned sum = 0;
+
+  for (unsigned i = 0; i < HASH_STATS_HIST_SIZE; i ++) sum += hist[i];
+  assert(sum == total);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct hnode n, *found;
+  hash_stats_t st;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_ON_EXPAND(&head, count_expand, NULL);
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == 0 && st.num_buckets == 0);
+
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[i].key = i;
+    HASH_INSERT(&head, hnode, hh, &nodes[i]);
+  }
+  for (int i = 0; i < NELTS * 2; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert((found != NULL) == (i < NELTS));
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS);
+  assert(st.num_buckets == head.num_buckets);
+  assert(st.expands > 0 && st.expands == head.expands);
+  assert(st.expand_ns > 0);
+  assert(nexpands == st.expands && expand_ns == st.expand_ns);
+  assert(st.load_factor == (double)NELTS / head.num_buckets);
+  check_hist(st.chain_hist, st.num_buckets);
+  check_hist(st.probe_hist, st.num_items);
+  assert(st.chain_hist[0] == st.empty_buckets);
+  assert(st.max_chain > 0 && st.max_chain <= HASH_BKT_CAPACITY_THRESH * 2);
+  /* One in 2^HASH_PROBE_SAMPLE_LOG2 lookups is sampled */
+  check_hist(st.sampled_hist, (NELTS * 2) >> HASH_PROBE_SAMPLE_LOG2);
+  assert(st.sampled_probes > 0);
+
+  printf("items: %u, buckets: %u, load: %.2f, empty: %u, longest: %u, "
+      "expands: %u (%llu ns)\n", st.num_items, st.num_buckets,
+      st.load_factor, st.empty_buckets, st.max_chain, st.expands,
+      (unsigned long long)st.expand_ns);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  return 0;
+}
@@ -0,0 +1,211 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_ttl.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 20000
+#define GONE UINT64_MAX
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+  HASH_TTL_ENTRY(hnode) ttl;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+HASH_TTL_GENERATE(hnode, hh, ttl);
+
+HASH_TTL_HEAD(, hnode, hh) head;
+unsigned nallocs, nfrees;
+/* Elements freed by HASH_TTL_EXPIRE of a thread should be due by this tick */
+__thread uint64_t expire_now;
+__thread int expiring;
+
+struct hnode *
+node_new(int key, uint64_t deadline)
+{
+  struct hnode *n = calloc(1, sizeof(*n));
+
+  assert(n != NULL);
+  n->key = key;
+  n->value = key;
+  n->ttl.deadline = deadline;
+  __atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+
+  return n;
+}
+
+void
+node_free(struct hnode *n)
+{
+  if (expiring) assert(n->ttl.deadline <= expire_now);
+  __atomic_fetch_add(&nfrees, 1, __ATOMIC_RELAXED);
+  free(n);
+}
+
+unsigned
+expire(uint64_t now)
+{
+  unsigned n;
+
+  expire_now = now;
+  expiring = 1;
+  HASH_TTL_EXPIRE(&head, hnode, hh, ttl, now, n);
+  expiring = 0;
+
+  return n;
+}
+
+void
+test_expire(uint64_t origin, uint64_t start, uint64_t span)
+{
+  static uint64_t deadlines[NELTS];
+  struct hnode n, *elt, *found;
+  unsigned due, total = 0;
+  uint64_t now;
+
+  nallocs = nfrees = 0;
+  HASH_TTL_INIT(&head, hnode, hh, node_free);
+  HASH_INIT_PTHREAD_RWLOCK(HASH_TTL_TABLE(&head), hnode, hh);
+  HASH_TTL_MAKE_TABLE(&head, origin);
+
+  srand(NELTS);
+  for (int i = 0; i < NELTS; i ++) {
+    deadlines[i] = start + (uint64_t)rand() * rand() % span;
+    elt = node_new(i, deadlines[i]);
+    HASH_TTL_INSERT(&head, hnode, hh, ttl, elt, deadlines[i], found);
+    assert(found == NULL);
+  }
+  /* Some deadlines are moved and some elements are deleted before expiring */
+  for (int i = 0; i < NELTS; i += 10) {
+    n.key = i;
+    deadlines[i] = start + span - 1 - deadlines[i] % 1000;
+    HASH_TTL_SET_DEADLINE(&head, hnode, hh, ttl, &n, deadlines[i], found);
+    assert(found != NULL && found->ttl.deadline == deadlines[i]);
+  }
+  for (int i = 5; i < NELTS; i += 10) {
+    n.key = i;
+    HASH_TTL_DELETE_ELT(&head, hnode, hh, ttl, &n);
+    deadlines[i] = GONE;
+  }
+  assert(HASH_TTL_COUNT(&head) == NELTS - NELTS / 10);
+
+  for (now = start; total < NELTS - NELTS / 10; now += 1 + rand() % (span / 50)) {
+    due = 0;
+    for (int i = 0; i < NELTS; i ++) {
+      if (deadlines[i] != GONE && deadlines[i] <= now) {
+        due ++;
+        deadlines[i] = GONE;
+      }
+    }
+    assert(expire(now) == due);
+    total += due;
+    assert(HASH_TTL_COUNT(&head) == NELTS - NELTS / 10 - total);
+    for (int i = 0; i < NELTS; i += 97) {
+      n.key = i;
+      HASH_TTL_FIND_ELT(&head, hnode, hh, ttl, &n, now, found);
+      assert((found != NULL) == (deadlines[i] != GONE));
+    }
+  }
+  assert(nfrees == nallocs);
+
+  HASH_TTL_DESTROY(&head, hnode, hh);
+}
+
+void *
+writer(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode n, *elt, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    elt = node_new(base + i, 1 + i % 5000);
+    HASH_TTL_INSERT(&head, hnode, hh, ttl, elt, elt->ttl.deadline, found);
+    assert(found == NULL);
+    if (i % 3 == 0) {
+      n.key = base + i / 2;
+      HASH_TTL_DELETE_ELT(&head, hnode, hh, ttl, &n);
+    }
+  }
+
+  return NULL;
+}
+
+void *
+expirer(void *arg)
+{
+  for (uint64_t now = 0; now < 5000; now += 10) {
+    expire(now);
+  }
+
+  return NULL;
+}
+
+void
+test_threads(void)
+{
+  pthread_t th[NTHREADS + 1];
+
+  nallocs = nfrees = 0;
+  HASH_TTL_INIT(&head, hnode, hh, node_free);
+  HASH_TTL_MAKE_TABLE(&head, 0);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, writer, (void *)(intptr_t)i);
+  }
+  pthread_create(&th[NTHREADS], NULL, expirer, NULL);
+  for (int i = 0; i <= NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  expire(5000);
+  assert(HASH_TTL_COUNT(&head) == 0);
+  assert(nfrees == nallocs);
+
+  HASH_TTL_DESTROY(&head, hnode, hh);
+}
+
+int
+main(int argc, char **argv)
+{
+  test_expire(0, 0, 1000);
+  test_expire(12345, 12345, 1 << 20);
+  /* Deadlines past the horizon of wheels are cascaded again */
+  test_expire(1ULL << 40, 1ULL << 40, HASH_TTL_HORIZON * 4);
+  /* Wheels far behind the clock are rebuilt */
+  test_expire(0, 1ULL << 40, 1 << 16);
+  test_threads();
+
+  printf("PASS\n");
+
+  return 0;
+}
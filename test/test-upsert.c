@@ -0,0 +1,150 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 20000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+/* Murmur string hash depends on the seed, unlike the integer one */
+struct snode {
+  const char *key;
+  int value;
+  HASH_ENTRY(snode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+HASH_GENERATE_STR(snode, hh, key);
+
+HASH_HEAD(, hnode, hh) head;
+HASH_HEAD(, snode, hh) shead;
+struct hnode nodes[NTHREADS][NELTS];
+unsigned ninserted = 0;
+
+static void
+merge_value(struct hnode *existing, struct hnode *elm)
+{
+  existing->value += elm->value;
+}
+
+static void
+merge_svalue(struct snode *existing, struct snode *elm)
+{
+  existing->value += elm->value;
+}
+
+void *
+worker(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+  struct hnode n, *found;
+
+  /* All threads try to insert the same keys, only one insertion must win */
+  for (int i = 0; i < NELTS; i ++) {
+    nodes[id][i].key = i;
+    nodes[id][i].value = 0;
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &nodes[id][i], found);
+    if (found == NULL) __atomic_fetch_add(&ninserted, 1, __ATOMIC_RELAXED);
+    else assert(found->key == i && found != &nodes[id][i]);
+  }
+  /* Every thread adds one to each key */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    n.value = 1;
+    HASH_UPSERT(&head, hnode, hh, &n, merge_value);
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t th[NTHREADS];
+  struct hnode n, *found;
+  struct snode sa = {.key = "alpha", .value = 1}, sk, *sfound,
+      sb = {.key = "beta", .value = 1}, sc = {.key = "alpha", .value = 1};
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_MUTEX(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  assert(ninserted == NELTS);
+  assert(head.num_items == NELTS);
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found != NULL && found->value == NTHREADS);
+  }
+
+  /* Upsert of a new key inserts it */
+  n.key = NELTS;
+  n.value = 42;
+  HASH_UPSERT(&head, hnode, hh, &n, merge_value);
+  HASH_FIND_ELT(&head, hnode, hh, &n, found);
+  assert(found == &n);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+
+  /* The first find-or-insert or upsert creates the table of a seeded hash */
+  HASH_INIT(&shead, snode, hh);
+  HASH_FIND_OR_INSERT(&shead, snode, hh, &sa, sfound);
+  assert(sfound == NULL);
+  sk.key = "alpha";
+  HASH_FIND_ELT(&shead, snode, hh, &sk, sfound);
+  assert(sfound == &sa);
+  HASH_DESTROY(&shead, snode, hh, NULL);
+
+  HASH_INIT(&shead, snode, hh);
+  HASH_UPSERT(&shead, snode, hh, &sb, merge_svalue);
+  HASH_UPSERT(&shead, snode, hh, &sa, merge_svalue);
+  HASH_UPSERT(&shead, snode, hh, &sc, merge_svalue);
+  sk.key = "beta";
+  HASH_FIND_ELT(&shead, snode, hh, &sk, sfound);
+  assert(sfound == &sb && sb.value == 1);
+  sk.key = "alpha";
+  HASH_FIND_ELT(&shead, snode, hh, &sk, sfound);
+  assert(sfound == &sa && sa.value == 2);
+  HASH_DESTROY(&shead, snode, hh, NULL);
+
+  return 0;
+}
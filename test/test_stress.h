@@ -0,0 +1,190 @@
+/* Copyright (c) 2014, Vsevolod Stakhov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *       * Redistributions of source code must retain the above copyright
+ *         notice, this list of conditions and the following disclaimer.
+ *       * Redistributions in binary form must reproduce the above copyright
+ *         notice, this list of conditions and the following disclaimer in the
+ *         documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks shared by tables storing elements inside of their shards, included
+ * after hash_cuckoo.h or hash_hopscotch.h: single threaded replacing,
+ * lookups and deletions, and concurrent writers of a sharded table.
+ */
+#ifndef TEST_STRESS_H_
+#define TEST_STRESS_H_
+
+#include "hash.h"
+#include "hash_pthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NTHREADS 4
+#define NELTS 50000
+
+struct hnode {
+  int key;
+  int value;
+  HASH_ENTRY(hnode) hh;
+};
+
+HASH_GENERATE_INT(hnode, hh, key);
+HASH_PTHREAD_GENERATE(hnode, hh);
+
+HASH_HEAD(, hnode, hh) head;
+/* Shards grow under their own locks, so callbacks could run concurrently */
+unsigned nexpands = 0;
+/* The lowest load of a shard when it had to grow, in 1/1000 */
+unsigned min_load = 1000;
+
+static void
+merge_value(struct hnode *existing, struct hnode *elm)
+{
+  existing->value += elm->value;
+}
+
+/* Load of a shard when it has to grow, ignoring tiny shards */
+static void
+on_expand(unsigned old_num, unsigned new_num, unsigned items, uint64_t ns,
+    void *d)
+{
+  unsigned load = (uint64_t)items * 1000 / old_num, cur;
+
+  assert(new_num >= old_num * 2);
+  if (old_num >= 4096) {
+    cur = __atomic_load_n(&min_load, __ATOMIC_RELAXED);
+    while (load < cur && !__atomic_compare_exchange_n(&min_load, &cur, load,
+        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  }
+  __atomic_fetch_add(&nexpands, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Fills a new table with NELTS * 4 elements replacing one of them and checks
+ * lookups, `st` is set to statistics of the full table
+ */
+static void
+stress_fill(hash_stats_t *st)
+{
+  struct hnode n, *found;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_ON_EXPAND(&head, on_expand, NULL);
+  for (int i = 0; i < NELTS * 4; i ++) {
+    n.key = i;
+    n.value = i;
+    HASH_INSERT(&head, hnode, hh, &n);
+  }
+  n.key = 7;
+  n.value = -1;
+  HASH_INSERT(&head, hnode, hh, &n);
+  for (int i = 0; i < NELTS * 4; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found != NULL && found->key == i);
+    assert(found->value == (i == 7 ? -1 : i));
+    n.key = -i - 1;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert(found == NULL);
+  }
+
+  HASH_STATS(&head, hnode, hh, st);
+  assert(st->num_items == NELTS * 4);
+  assert(st->expands == nexpands && nexpands > 0);
+}
+
+/* Deletes every other element of the table filled by stress_fill */
+static void
+stress_delete(void)
+{
+  struct hnode n, *found;
+  hash_stats_t st;
+
+  for (int i = 0; i < NELTS * 4; i += 2) {
+    n.key = i;
+    HASH_DELETE_ELT(&head, hnode, hh, &n);
+  }
+  for (int i = 0; i < NELTS * 4; i ++) {
+    n.key = i;
+    HASH_FIND_ELT(&head, hnode, hh, &n, found);
+    assert((found != NULL) == (i % 2 == 1));
+  }
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NELTS * 2);
+  HASH_DESTROY(&head, hnode, hh, NULL);
+}
+
+static void *
+stress_worker(void *arg)
+{
+  int base = (int)(intptr_t)arg * NELTS;
+  struct hnode n, cp, *found;
+
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    n.value = n.key;
+    HASH_FIND_OR_INSERT(&head, hnode, hh, &n, found);
+    assert(found == NULL);
+  }
+  /* Remove odd keys and add a value to even ones */
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    n.value = 1;
+    if (i % 2) HASH_DELETE_ELT(&head, hnode, hh, &n);
+    else HASH_UPSERT(&head, hnode, hh, &n, merge_value);
+  }
+  for (int i = 0; i < NELTS; i ++) {
+    n.key = base + i;
+    HASH_FIND_ELT_COPY(&head, hnode, hh, &n, &cp, found);
+    if (i % 2 == 0) assert(found != NULL && cp.value == n.key + 1);
+    else assert(found == NULL);
+  }
+
+  return NULL;
+}
+
+/* Concurrent writers of a sharded table */
+static void
+stress_threads(void)
+{
+  pthread_t th[NTHREADS];
+  hash_stats_t st;
+  unsigned before = nexpands;
+
+  HASH_INIT(&head, hnode, hh);
+  HASH_INIT_PTHREAD_RWLOCK(&head, hnode, hh);
+  HASH_MAKE_TABLE(&head);
+
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_create(&th[i], NULL, stress_worker, (void *)(intptr_t)i);
+  }
+  for (int i = 0; i < NTHREADS; i ++) {
+    pthread_join(th[i], NULL);
+  }
+
+  HASH_STATS(&head, hnode, hh, &st);
+  assert(st.num_items == NTHREADS * NELTS / 2);
+  /* Expansions are counted by callbacks of all shards */
+  assert(st.expands == nexpands - before && st.expands > 0);
+
+  HASH_DESTROY(&head, hnode, hh, NULL);
+}
+
+#endif /* TEST_STRESS_H_ */